@@ -0,0 +1,423 @@
+#include <buffalo/buffalo.h>
+#include <buffalo/grammar_file.h>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define BUFFALO_BENCH_PERF_EVENTS 1
+#endif
+
+/*
+ * Parser throughput benchmark.
+ *
+ * Usage: buffalo-bench [discovery|renumbered|unrecorded|replay|runtime|locality] [repetitions]
+ *
+ * Parses a long generated calculator expression with the parsing tables either in state discovery order or
+ * renumbered depth-first (see LRParser<G>::LocalityOrder). The calculator's tables fit in L1, so `locality` runs
+ * both orders on a generated grammar whose tables are several megabytes instead, and reports them side by side.
+ * Whether renumbering pays off depends on the grammar and the machine, so no result is assumed here.
+ *
+ * Each run reports L1 data cache read misses and last-level cache misses of the parses, read in-process with
+ * perf_event_open on Linux. Where the counters are unavailable (other systems, containers, or a restrictive
+ * `/proc/sys/kernel/perf_event_paranoid`), they are reported as such and only times are given.
+ *
+ * `replay` replays a recorded trace of the parse instead (see bf::ParseTrace), measuring the parse loop without the
+ * scanner. Replays do not take the operator-precedence fast path, so compare them with `unrecorded`, which runs the
+ * same loop with the scanner (ParseTraced without a trace): the difference is the cost of scanning.
+ *
+ * `runtime` parses with the same grammar built from bf::RuntimeTerminal instead of bf::DefineTerminal, i.e. with its
+ * terminals matched by one combined DFA instead of ctre; compare it with `renumbered`.
+ */
+
+/*
+ * Grammar Definition
+ */
+using G = bf::GrammarDefinition<double>;
+
+/*
+ * Terminals
+ */
+bf::DefineTerminal<G, R"(\d+(\.\d+)?)", double> NUMBER([](auto const &tok) {
+    return std::stod(std::string(tok.raw));
+});
+
+bf::DefineTerminal<G, R"(\^)"> OP_EXP(bf::Right);
+
+bf::DefineTerminal<G, R"(\*)"> OP_MUL(bf::Left);
+bf::DefineTerminal<G, R"(\/)"> OP_DIV(bf::Left);
+bf::DefineTerminal<G, R"(\+)"> OP_ADD(bf::Left);
+bf::DefineTerminal<G, R"(\-)"> OP_SUB(bf::Left);
+
+bf::DefineTerminal<G, R"(\()"> PAR_OPEN;
+bf::DefineTerminal<G, R"(\))"> PAR_CLOSE;
+
+/*
+ * Non-Terminals
+ */
+bf::DefineNonTerminal<G> expression
+    = bf::PR<G>(NUMBER)<=>[](auto &$) { return $[0]; }
+    | (PAR_OPEN + expression + PAR_CLOSE)<=>[](auto &$) { return $[1]; }
+    | (expression + OP_EXP + expression)<=>[](auto &$) { return std::pow($[0], $[2]); }
+    | (expression + OP_MUL + expression)<=>[](auto &$) { return $[0] * $[2]; }
+    | (expression + OP_DIV + expression)<=>[](auto &$) { return $[0] / $[2]; }
+    | (expression + OP_ADD + expression)<=>[](auto &$) { return $[0] + $[2]; }
+    | (expression + OP_SUB + expression)<=>[](auto &$) { return $[0] - $[2]; }
+    ;
+
+bf::DefineNonTerminal<G> statement
+    = bf::PR<G>(expression)<=>[](auto &$)
+    {
+        return $[0];
+    }
+    ;
+
+/*
+ * The same grammar with runtime terminals.
+ */
+bf::RuntimeTerminal<G> R_NUMBER(R"(\d+(\.\d+)?)", [](auto const &tok) {
+    return std::stod(std::string(tok.raw));
+});
+
+bf::RuntimeTerminal<G> R_OP_EXP(R"(\^)", bf::Right);
+
+bf::RuntimeTerminal<G> R_OP_MUL(R"(\*)", bf::Left);
+bf::RuntimeTerminal<G> R_OP_DIV(R"(\/)", bf::Left);
+bf::RuntimeTerminal<G> R_OP_ADD(R"(\+)", bf::Left);
+bf::RuntimeTerminal<G> R_OP_SUB(R"(\-)", bf::Left);
+
+bf::RuntimeTerminal<G> R_PAR_OPEN(R"(\()");
+bf::RuntimeTerminal<G> R_PAR_CLOSE(R"(\))");
+
+bf::DefineNonTerminal<G> r_expression
+    = bf::PR<G>(R_NUMBER)<=>[](auto &$) { return $[0]; }
+    | (R_PAR_OPEN + r_expression + R_PAR_CLOSE)<=>[](auto &$) { return $[1]; }
+    | (r_expression + R_OP_EXP + r_expression)<=>[](auto &$) { return std::pow($[0], $[2]); }
+    | (r_expression + R_OP_MUL + r_expression)<=>[](auto &$) { return $[0] * $[2]; }
+    | (r_expression + R_OP_DIV + r_expression)<=>[](auto &$) { return $[0] / $[2]; }
+    | (r_expression + R_OP_ADD + r_expression)<=>[](auto &$) { return $[0] + $[2]; }
+    | (r_expression + R_OP_SUB + r_expression)<=>[](auto &$) { return $[0] - $[2]; }
+    ;
+
+bf::DefineNonTerminal<G> r_statement
+    = bf::PR<G>(r_expression)<=>[](auto &$)
+    {
+        return $[0];
+    }
+    ;
+
+/**
+ * Hardware event counter of the calling thread, excluding the kernel. Does nothing where perf_event_open is not
+ * available.
+ */
+class EventCounter
+{
+    int fd_ = -1;
+
+public:
+    EventCounter(std::uint32_t type, std::uint64_t config)
+    {
+#ifdef BUFFALO_BENCH_PERF_EVENTS
+        perf_event_attr attributes{};
+        attributes.size = sizeof(attributes);
+        attributes.type = type;
+        attributes.config = config;
+        attributes.disabled = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+
+        this->fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+#endif
+    }
+
+    EventCounter(EventCounter const &) = delete;
+
+    ~EventCounter()
+    {
+#ifdef BUFFALO_BENCH_PERF_EVENTS
+        if(this->fd_ >= 0)
+        {
+            close(this->fd_);
+        }
+#endif
+    }
+
+    void Start()
+    {
+#ifdef BUFFALO_BENCH_PERF_EVENTS
+        if(this->fd_ >= 0)
+        {
+            ioctl(this->fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(this->fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    /**
+     * @return Events since Start, if counted.
+     */
+    std::optional<std::uint64_t> Stop()
+    {
+#ifdef BUFFALO_BENCH_PERF_EVENTS
+        std::uint64_t count = 0;
+        if(this->fd_ >= 0 && ioctl(this->fd_, PERF_EVENT_IOC_DISABLE, 0) == 0 && read(this->fd_, &count, sizeof(count)) == sizeof(count))
+        {
+            return count;
+        }
+#endif
+        return std::nullopt;
+    }
+
+    /**
+     * @return L1 data cache read misses.
+     */
+    static EventCounter L1Misses()
+    {
+#ifdef BUFFALO_BENCH_PERF_EVENTS
+        return { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) };
+#else
+        return { 0, 0 };
+#endif
+    }
+
+    /**
+     * @return Last-level cache misses.
+     */
+    static EventCounter CacheMisses()
+    {
+#ifdef BUFFALO_BENCH_PERF_EVENTS
+        return { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES };
+#else
+        return { 0, 0 };
+#endif
+    }
+};
+
+/**
+ * Generates a grammar of `statements` kinds of statement, each a distinct keyword followed by `length` terminals
+ * out of a few shared ones, so the automaton has about `statements * length` states and `statements` terminals.
+ * Each kind walks its own chain of states, which discovery order interleaves with the chains of the other kinds.
+ * @param statements
+ * @param length
+ * @return
+ */
+std::string GenerateGrammar(std::size_t statements, std::size_t length)
+{
+    std::string grammar = "%token A \"a\"\n%token B \"b\"\n%token C \"c\"\n%token END \";\"\n";
+    for(std::size_t i = 0; i < statements; i++)
+    {
+        // Fixed width, so no keyword is a prefix of another.
+        std::string keyword = std::to_string(1000 + i).substr(1);
+        grammar += "%token K" + keyword + " \"k" + keyword + "\"\n";
+    }
+
+    grammar += "%%\nroot : program { forward } ;\nprogram : statement { forward } | program statement { add } ;\nstatement : ";
+    for(std::size_t i = 0; i < statements; i++)
+    {
+        grammar += (i ? " | s" : "s") + std::to_string(i) + " { forward }";
+    }
+    grammar += " ;\n";
+
+    for(std::size_t i = 0; i < statements; i++)
+    {
+        grammar += "s" + std::to_string(i) + " : K" + std::to_string(1000 + i).substr(1);
+        for(std::size_t j = 0; j < length; j++)
+        {
+            grammar += " " + std::string(1, "ABC"[(i + j) % 3]);
+        }
+        grammar += " END { one } ;\n";
+    }
+
+    return grammar;
+}
+
+/**
+ * Generates `count` statements of a GenerateGrammar grammar, of pseudo-random kinds.
+ * @param statements
+ * @param length
+ * @param count
+ * @return
+ */
+std::string GenerateStatements(std::size_t statements, std::size_t length, std::size_t count)
+{
+    std::string input;
+    std::uint32_t seed = 1;
+    for(std::size_t k = 0; k < count; k++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        std::size_t i = (seed >> 8) % statements;
+
+        input += "k" + std::to_string(1000 + i).substr(1);
+        for(std::size_t j = 0; j < length; j++)
+        {
+            input += " " + std::string(1, "abc"[(i + j) % 3]);
+        }
+        input += " ;\n";
+    }
+
+    return input;
+}
+
+/**
+ * Parses `input` `repetitions` times with `parse` and prints the throughput and cache misses.
+ * @return Whether all parses succeeded.
+ */
+template<typename Parse>
+bool Measure(std::string_view label, std::string_view input, std::size_t repetitions, Parse parse)
+{
+    EventCounter l1_misses = EventCounter::L1Misses();
+    EventCounter cache_misses = EventCounter::CacheMisses();
+
+    double checksum = 0;
+    l1_misses.Start();
+    cache_misses.Start();
+    auto begin = std::chrono::steady_clock::now();
+    for(std::size_t i = 0; i < repetitions; i++)
+    {
+        auto result = parse();
+        if(!result)
+        {
+            std::cerr << "Parse failed: " << result.error().message << '\n';
+            return false;
+        }
+        checksum += *result;
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto l1 = l1_misses.Stop();
+    auto llc = cache_misses.Stop();
+
+    auto per_parse = [&](std::optional<std::uint64_t> count)
+    {
+        return count ? std::to_string(*count / repetitions) : std::string("unavailable");
+    };
+
+    double seconds = std::chrono::duration<double>(end - begin).count();
+    std::cout << label << ": " << repetitions << " parses of " << input.size() << " bytes in " << seconds << " s ("
+              << (input.size() * repetitions) / seconds / 1e6 << " MB/s, checksum " << checksum << ")\n"
+              << "    per parse: " << per_parse(l1) << " L1d read misses, " << per_parse(llc) << " cache misses\n";
+
+    return true;
+}
+
+/**
+ * Runs the generated grammar of GenerateGrammar with its tables in discovery order, then renumbered.
+ * @param repetitions
+ * @return
+ */
+int MeasureLocality(std::size_t repetitions)
+{
+    constexpr std::size_t kStatements = 512;
+    constexpr std::size_t kLength = 12;
+
+    bf::ActionRegistry<G> actions;
+    actions
+        .Action("forward", bf::Forward<G>)
+        .Action("add", [](auto &$) { return $[0] + $[1]; })
+        .Action("one", [](auto &) { return 1.0; })
+        ;
+
+    auto file = bf::GrammarFile<G>::Load(GenerateGrammar(kStatements, kLength), actions);
+    if(!file)
+    {
+        std::cerr << "Failed to load grammar: " << file.error().message << '\n';
+        return 1;
+    }
+
+    std::string input = GenerateStatements(kStatements, kLength, 20000);
+
+    for(bool renumber : { false, true })
+    {
+        auto parser = bf::SLRParser<G>::Build(file->Root(), { .renumber_states = renumber });
+        if(!parser)
+        {
+            std::cerr << "Failed to build parser: " << parser.error().message << '\n';
+            return 1;
+        }
+
+        std::size_t states = parser->GetBuildReport().states;
+        std::cout << (renumber ? "renumbered" : "discovery") << " (" << states << " states, " << kStatements + 5
+                  << " terminals, ACTION table of about " << states * (kStatements + 5) * 2 / 1024 << " KiB)\n";
+
+        if(!Measure(renumber ? "renumbered" : "discovery", input, repetitions, [&] { return parser->Parse(input); }))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Generates an expression mixing all operators and nesting levels.
+ * @param terms
+ * @return
+ */
+std::string GenerateExpression(std::size_t terms)
+{
+    constexpr std::string_view operators[] = { " + ", " - ", " * ", " / " };
+
+    std::string expression = "1";
+    for(std::size_t i = 1; i < terms; i++)
+    {
+        expression += operators[i % 4];
+
+        if(i % 7 == 0)
+        {
+            expression += "(2 ^ 1 + " + std::to_string(i % 5) + ")";
+        }
+        else
+        {
+            expression += std::to_string(i % 9 + 1);
+        }
+    }
+
+    return expression;
+}
+
+int main(int argc, char **argv)
+{
+    std::string_view variant = argc > 1 ? argv[1] : "renumbered";
+    std::size_t repetitions = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200;
+
+    if(variant == "locality")
+    {
+        return MeasureLocality(repetitions);
+    }
+
+    auto parser = bf::SLRParser<G>::Build(variant == "runtime" ? r_statement : statement, {
+        .renumber_states = variant != "discovery",
+    });
+
+    if(!parser)
+    {
+        std::cerr << "Failed to build parser: " << parser.error().message << '\n';
+        return 1;
+    }
+
+    std::string input = GenerateExpression(10000);
+
+    std::vector<std::byte> trace;
+    if(variant == "replay" && !parser->ParseTraced(input, trace))
+    {
+        std::cerr << "Failed to record trace\n";
+        return 1;
+    }
+
+    bool parsed = Measure(variant, input, repetitions, [&]
+    {
+        return variant == "replay" ? parser->Replay(input, trace)
+             : variant == "unrecorded" ? parser->ParseTraced(input, nullptr)
+             : parser->Parse(input);
+    });
+
+    return parsed ? 0 : 1;
+}
@@ -0,0 +1,60 @@
+#ifdef BUFFALO_BENCH_MODULE
+import buffalo;
+#else
+#include <buffalo/buffalo.h>
+#endif
+
+#include <cmath>
+#include <string>
+#include <string_view>
+#include "calculator.h"
+
+/*
+ * Grammar TU compiled by the compile-time benchmark (see compile_time.cmake), either against the header, with the
+ * parser instantiations declared extern (BUFFALO_BENCH_EXTERN) or importing the module (BUFFALO_BENCH_MODULE).
+ */
+
+/*
+ * Terminals
+ */
+bf::DefineTerminal<G, R"(\d+(\.\d+)?)", double> NUMBER([](auto const &tok) {
+    return std::stod(std::string(tok.raw));
+});
+
+bf::DefineTerminal<G, R"(\^)"> OP_EXP(bf::Right);
+
+bf::DefineTerminal<G, R"(\*)"> OP_MUL(bf::Left);
+bf::DefineTerminal<G, R"(\/)"> OP_DIV(bf::Left);
+bf::DefineTerminal<G, R"(\+)"> OP_ADD(bf::Left);
+bf::DefineTerminal<G, R"(\-)"> OP_SUB(bf::Left);
+
+bf::DefineTerminal<G, R"(\()"> PAR_OPEN;
+bf::DefineTerminal<G, R"(\))"> PAR_CLOSE;
+
+/*
+ * Non-Terminals
+ */
+bf::DefineNonTerminal<G> expression
+    = bf::PR<G>(NUMBER)<=>[](auto &$) { return $[0]; }
+    | (PAR_OPEN + expression + PAR_CLOSE)<=>[](auto &$) { return $[1]; }
+    | (expression + OP_EXP + expression)<=>[](auto &$) { return std::pow($[0], $[2]); }
+    | (expression + OP_MUL + expression)<=>[](auto &$) { return $[0] * $[2]; }
+    | (expression + OP_DIV + expression)<=>[](auto &$) { return $[0] / $[2]; }
+    | (expression + OP_ADD + expression)<=>[](auto &$) { return $[0] + $[2]; }
+    | (expression + OP_SUB + expression)<=>[](auto &$) { return $[0] - $[2]; }
+    ;
+
+bf::DefineNonTerminal<G> statement
+    = bf::PR<G>(expression)<=>[](auto &$)
+    {
+        return $[0];
+    }
+    ;
+
+double Evaluate(std::string_view input)
+{
+    auto parser = bf::SLRParser<G>::Build(statement);
+    auto result = parser->Parse(input);
+
+    return result ? *result : NAN;
+}
@@ -0,0 +1,13 @@
+#ifndef BUFFALO_BENCH_CALCULATOR_H
+#define BUFFALO_BENCH_CALCULATOR_H
+
+/*
+ * Grammar Definition
+ */
+using G = bf::GrammarDefinition<double>;
+
+#ifdef BUFFALO_BENCH_EXTERN
+BUFFALO_EXTERN_TEMPLATES(G)
+#endif
+
+#endif //BUFFALO_BENCH_CALCULATOR_H
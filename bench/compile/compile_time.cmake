@@ -0,0 +1,76 @@
+# Compile-time benchmark.
+#
+# Usage: cmake -DBUILD_DIR=<build directory>[;<build directory>...] -P bench/compile/compile_time.cmake
+#
+# Each build directory must be configured with -DBUFFALO_ENABLE_BENCHMARKS=ON, and -DBUFFALO_ENABLE_MODULE=ON for the
+# module variant. To compare compilers, configure one build directory per compiler and pass them all; results are
+# reported per compiler.
+#
+# Each variant's dependencies (parser instantiations, module interface) are built first, then the grammar TU is
+# rebuilt and timed on its own. Besides the calculator variants, the grammars generated for
+# BUFFALO_BENCH_GRAMMAR_SIZES (<terminals>x<rules>, see generate_grammar.cmake) are timed to show how compile time
+# and object size scale with grammar size.
+cmake_minimum_required(VERSION 3.28)
+
+if(NOT BUILD_DIR)
+    message(FATAL_ERROR "Usage: cmake -DBUILD_DIR=<build directory>[;<build directory>...] -P ${CMAKE_CURRENT_LIST_FILE}")
+endif()
+
+# Rebuilds `target` after touching `source` and reports the time and the size of the object matching `object`.
+function(Measure build_dir compiler variant target source object)
+    execute_process(
+            COMMAND ${CMAKE_COMMAND} --build ${build_dir} --target ${target}
+            RESULT_VARIABLE result
+            OUTPUT_QUIET ERROR_QUIET
+    )
+    if(NOT result EQUAL 0)
+        message(STATUS "${compiler} ${variant}: skipped, ${target} does not build")
+        return()
+    endif()
+
+    file(TOUCH ${source})
+
+    string(TIMESTAMP begin "%s%f")
+    execute_process(
+            COMMAND ${CMAKE_COMMAND} --build ${build_dir} --target ${target}
+            RESULT_VARIABLE result
+            OUTPUT_QUIET
+    )
+    string(TIMESTAMP end "%s%f")
+
+    math(EXPR milliseconds "(${end} - ${begin}) / 1000")
+
+    file(GLOB_RECURSE objects ${build_dir}/CMakeFiles/${target}.dir/*${object}.o*)
+    set(size "?")
+    if(objects)
+        list(GET objects 0 object)
+        file(SIZE ${object} size)
+    endif()
+
+    message(STATUS "${compiler} ${variant}: ${milliseconds} ms, ${size} byte object")
+endfunction()
+
+foreach(build_dir ${BUILD_DIR})
+    # Compiler and grammar sizes the build directory was configured with
+    file(GLOB compiler_files ${build_dir}/CMakeFiles/*/CMakeCXXCompiler.cmake)
+    set(compiler "unknown")
+    if(compiler_files)
+        list(GET compiler_files 0 compiler_file)
+        file(STRINGS ${compiler_file} id REGEX "^set\\(CMAKE_CXX_COMPILER_ID \"")
+        file(STRINGS ${compiler_file} version REGEX "^set\\(CMAKE_CXX_COMPILER_VERSION \"")
+        string(REGEX REPLACE ".*\"(.*)\".*" "\\1" id "${id}")
+        string(REGEX REPLACE ".*\"(.*)\".*" "\\1" version "${version}")
+        set(compiler "${id}-${version}")
+    endif()
+
+    load_cache(${build_dir} READ_WITH_PREFIX cache_ BUFFALO_BENCH_GRAMMAR_SIZES)
+
+    foreach(variant header extern module)
+        Measure(${build_dir} ${compiler} ${variant} buffalo-compile-${variant} ${CMAKE_CURRENT_LIST_DIR}/calculator.cpp calculator.cpp)
+    endforeach()
+
+    foreach(size ${cache_BUFFALO_BENCH_GRAMMAR_SIZES})
+        set(grammar grammar_${size}.cpp)
+        Measure(${build_dir} ${compiler} grammar-${size} buffalo-compile-grammar-${size} ${build_dir}/bench/compile/${grammar} ${grammar})
+    endforeach()
+endforeach()
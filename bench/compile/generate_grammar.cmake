@@ -0,0 +1,86 @@
+# Grammar generator for the compile-time benchmark.
+#
+# Usage: cmake -DTERMINALS=<n> -DRULES=<m> -DOUTPUT=<file.cpp> -P bench/compile/generate_grammar.cmake
+#
+# Writes a grammar TU with `n` terminals and `m` two-terminal production rules (m <= n * n, so that no two rules derive
+# the same terminals and the grammar stays conflict-free), plus a function building and running its parser so the
+# parser templates are instantiated as in a real grammar TU. Terminal patterns rotate through literals, classes with
+# quantifiers, alternations and counted repeats, each ending in its zero-padded number so that no terminal matches a
+# prefix of another.
+cmake_minimum_required(VERSION 3.28)
+
+if(NOT TERMINALS OR NOT RULES OR NOT OUTPUT)
+    message(FATAL_ERROR "Usage: cmake -DTERMINALS=<n> -DRULES=<m> -DOUTPUT=<file.cpp> -P ${CMAKE_CURRENT_LIST_FILE}")
+endif()
+
+math(EXPR max_rules "${TERMINALS} * ${TERMINALS}")
+if(RULES GREATER max_rules)
+    message(FATAL_ERROR "At most ${max_rules} rules can be generated for ${TERMINALS} terminals")
+endif()
+
+math(EXPR last_terminal "${TERMINALS} - 1")
+math(EXPR last_rule "${RULES} - 1")
+string(LENGTH "${last_terminal}" width)
+
+set(source "// Generated by bench/compile/generate_grammar.cmake: ${TERMINALS} terminals, ${RULES} rules.\n")
+string(APPEND source "#include <buffalo/buffalo.h>\n#include <string_view>\n\n")
+string(APPEND source "using G = bf::GrammarDefinition<int>;\n\n")
+
+foreach(i RANGE ${last_terminal})
+    string(LENGTH "${i}" length)
+    math(EXPR padding "${width} - ${length}")
+    string(REPEAT "0" ${padding} id)
+    string(APPEND id "${i}")
+
+    math(EXPR shape "${i} % 4")
+    if(shape EQUAL 0)
+        set(pattern "k${id}")
+    elseif(shape EQUAL 1)
+        set(pattern "[a-j]+_${id}")
+    elseif(shape EQUAL 2)
+        set(pattern "(?:if|do|of)${id}")
+    else()
+        set(pattern "x{2,4}${id}")
+    endif()
+    string(APPEND source "bf::DefineTerminal<G, R\"(${pattern})\"> T${i};\n")
+endforeach()
+string(APPEND source "\n")
+
+# Rule j derives the terminals given by its two base-n digits.
+set(alternatives "")
+foreach(j RANGE ${last_rule})
+    math(EXPR first "${j} % ${TERMINALS}")
+    math(EXPR second "(${j} / ${TERMINALS}) % ${TERMINALS}")
+    string(APPEND source "bf::DefineNonTerminal<G> R${j} = (T${first} + T${second})<=>[]([[maybe_unused]] auto &$) { return ${j}; };\n")
+
+    if(j EQUAL 0)
+        string(APPEND alternatives "    = bf::PR<G>(R${j})<=>[](auto &$) { return $[0]; }\n")
+    else()
+        string(APPEND alternatives "    | bf::PR<G>(R${j})<=>[](auto &$) { return $[0]; }\n")
+    endif()
+endforeach()
+
+string(APPEND source "
+bf::DefineNonTerminal<G> item
+${alternatives}    ;
+
+bf::DefineNonTerminal<G> list
+    = bf::PR<G>(item)<=>[](auto &$) { return $[0]; }
+    | (list + item)<=>[](auto &$) { return $[0] + $[1]; }
+    ;
+
+bf::DefineNonTerminal<G> document
+    = bf::PR<G>(list)<=>[](auto &$) { return $[0]; }
+    ;
+
+int Evaluate(std::string_view input)
+{
+    auto parser = bf::SLRParser<G>::Build(document);
+    auto result = parser->Parse(input);
+
+    return result ? *result : -1;
+}
+")
+
+# Only rewrite on change, so regenerating does not invalidate the timed object.
+file(CONFIGURE OUTPUT ${OUTPUT} CONTENT "${source}" @ONLY)
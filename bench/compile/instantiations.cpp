@@ -0,0 +1,7 @@
+#include <buffalo/buffalo.h>
+#include "calculator.h"
+
+/*
+ * Parser instantiations for the calculator grammar, compiled once instead of in every grammar TU.
+ */
+BUFFALO_INSTANTIATE_TEMPLATES(G)
@@ -0,0 +1,139 @@
+#ifndef BUFFALO_ASYNC_H
+#define BUFFALO_ASYNC_H
+
+#include <buffalo/buffalo.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace bf
+{
+    /**
+     * EXECUTOR
+     * Anything tasks can be submitted to, e.g. bf::ThreadPool or an adaptor posting to an application's event loop.
+     */
+    template<typename E>
+    concept IExecutor = requires(E &executor, std::function<void()> task)
+    {
+        executor.Execute(std::move(task));
+    };
+
+    /**
+     * THREAD POOL
+     * Fixed set of worker threads running submitted tasks in FIFO order. Pending tasks are still run on destruction.
+     */
+    class ThreadPool
+    {
+        std::mutex mutex_;
+        std::condition_variable available_;
+        std::deque<std::function<void()>> tasks_;
+        bool stopping_ = false;
+
+        std::vector<std::jthread> workers_;
+
+        void Work()
+        {
+            while(true)
+            {
+                std::function<void()> task;
+                {
+                    std::unique_lock lock(this->mutex_);
+                    this->available_.wait(lock, [this] { return this->stopping_ || !this->tasks_.empty(); });
+
+                    if(this->tasks_.empty())
+                    {
+                        return;
+                    }
+
+                    task = std::move(this->tasks_.front());
+                    this->tasks_.pop_front();
+                }
+
+                task();
+            }
+        }
+
+    public:
+        void Execute(std::function<void()> task)
+        {
+            {
+                std::lock_guard lock(this->mutex_);
+                this->tasks_.push_back(std::move(task));
+            }
+
+            this->available_.notify_one();
+        }
+
+        /**
+         * @return Process-wide pool used by bf::ParseAsync when no executor is given.
+         */
+        static ThreadPool &Default()
+        {
+            static ThreadPool pool;
+            return pool;
+        }
+
+        explicit ThreadPool(std::size_t threads = std::max(1u, std::thread::hardware_concurrency()))
+        {
+            for(std::size_t i = 0; i < threads; i++)
+            {
+                this->workers_.emplace_back([this] { this->Work(); });
+            }
+        }
+
+        ThreadPool(ThreadPool const &) = delete;
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard lock(this->mutex_);
+                this->stopping_ = true;
+            }
+
+            this->available_.notify_all();
+        }
+    };
+
+    /**
+     * Parses `input` on `executor`. Parsing does not modify the parser, so any number of parses may run concurrently
+     * on the same parser, as long as it is not instrumented (LRParser<G>::Instrument) and outlives the returned future.
+     * @tparam G
+     * @tparam Executor
+     * @param parser
+     * @param input
+     * @param executor
+     * @return
+     */
+    template<IGrammar G, IExecutor Executor>
+    std::future<std::expected<typename G::ValueType, Error>> ParseAsync(Parser<G> &parser, std::string input, Executor &executor)
+    {
+        auto task = std::make_shared<std::packaged_task<std::expected<typename G::ValueType, Error>()>>([&parser, input = std::move(input)]
+        {
+            return parser.Parse(input, nullptr);
+        });
+
+        auto future = task->get_future();
+        executor.Execute([task] { (*task)(); });
+
+        return future;
+    }
+
+    /**
+     * Parses `input` on bf::ThreadPool::Default.
+     * @tparam G
+     * @param parser
+     * @param input
+     * @return
+     */
+    template<IGrammar G>
+    std::future<std::expected<typename G::ValueType, Error>> ParseAsync(Parser<G> &parser, std::string input)
+    {
+        return ParseAsync(parser, std::move(input), ThreadPool::Default());
+    }
+}
+
+#endif //BUFFALO_ASYNC_H
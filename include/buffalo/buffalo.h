@@ -3,19 +3,71 @@
 
 #include <memory>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <bit>
 #include <cctype>
+#include <cstddef>
+#include <cstring>
+#include <cstdint>
 #include <expected>
+#include <filesystem>
+#include <limits>
+#include <fstream>
 #include <map>
+#include <mutex>
+#include <numeric>
 #include <optional>
 #include <ranges>
 #include <set>
-#include <stack>
+#include <span>
 #include <stdexcept>
+#include <string>
 #include <variant>
 #include <vector>
 #include <ctre.hpp>
 #include <ctll.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Checks DefineTerminal patterns for super-linear backtracking (see bf::LintRegex): 0 disables the check, 1 warns and
+ * 2 fails compilation.
+ */
+#ifndef BUFFALO_REGEX_LINT
+#define BUFFALO_REGEX_LINT 1
+#endif
+
+/**
+ * Linux USDT probes (provider `buffalo`) for bpftrace, perf or SystemTap, compiled in by default on Linux where
+ * <sys/sdt.h> is available, so that production builds can be traced as they are. A probe is a single nop until a
+ * tracer attaches to it. BUFFALO_USDT=0 leaves them out, BUFFALO_USDT=1 requires them.
+ *
+ * parse__start(position), parse__done(result, position) with the DriveResult or -1 on errors,
+ * shift(state, column, target), reduce(state, reduction, length), lex__miss(state, position),
+ * build__phase(name) at the start of each phase of Build and build__done(states).
+ */
+#ifndef BUFFALO_USDT
+#if defined(__linux__) && __has_include(<sys/sdt.h>)
+#define BUFFALO_USDT 1
+#else
+#define BUFFALO_USDT 0
+#endif
+#endif
+
+#if BUFFALO_USDT
+#if !__has_include(<sys/sdt.h>)
+#error "BUFFALO_USDT requires <sys/sdt.h>"
+#endif
+#include <sys/sdt.h>
+#define BUFFALO_PROBE(name, ...) STAP_PROBEV(buffalo, name __VA_OPT__(,) __VA_ARGS__)
+#else
+#define BUFFALO_PROBE(name, ...) ((void)0)
+#endif
+
 namespace bf
 {
     /*
@@ -72,6 +124,9 @@ namespace bf
     template<IGrammar G, typename SemanticType>
     class DefineNonTerminal;
 
+    template<IGrammar G>
+    class Subrule;
+
     template<IGrammar G>
     struct LRItem;
 
@@ -81,9 +136,22 @@ namespace bf
     template<IGrammar G>
     class Parser;
 
+    template<IGrammar G>
+    class LRParser;
+
     template<IGrammar G>
     class SLRParser;
 
+    template<IGrammar G>
+    class LR1Parser;
+
+    template<IGrammar G>
+    class ParseCheckpoint;
+
+    class DFA;
+
+    class TerminalRegistry;
+
     /**
      * LOCATION
      * Represents the location of a string of text in `buffer`.
@@ -197,6 +265,15 @@ namespace bf
         Right,
     };
 
+    /**
+     * Set of dialect features, one per bit. Terminals and production rules belong to the features in their mask, and
+     * a parse given a FeatureMask only uses those sharing a feature with it, so one automaton built over the union of
+     * several dialects serves all of them.
+     */
+    using FeatureMask = std::uint64_t;
+
+    constexpr FeatureMask kAllFeatures = ~FeatureMask(0);
+
     /**
      * TERMINAL
      */
@@ -209,7 +286,7 @@ namespace bf
         using ReasonerType = typename G::ValueType(*)(Token<G> const&);
 
     protected:
-        inline static std::size_t counter = 0;
+        inline static std::atomic<std::size_t> counter = 0;
 
         ReasonerType reasoner_ = nullptr;
 
@@ -220,6 +297,9 @@ namespace bf
         Associativity associativity = Associativity::None;
         typename G::UserDataType user_data;
 
+        /// Dialects the terminal is scanned in. Disabled terminals are skipped, e.g. keywords read as identifiers.
+        FeatureMask features = kAllFeatures;
+
         std::optional<typename G::ValueType> Reason(Token<G> const &token) const
         {
             if(this->reasoner_)
@@ -230,680 +310,6336 @@ namespace bf
             return std::nullopt;
         }
 
-        virtual std::optional<Token<G>> Lex(std::string_view input) const
+        /**
+         * Prepares the terminal for scanning, called when a parser using it is built.
+         * @return
+         */
+        virtual std::optional<Error> Compile()
         {
             return std::nullopt;
         }
 
-        Terminal(Terminal<G>  &&) = delete;
-        Terminal(Terminal<G> const &) = delete;
-    };
-
-    /**
-     * DEFINE TERMINAL
-     * @tparam G
-     */
-    template<IGrammar G, ctll::fixed_string regex, typename SemanticType = void>
-    class DefineTerminal : public Terminal<G>
-    {
-    public:
-        SemanticType operator()(typename G::ValueType &value)
+        virtual std::optional<Token<G>> Lex(std::string_view input) const
         {
-            if constexpr(std::variant_size<typename G::ValueType>::value != 0)
-            {
-                if(!std::holds_alternative<SemanticType>(value))
-                {
-                    throw std::runtime_error("failed to convert type");
-                }
-
-                return std::move(std::get<SemanticType>(value));
-            }
-            else
-            {
-                return std::move(reinterpret_cast<SemanticType>(value));
-            }
+            return std::nullopt;
         }
 
-        std::optional<Token<G>> Lex(std::string_view input) const override
+        /**
+         * Bytes a token can start with, or all bytes if it can be empty. Terminals with disjoint sets never match the
+         * same input. Defaults to all bytes.
+         * @return
+         */
+        virtual std::bitset<256> FirstBytes() const
         {
-            auto match = ctre::starts_with<regex>(input);
-
-            if(!match)
-            {
-                return std::nullopt;
-            }
+            return std::bitset<256>().set();
+        }
 
-            return Token<G> {
-                    .terminal = (Terminal<G>*)this,
-                    .raw = match.view(),
-                    .location = {
-                            .begin = 0,
-                            .end = match.size(),
-                    },
-            };
+        /**
+         * DFA the terminal is matched with, if any. Such terminals are scanned together by the parser's CombinedDFA.
+         * @return
+         */
+        virtual std::shared_ptr<DFA const> Automaton() const
+        {
+            return nullptr;
         }
 
-        constexpr DefineTerminal(Associativity assoc = bf::None, typename G::UserDataType user_data = {}, typename Terminal<G>::ReasonerType reasoner = nullptr)
+        /**
+         * TerminalRegistry the terminal's DFA was compiled through, if any, and the id of its pattern there.
+         * @return
+         */
+        virtual std::pair<TerminalRegistry const *, std::size_t> Registration() const
         {
-            this->associativity = assoc;
-            this->user_data = user_data;
-            this->reasoner_ = reasoner;
+            return { nullptr, 0 };
         }
 
-        constexpr DefineTerminal(Associativity assoc, typename Terminal<G>::ReasonerType reasoner) : DefineTerminal(assoc, {}, reasoner) {}
+        Terminal(Terminal<G>  &&) = delete;
+        Terminal(Terminal<G> const &) = delete;
+    };
 
-        constexpr DefineTerminal(typename G::UserDataType user_data) : DefineTerminal(bf::None, user_data, nullptr) {}
-        constexpr DefineTerminal(typename G::UserDataType user_data, typename Terminal<G>::ReasonerType reasoner) : DefineTerminal(bf::None, user_data, reasoner) {}
+    /**
+     * Shapes of regular expressions that make backtracking matchers such as ctre super-linear on some inputs.
+     */
+    enum class RegexHazard
+    {
+        kNone,
 
-        constexpr DefineTerminal(typename Terminal<G>::ReasonerType reasoner) : DefineTerminal(bf::None, {}, reasoner) {}
+        /// Unbounded quantifier inside a repeated group, e.g. `(a+)+` or `(\w+\s?)*`.
+        kNestedQuantifier,
+
+        /// Repeated alternation whose alternatives can start with the same character, e.g. `(\\.|[^"])*`.
+        kOverlappingAlternation,
     };
 
     /**
-     * NON-TERMINAL
+     * REGEX LINT
+     * Result of the static analysis of a terminal pattern, see bf::LintRegex.
      */
-    template<IGrammar G>
-    class NonTerminal
+    struct RegexLint
     {
-        friend class Grammar<G>;
-        friend struct LRState<G>;
+        RegexHazard hazard = RegexHazard::kNone;
 
-    public:
-        using TransductorType = typename G::ValueType(*)(std::vector<typename G::ValueType> &);
+        /// Offset of the quantifier causing `hazard`.
+        std::size_t position = 0;
 
-    protected:
-        std::vector<ProductionRule<G>> rules_;
+        /**
+         * Whether bf::DFA gives the pattern the same meaning, i.e. it could be scanned in linear time by a
+         * RuntimeTerminal. ctre returns the first match in the order of alternatives and greedy quantifiers, bf::DFA
+         * the longest one, so this is false whenever one byte of lookahead cannot tell the choices apart (e.g. `if|ifx`
+         * or `a*(ab)?`), even if the first match happens to be the longest.
+         */
+        bool dfa_compatible = true;
 
-    public:
-        NonTerminal(NonTerminal  &) = delete;
-        NonTerminal(NonTerminal &&) = delete;
+        /// Bytes a match can start with, one bit per byte. All of them if the pattern matches the empty string.
+        std::array<std::uint64_t, 4> first_bytes{};
 
-        NonTerminal() = default;
+        constexpr bool Linear() const
+        {
+            return this->hazard == RegexHazard::kNone;
+        }
 
-        NonTerminal(ProductionRule<G> const &rule) : rules_({rule}) {}
-        NonTerminal(ProductionRuleList<G> const &rule_list) : rules_(rule_list.rules) {}
+        constexpr bool CanStartWith(unsigned char byte) const
+        {
+            return (this->first_bytes[byte / 64] >> (byte % 64)) & 1;
+        }
     };
 
     /**
-     * DEFINE NON-TERMINAL
+     * Recursive-descent analysis of a pattern in ctre syntax. Patterns are assumed to be valid, which ctre has
+     * already checked by the time a DefineTerminal is instantiated.
      */
-    template<IGrammar G, typename SemanticValue = void>
-    class DefineNonTerminal : public NonTerminal<G>
+    class RegexLinter
     {
-    public:
-        SemanticValue operator()(typename G::ValueType &value)
+        /// Byte set usable in constant expressions.
+        struct Bytes
         {
-            if constexpr(std::variant_size<typename G::ValueType>::value != 0)
+            std::array<std::uint64_t, 4> words{};
+
+            constexpr void Set(unsigned char first, unsigned char last)
             {
-                if(!std::holds_alternative<SemanticValue>(value))
+                for(unsigned b = first; b <= last; b++)
                 {
-                    throw std::runtime_error("failed to convert type");
+                    this->words[b / 64] |= std::uint64_t(1) << (b % 64);
                 }
+            }
 
-                return std::move(std::get<SemanticValue>(value));
+            constexpr Bytes operator|(Bytes const &other) const
+            {
+                Bytes result;
+                for(std::size_t i = 0; i < 4; i++) result.words[i] = this->words[i] | other.words[i];
+                return result;
             }
-            else
+
+            constexpr Bytes operator~() const
             {
-                return std::move(reinterpret_cast<SemanticValue>(value));
+                Bytes result;
+                for(std::size_t i = 0; i < 4; i++) result.words[i] = ~this->words[i];
+                return result;
             }
-        }
 
-        DefineNonTerminal() = delete;
+            constexpr bool Intersects(Bytes const &other) const
+            {
+                for(std::size_t i = 0; i < 4; i++)
+                {
+                    if(this->words[i] & other.words[i]) return true;
+                }
 
-        DefineNonTerminal(ProductionRule<G> const &rule) : NonTerminal<G>(rule) {}
-        DefineNonTerminal(ProductionRuleList<G> const &rule_list) : NonTerminal<G>(rule_list) {}
-    };
+                return false;
+            }
 
-    /**
-     * SYMBOL
-     */
-    template<IGrammar G>
-    using Symbol = std::variant<Terminal<G>*, NonTerminal<G>*>;
+            static constexpr Bytes Range(unsigned char first, unsigned char last)
+            {
+                Bytes bytes;
+                bytes.Set(first, last);
+                return bytes;
+            }
+        };
 
-    /*
-     * PRODUCTION RULES
-     */
-    template<IGrammar G>
-    class ProductionRule
-    {
-        friend class Grammar<G>;
-        friend struct LRItem<G>;
-        friend class Parser<G>;
-        friend class SLRParser<G>;
+        /**
+         * What the analysis needs to know about a subexpression.
+         */
+        struct Summary
+        {
+            /// Bytes a match can start with.
+            Bytes first;
+            bool nullable = true;
 
-    protected:
-        typename NonTerminal<G>::TransductorType transductor_ = nullptr;
-        std::vector<Symbol<G>> sequence_;
-        std::size_t precedence = -1;
+            /// Contains an unbounded quantifier.
+            bool unbounded = false;
 
-        NonTerminal<G> *non_terminal_ = nullptr;
+            /// Is an alternation whose alternatives can start with the same byte.
+            bool overlapping = false;
 
-    public:
-        ProductionRule &operator+(Terminal<G> &rhs)
-        {
-            this->sequence_.push_back(&rhs);
+            /// A quantifier in it may stop or go on where the rest of it continues, e.g. `a+a`.
+            bool ambiguous = false;
 
-            return *this;
-        }
+            /// Bytes on which a match of a quantifier or nullable alternation at its end could either stop or go on.
+            Bytes open;
+        };
 
-        ProductionRule &operator+(NonTerminal<G> &rhs)
-        {
-            this->sequence_.push_back(&rhs);
+        std::string_view pattern_;
+        std::size_t position_ = 0;
+        RegexLint result_;
 
-            return *this;
+        constexpr bool AtEnd() const
+        {
+            return this->position_ >= this->pattern_.size();
         }
 
-        ProductionRule &operator<=>(typename NonTerminal<G>::TransductorType tranductor)
+        constexpr char Current() const
         {
-            this->transductor_ = tranductor;
-
-            return *this;
+            return this->pattern_[this->position_];
         }
 
-        bool operator==(ProductionRule<G> const &other) const
+        constexpr void Report(RegexHazard hazard, std::size_t position)
         {
-            if(this->non_terminal_ && other.non_terminal_)
+            if(this->result_.Linear())
             {
-                if(this->non_terminal_ != other.non_terminal_) return false;
+                this->result_.hazard = hazard;
+                this->result_.position = position;
             }
-            else if(this->non_terminal_ != other.non_terminal_)
+        }
+
+        /**
+         * Parses the character after a backslash.
+         */
+        constexpr Bytes Escape()
+        {
+            if(this->AtEnd())
             {
-                return false;
+                return {};
             }
 
-            if(this->sequence_.size() != other.sequence_.size()) return false;
+            char c = this->pattern_[this->position_++];
+            Bytes word = Bytes::Range('a', 'z') | Bytes::Range('A', 'Z') | Bytes::Range('0', '9') | Bytes::Range('_', '_');
+            Bytes space = Bytes::Range(' ', ' ') | Bytes::Range('\t', '\r');
 
-            for(auto const &[first, second] : std::views::zip(this->sequence_, other.sequence_))
+            switch(c)
             {
-                if(first != second) return false;
+                case 'd': return Bytes::Range('0', '9');
+                case 'D': return ~Bytes::Range('0', '9');
+                case 'w': return word;
+                case 'W': return ~word;
+                case 's': return space;
+                case 'S': return ~space;
+                case 'n': return Bytes::Range('\n', '\n');
+                case 'r': return Bytes::Range('\r', '\r');
+                case 't': return Bytes::Range('\t', '\t');
             }
 
-            return true;
-        }
-
-        std::optional<typename G::ValueType> Transduce(std::vector<typename G::ValueType> &args) const
-        {
-            if(this->transductor_)
+            // Backreferences, word boundaries, code point escapes, ... are rejected by bf::DFA.
+            if((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
             {
-                return std::move(this->transductor_(args));
+                this->result_.dfa_compatible = false;
+                return ~Bytes{};
             }
 
-            return std::nullopt;
+            return Bytes::Range(c, c);
         }
 
-        ProductionRule(Terminal<G>       &terminal) : sequence_({ &terminal }) {}
-        ProductionRule(NonTerminal<G> &nonterminal) : sequence_({ &nonterminal }) {}
-    };
+        constexpr Bytes Class()
+        {
+            Bytes bytes;
 
-    template<IGrammar G>
-    using PR = ProductionRule<G>;
+            bool negated = !this->AtEnd() && this->Current() == '^';
+            if(negated) this->position_++;
 
-    /*
-     * GRAMMAR
-     */
-    template<IGrammar G>
-    class Grammar
-    {
-        friend class Parser<G>;
-        friend class SLRParser<G>;
+            bool first = true;
+            while(!this->AtEnd() && (first || this->Current() != ']'))
+            {
+                first = false;
 
-    protected:
-        /**
-         * Unique pointer to an EOS terminal for this grammar. This allows the grammar to be moved while still
-         * retaining the ability to perform pointer comparison on the EOS terminal.
-         */
-        std::unique_ptr<Terminal<G>> EOS;
+                if(this->pattern_.substr(this->position_).starts_with("[:"))
+                {
+                    // POSIX class
+                    this->result_.dfa_compatible = false;
+                    std::size_t end = this->pattern_.find(":]", this->position_);
+                    this->position_ = end == std::string_view::npos ? this->pattern_.size() : end + 2;
+                    bytes = ~Bytes{};
+                    continue;
+                }
 
-        std::set<NonTerminal<G>*> nonterminals_;
-        std::set<Terminal<G>*> terminals_;
+                Bytes element;
+                unsigned char c = this->Current();
+                this->position_++;
 
-        std::map<NonTerminal<G>*, std::set<Terminal<G>*>> first_;
-        std::map<NonTerminal<G>*, std::set<Terminal<G>*>> follow_;
+                if(c == '\\')
+                {
+                    element = this->Escape();
+                }
+                else if(this->position_ + 1 < this->pattern_.size() && this->Current() == '-' && this->pattern_[this->position_ + 1] != ']')
+                {
+                    unsigned char last = this->pattern_[this->position_ + 1];
+                    this->position_ += 2;
+                    element = Bytes::Range(c, last >= c ? last : c);
 
-        /// List of all production rules along with their respective NonTerminal
-        std::vector<std::pair<NonTerminal<G>*, ProductionRule<G>>> production_rules_;
+                    if(last == '\\')
+                    {
+                        this->Escape();
+                        element = ~Bytes{};
+                    }
+                }
+                else
+                {
+                    element = Bytes::Range(c, c);
+                }
 
-    public:
-        NonTerminal<G> &root;
+                // bf::DFA matches classes bytewise, ctre by code point.
+                if(c >= 0x80)
+                {
+                    this->result_.dfa_compatible = false;
+                }
 
-        bool HasNonTerminal(NonTerminal<G> &non_terminal) const
-        {
-            return this->nonterminals_.contains(&non_terminal);
-        }
+                bytes = bytes | element;
+            }
 
-        bool NonTerminalHasFollow(NonTerminal<G> &non_terminal, Terminal<G> &terminal) const
-        {
-            return this->follow_.at(&non_terminal).contains(&terminal);
-        }
+            if(!this->AtEnd()) this->position_++;
 
-        bool NonTerminalHasFirst(NonTerminal<G> &non_terminal, Terminal<G> &terminal) const
-        {
-            return this->first_.at(&non_terminal).contains(&terminal);
+            return negated ? ~bytes : bytes;
         }
 
-        /**
-         * Simple, but somewhat inefficient algorithm for generating FIRST sets.
-         * The FIRST set is the set of all Terminals that a NonTerminal can begin with.
-         */
-        void GenerateFirstSet()
+        constexpr Summary Atom()
         {
-            bool has_change;
-            do
-            {
-                has_change = false;
+            Summary summary;
+            summary.nullable = false;
 
-                for(auto const &[nonterminal, rule] : this->production_rules_)
+            char c = this->pattern_[this->position_++];
+            switch(c)
+            {
+                case '(':
                 {
-                    if(rule.sequence_.empty()) continue;
+                    if(this->pattern_.substr(this->position_).starts_with("?:"))
+                    {
+                        this->position_ += 2;
+                    }
+                    else if(!this->AtEnd() && this->Current() == '?')
+                    {
+                        // Lookaround and other extensions, which may let a match start with any byte.
+                        this->result_.dfa_compatible = false;
+                        while(!this->AtEnd() && this->Current() != ':' && this->Current() != '=' && this->Current() != '!' && this->Current() != ')') this->position_++;
+                        if(!this->AtEnd() && this->Current() != ')') this->position_++;
 
-                    has_change |= std::visit(overload{
-                        [&](Terminal<G> *terminal)
-                        {
-                            auto [it, inserted] = this->first_[nonterminal].insert(terminal);
-                            return inserted;
-                        },
-                        [&](NonTerminal<G> *child_nonterminal)
-                        {
-                            if(child_nonterminal == nonterminal)
-                            {
-                                return false;
-                            }
+                        summary = this->Alternation();
+                        if(!this->AtEnd()) this->position_++;
+
+                        summary.first = ~Bytes{};
+                        summary.nullable = false;
+                        return summary;
+                    }
 
-                            auto &parent_first = this->first_[nonterminal];
-                            auto &child_first = this->first_[child_nonterminal];
+                    summary = this->Alternation();
+                    if(!this->AtEnd()) this->position_++;
 
-                            std::size_t parent_size = parent_first.size();
-                            parent_first.insert(child_first.begin(), child_first.end());
+                    return summary;
+                }
 
-                            return parent_size != parent_first.size();
-                        }
-                    }, rule.sequence_[0]);
+                case '^':
+                case '$':
+                {
+                    this->result_.dfa_compatible = false;
+                    return {};
                 }
-            } while(has_change);
+
+                case '[': summary.first = this->Class(); break;
+                case '.': summary.first = ~Bytes::Range('\n', '\n'); break;
+                case '\\': summary.first = this->Escape(); break;
+                default: summary.first = Bytes::Range(c, c); break;
+            }
+
+            return summary;
         }
 
         /**
-         * Simple, but somewhat inefficient algorithm for generating FOLLOW sets.
-         * The FOLLOW set is the set of all Terminals that can follow a NonTerminal.
+         * Parses an optional quantifier following `atom` and checks what it repeats.
          */
-        void GenerateFollowSet()
+        constexpr Summary Quantify(Summary atom)
         {
-            this->follow_[&root] = { this->EOS.get() };
+            if(this->AtEnd())
+            {
+                return atom;
+            }
 
-            bool has_change;
-            do
+            std::size_t position = this->position_;
+            std::size_t min = 1;
+            std::size_t max = 1;
+
+            char quantifier = this->Current();
+            if(quantifier == '*' || quantifier == '+' || quantifier == '?')
             {
-                has_change = false;
+                this->position_++;
+                min = quantifier == '+' ? 1 : 0;
+                max = quantifier == '?' ? 1 : std::string_view::npos;
+            }
+            else if(quantifier == '{')
+            {
+                this->position_++;
 
-                for(auto &[nonterminal, rule] : this->production_rules_)
+                auto number = [this]
                 {
-                    for(int i = 0; i < rule.sequence_.size(); i++)
+                    std::size_t value = 0;
+                    while(!this->AtEnd() && this->Current() >= '0' && this->Current() <= '9')
                     {
-                        // Skip over Terminals
-                        if(std::holds_alternative<Terminal<G>*>(rule.sequence_[i])) continue;
-
-                        // Process NonTerminal
-                        auto symbol = std::get<NonTerminal<G>*>(rule.sequence_[i]);
+                        value = std::min<std::size_t>(value * 10 + (this->Current() - '0'), std::string_view::npos - 1);
+                        this->position_++;
+                    }
+                    return value;
+                };
 
-                        // If this is the last NonTerminal in the sequence, then it gets all of the FOLLOW of parent.
-                        if(i == rule.sequence_.size() - 1)
-                        {
-                            auto &parent_follow = this->follow_[nonterminal];
-                            auto &child_follow = this->follow_[symbol];
+                min = max = number();
+                if(!this->AtEnd() && this->Current() == ',')
+                {
+                    this->position_++;
+                    max = !this->AtEnd() && this->Current() == '}' ? std::string_view::npos : number();
+                }
+                if(!this->AtEnd()) this->position_++;
 
-                            std::size_t child_size = child_follow.size();
-                            child_follow.insert(parent_follow.begin(), parent_follow.end());
+                if(max != std::string_view::npos && max > 1000)
+                {
+                    this->result_.dfa_compatible = false;
+                }
+            }
+            else
+            {
+                return atom;
+            }
 
-                            has_change = child_size != child_follow.size();
-                            continue;
-                        }
+            // Lazy and possessive quantifiers.
+            if(!this->AtEnd() && (this->Current() == '?' || this->Current() == '+'))
+            {
+                this->position_++;
+                this->result_.dfa_compatible = false;
+            }
 
-                        // ELSE process the next token
-                        auto follow = rule.sequence_[i + 1];
+            // Another iteration and what the atom itself may still consume must be told apart.
+            if(max > 1 && atom.open.Intersects(atom.first))
+            {
+                this->result_.dfa_compatible = false;
+            }
 
-                        has_change |= std::visit(overload{
-                            [&](Terminal<G> *terminal)
-                            {
-                                auto [it, inserted] = this->follow_[symbol].insert(terminal);
-                                return inserted;
-                            },
-                            [&](NonTerminal<G> *follow_nonterminal)
-                            {
-                                auto &symbol_follow = this->follow_[symbol];
-                                auto &follow_first = this->first_[follow_nonterminal];
+            if(max > 1)
+            {
+                // The repetition alone cannot split the same text between iterations in several ways unless an inner
+                // quantifier could also consume the start of the next iteration, or overlaps what follows it.
+                if(atom.unbounded && (atom.ambiguous || atom.open.Intersects(atom.first)))
+                {
+                    this->Report(RegexHazard::kNestedQuantifier, position);
+                }
+                else if(atom.overlapping)
+                {
+                    this->Report(RegexHazard::kOverlappingAlternation, position);
+                }
+            }
 
-                                std::size_t symbol_size = symbol_follow.size();
-                                symbol_follow.insert(follow_first.begin(), follow_first.end());
+            atom.nullable |= min == 0;
+            atom.unbounded |= max == std::string_view::npos;
+            atom.overlapping = false;
+            if(max > min)
+            {
+                atom.open = atom.open | atom.first;
+            }
 
-                                return symbol_size != symbol_follow.size();
-                            }
-                        }, follow);
-                    }
-                }
-            } while(has_change);
+            return atom;
         }
 
-        void RegisterSymbols(NonTerminal<G> *nonterminal)
+        constexpr Summary Sequence()
         {
-            this->nonterminals_.insert(nonterminal);
+            Summary summary;
+            std::size_t elements = 0;
 
-            for(auto &rule : nonterminal->rules_)
+            while(!this->AtEnd() && this->Current() != '|' && this->Current() != ')')
             {
-                rule.non_terminal_ = nonterminal;
-                Terminal<G> *last_terminal = nullptr;
+                Summary element = this->Quantify(this->Atom());
+                elements++;
 
-                this->production_rules_.push_back({nonterminal, rule});
-
-                for(auto &symbol : rule.sequence_)
+                // A preceding quantifier may stop or go on where this element starts.
+                if(summary.open.Intersects(element.first))
                 {
-                    std::visit(overload{
-                        [&](Terminal<G> *terminal)
-                        {
-                            last_terminal = terminal;
-                            this->terminals_.insert(terminal);
-                        },
-                        [&](NonTerminal<G> *child_nonterminal)
-                        {
-                            if(this->nonterminals_.contains(child_nonterminal)) return;
-
-                            this->RegisterSymbols(child_nonterminal);
-                        }
-                    }, symbol);
+                    this->result_.dfa_compatible = false;
+                    summary.ambiguous = true;
                 }
+                summary.open = element.nullable ? summary.open | element.open : element.open;
 
-                // Rule precedence defaults to the precedence of the LAST terminal in sequence.
-                if(last_terminal)
+                if(summary.nullable)
                 {
-                    rule.precedence = last_terminal->precedence;
+                    summary.first = summary.first | element.first;
                 }
+                summary.nullable &= element.nullable;
+                summary.unbounded |= element.unbounded;
+                summary.ambiguous |= element.ambiguous;
+                summary.overlapping = elements == 1 && element.overlapping;
             }
+
+            return summary;
         }
 
-        Grammar(NonTerminal<G> &start) : root(start)
+        constexpr Summary Alternation()
         {
-            this->EOS = std::make_unique<DefineTerminal<G, R"(\Z)">>();
-            this->terminals_.insert(this->EOS.get());
+            Summary summary = this->Sequence();
+            if(this->AtEnd() || this->Current() != '|')
+            {
+                return summary;
+            }
 
-            this->RegisterSymbols(&start);
+            summary.overlapping = false;
+            while(!this->AtEnd() && this->Current() == '|')
+            {
+                this->position_++;
 
-            this->GenerateFirstSet();
-            this->GenerateFollowSet();
+                Summary next = this->Sequence();
+                summary.overlapping |= next.first.Intersects(summary.first) || (next.nullable && summary.nullable);
+
+                // ctre takes the first alternative that matches, bf::DFA the longest one. An empty alternative
+                // before others makes ctre stop early.
+                if(next.first.Intersects(summary.first) || summary.nullable)
+                {
+                    this->result_.dfa_compatible = false;
+                }
+
+                summary.first = summary.first | next.first;
+                summary.nullable |= next.nullable;
+                summary.unbounded |= next.unbounded;
+                summary.ambiguous |= next.ambiguous;
+                summary.open = summary.open | next.open;
+            }
+
+            // Like an optional, a nullable alternation may stop or go on.
+            if(summary.nullable)
+            {
+                summary.open = summary.open | summary.first;
+            }
+
+            return summary;
         }
 
-        Grammar() = delete;
+    public:
+        constexpr explicit RegexLinter(std::string_view pattern) : pattern_(pattern) {}
+
+        constexpr RegexLint Lint()
+        {
+            Bytes first;
+            bool nullable = this->AtEnd();
+
+            while(!this->AtEnd())
+            {
+                Summary summary = this->Alternation();
+                first = first | summary.first;
+                nullable |= summary.nullable;
+
+                // Unbalanced parenthesis
+                if(!this->AtEnd()) this->position_++;
+            }
+
+            // Bytes from 0x80 stand for any non-ASCII character, see LintRegex<regex>().
+            if(first.Intersects(Bytes::Range(0x80, 0xFF)))
+            {
+                first = first | Bytes::Range(0x80, 0xFF);
+            }
+
+            this->result_.first_bytes = nullable ? (~Bytes{}).words : first.words;
+            return this->result_;
+        }
     };
 
-    /*
-     * PRODUCTION RULE COMPOSITION FUNCTIONS
+    /**
+     * Checks a pattern for shapes that can make ctre's backtracking super-linear and for syntax that bf::DFA does not
+     * support in the same way. Nested unbounded quantifiers that can split the same text between iterations in
+     * several ways, e.g. `(a+)+` but not `\d+(,\d+)*`, and repeated overlapping alternations are reported, the usual
+     * causes of catastrophic backtracking; the analysis is conservative and may flag patterns that are fine for every
+     * input a grammar sees.
+     * @param pattern
+     * @return
      */
-    template<IGrammar G>
-    ProductionRule<G> operator+(Terminal<G> &lhs, Terminal<G> &rhs)
+    constexpr RegexLint LintRegex(std::string_view pattern)
     {
-        return ProductionRule(lhs) + rhs;
+        return RegexLinter(pattern).Lint();
     }
 
-    template<IGrammar G>
-    ProductionRule<G> operator+(Terminal<G> &lhs, NonTerminal<G> &rhs)
+    template<ctll::fixed_string regex>
+    consteval RegexLint LintRegex()
     {
-        return ProductionRule(lhs) + rhs;
+        // ctll::fixed_string holds code points. Non-ASCII ones only matter as "some byte >= 0x80".
+        std::array<char, regex.size() + 1> pattern{};
+        for(std::size_t i = 0; i < regex.size(); i++)
+        {
+            pattern[i] = regex[i] < 0x80 ? static_cast<char>(regex[i]) : static_cast<char>(0x80);
+        }
+
+        return LintRegex(std::string_view(pattern.data(), regex.size()));
     }
 
-    template<IGrammar G>
-    ProductionRule<G> operator+(NonTerminal<G> &lhs, NonTerminal<G> &rhs)
+    template<RegexHazard hazard>
+    struct RegexLintWarning
     {
-        return ProductionRule(lhs) + rhs;
-    }
+        static constexpr void Check() {}
+    };
 
-    template<IGrammar G>
-    ProductionRule<G> operator+(NonTerminal<G> &lhs, Terminal<G> &rhs)
+    template<>
+    struct RegexLintWarning<RegexHazard::kNestedQuantifier>
     {
-        return ProductionRule(lhs) + rhs;
-    }
+        [[deprecated("terminal pattern has a nested quantifier and can backtrack exponentially (see bf::LintRegex)")]]
+        static constexpr void Check() {}
+    };
 
-    template<IGrammar G>
-    ProductionRuleList<G> operator|(ProductionRule<G> const &lhs, ProductionRule<G> const &rhs)
+    template<>
+    struct RegexLintWarning<RegexHazard::kOverlappingAlternation>
     {
-        return ProductionRuleList<G>() | lhs | rhs;
-    }
+        [[deprecated("terminal pattern repeats overlapping alternatives and can backtrack exponentially (see bf::LintRegex)")]]
+        static constexpr void Check() {}
+    };
 
     /**
-     * LR ITEM
+     * DEFINE TERMINAL
      * @tparam G
      */
-    template<IGrammar G>
-    struct LRItem
+    template<IGrammar G, ctll::fixed_string regex, typename SemanticType = void>
+    class DefineTerminal : public Terminal<G>
     {
-        ProductionRule<G> const *rule;
-        std::size_t position;
+    public:
+        /// Static analysis of `regex`, see bf::LintRegex.
+        static constexpr RegexLint kLint = LintRegex<regex>();
 
-        [[nodiscard]] bool Complete() const
+#if BUFFALO_REGEX_LINT >= 2
+        static_assert(kLint.Linear(), "terminal pattern can backtrack super-linearly (see bf::LintRegex)");
+#endif
+
+        SemanticType operator()(typename G::ValueType &value)
         {
-            return this->position >= this->rule->sequence_.size();
+            if constexpr(std::variant_size<typename G::ValueType>::value != 0)
+            {
+                if(!std::holds_alternative<SemanticType>(value))
+                {
+                    throw std::runtime_error("failed to convert type");
+                }
+
+                return std::move(std::get<SemanticType>(value));
+            }
+            else
+            {
+                return std::move(reinterpret_cast<SemanticType>(value));
+            }
         }
 
-        [[nodiscard]] LRItem Advance() const
+        std::optional<Token<G>> Lex(std::string_view input) const override
         {
-            return LRItem(this->rule, this->position + 1);
+            auto match = ctre::starts_with<regex>(input);
+
+            if(!match)
+            {
+                return std::nullopt;
+            }
+
+            return Token<G> {
+                    .terminal = (Terminal<G>*)this,
+                    .raw = match.view(),
+                    .location = {
+                            .begin = 0,
+                            .end = match.size(),
+                    },
+            };
         }
 
-        [[nodiscard]] Symbol<G> NextSymbol() const
+        std::bitset<256> FirstBytes() const override
         {
-            return this->rule->sequence_[this->position];
+            std::bitset<256> bytes;
+            for(unsigned b = 0; b < 256; b++)
+            {
+                bytes[b] = kLint.CanStartWith(b);
+            }
+
+            return bytes;
         }
 
-        bool operator==(LRItem const &other) const
+        constexpr DefineTerminal(Associativity assoc = bf::None, typename G::UserDataType user_data = {}, typename Terminal<G>::ReasonerType reasoner = nullptr)
         {
-            return *this->rule == *other.rule && this->position == other.position;
+#if BUFFALO_REGEX_LINT == 1
+            RegexLintWarning<kLint.hazard>::Check();
+#endif
+
+            this->associativity = assoc;
+            this->user_data = user_data;
+            this->reasoner_ = reasoner;
         }
 
-        LRItem(ProductionRule<G> const *rule, int position = 0) : rule(rule), position(position) {}
+        constexpr DefineTerminal(Associativity assoc, typename Terminal<G>::ReasonerType reasoner) : DefineTerminal(assoc, {}, reasoner) {}
 
-        LRItem() = delete;
-    };
+        constexpr DefineTerminal(typename G::UserDataType user_data) : DefineTerminal(bf::None, user_data, nullptr) {}
+        constexpr DefineTerminal(typename G::UserDataType user_data, typename Terminal<G>::ReasonerType reasoner) : DefineTerminal(bf::None, user_data, reasoner) {}
 
-    using lrstate_id_t = std::size_t;
+        constexpr DefineTerminal(typename Terminal<G>::ReasonerType reasoner) : DefineTerminal(bf::None, {}, reasoner) {}
+    };
 
     /**
-     * LR State
-     * @tparam G
+     * DFA
+     * Deterministic automaton over bytes compiled from a regular expression. Matches the longest prefix of its input
+     * in a single pass, without backtracking.
+     *
+     * Supported syntax: literals, `.`, escapes (`\d \w \s \D \W \S \n \r \t` and escaped metacharacters), classes
+     * (`[a-z_]`, `[^...]`), groups (`(...)`, `(?:...)`), alternation and the quantifiers `* + ? {n} {n,} {n,m}`.
+     * Anything else (anchors, word boundaries, `\x41`, POSIX classes, ...) fails compilation rather than being matched
+     * literally. Patterns are matched bytewise, so non-ASCII literals match their UTF-8 encoding.
      */
-    template<IGrammar G>
-    struct LRState
+    class DFA
     {
-        std::vector<LRItem<G>> kernel_items;
+        friend class CombinedDFA;
 
-        std::vector<LRItem<G>> GenerateClosure() const
-        {
-            std::vector<LRItem<G>> closure = this->kernel_items;
-            std::set<NonTerminal<G>*> closed_nonterminals;
+        using ByteSet = std::bitset<256>;
 
-            for(int i = 0; i < closure.size(); i++)
+    public:
+        /**
+         * Upper bound for the states of a compiled pattern. Patterns can come from configuration, and subset
+         * construction is exponential in the worst case (e.g. `(a|b)*a(a|b){15}`), as are nested counted repetitions.
+         */
+        static constexpr std::size_t kMaxStates = 10000;
+
+    private:
+
+        /**
+         * Thompson construction of an NFA during a recursive-descent parse of the pattern.
+         */
+        class Compiler
+        {
+            struct NFAState
             {
-                if(closure[i].Complete()) continue;
+                ByteSet bytes;
+                int next = -1;
+                std::vector<int> epsilon;
+            };
 
-                std::visit(overload{
-                    [](Terminal<G> *terminal) { /* Do Nothing */ },
-                    [&](NonTerminal<G> *non_terminal)
-                    {
-                        if(closed_nonterminals.contains(non_terminal)) return;
-                        closed_nonterminals.insert(non_terminal);
+            struct Fragment
+            {
+                int start;
+                int accept;
+            };
 
-                        for(auto const &rule : non_terminal->rules_)
-                        {
-                            closure.emplace_back(&rule);
-                        }
-                    }
-                }, closure[i].NextSymbol());
-            }
+            /// Upper bound for counted repetitions, which are expanded into copies.
+            static constexpr std::size_t kMaxRepetitions = 1000;
 
-            return closure;
-        }
+            /// Upper bound for NFA states, reached by nested counted repetitions.
+            static constexpr std::size_t kMaxNFAStates = 10 * kMaxStates;
 
-        std::map<Symbol<G>, LRState<G>> GenerateTransitions() const
-        {
-            std::map<Symbol<G>, LRState<G>> transitions;
+            std::string_view pattern_;
+            std::size_t position_ = 0;
+            std::optional<std::string> error_;
 
-            auto closure = this->GenerateClosure();
+        public:
+            std::vector<NFAState> states;
 
-            for(auto const &item : closure)
+        private:
+            int NewState()
             {
-                if(item.Complete()) continue;
-
+                if(this->states.size() == kMaxNFAStates)
+                {
+                    this->Fail("Pattern expands to more than " + std::to_string(kMaxNFAStates) + " NFA states");
+                }
+
+                this->states.emplace_back();
+                return static_cast<int>(this->states.size() - 1);
+            }
+
+            Fragment Empty()
+            {
+                int start = this->NewState();
+                int accept = this->NewState();
+                this->states[start].epsilon.push_back(accept);
+
+                return { start, accept };
+            }
+
+            Fragment Bytes(ByteSet const &bytes)
+            {
+                int start = this->NewState();
+                int accept = this->NewState();
+                this->states[start].bytes = bytes;
+                this->states[start].next = accept;
+
+                return { start, accept };
+            }
+
+            void Fail(std::string message)
+            {
+                if(!this->error_)
+                {
+                    this->error_ = std::move(message) + " at offset " + std::to_string(this->position_);
+                }
+            }
+
+            bool AtEnd() const
+            {
+                return this->position_ >= this->pattern_.size();
+            }
+
+            static ByteSet Range(unsigned char first, unsigned char last)
+            {
+                ByteSet bytes;
+                for(unsigned c = first; c <= last; c++)
+                {
+                    bytes.set(c);
+                }
+
+                return bytes;
+            }
+
+            /**
+             * Parses the character after a backslash.
+             */
+            ByteSet Escape()
+            {
+                if(this->AtEnd())
+                {
+                    this->Fail("Dangling escape");
+                    return {};
+                }
+
+                char c = this->pattern_[this->position_++];
+                ByteSet word = Range('a', 'z') | Range('A', 'Z') | Range('0', '9') | Range('_', '_');
+                ByteSet space = Range(' ', ' ') | Range('\t', '\r');
+
+                switch(c)
+                {
+                    case 'd': return Range('0', '9');
+                    case 'D': return ~Range('0', '9');
+                    case 'w': return word;
+                    case 'W': return ~word;
+                    case 's': return space;
+                    case 'S': return ~space;
+                    case 'n': return Range('\n', '\n');
+                    case 'r': return Range('\r', '\r');
+                    case 't': return Range('\t', '\t');
+                }
+
+                // Word boundaries, backreferences, code point escapes, ...
+                if(std::isalnum(static_cast<unsigned char>(c)))
+                {
+                    this->position_--;
+                    this->Fail("Unsupported escape \\" + std::string(1, c));
+                    return {};
+                }
+
+                return Range(c, c);
+            }
+
+            ByteSet Class()
+            {
+                ByteSet bytes;
+
+                bool negated = !this->AtEnd() && this->pattern_[this->position_] == '^';
+                if(negated) this->position_++;
+
+                if(this->pattern_.substr(this->position_).starts_with("[:"))
+                {
+                    this->Fail("POSIX classes are not supported");
+                    return {};
+                }
+
+                bool first = true;
+                while(!this->AtEnd() && (first || this->pattern_[this->position_] != ']'))
+                {
+                    first = false;
+
+                    char c = this->pattern_[this->position_++];
+                    if(c == '\\')
+                    {
+                        ByteSet escaped = this->Escape();
+                        if(escaped.count() != 1)
+                        {
+                            bytes |= escaped;
+                            continue;
+                        }
+
+                        // Single character escapes may start a range.
+                        for(unsigned b = 0; b < 256; b++)
+                        {
+                            if(escaped.test(b)) c = static_cast<char>(b);
+                        }
+                    }
+
+                    if(this->position_ + 1 < this->pattern_.size() && this->pattern_[this->position_] == '-' && this->pattern_[this->position_ + 1] != ']')
+                    {
+                        this->position_++;
+
+                        char last = this->pattern_[this->position_++];
+                        if(last == '\\')
+                        {
+                            ByteSet escaped = this->Escape();
+                            for(unsigned b = 0; b < 256; b++)
+                            {
+                                if(escaped.test(b)) last = static_cast<char>(b);
+                            }
+                        }
+
+                        if(static_cast<unsigned char>(last) < static_cast<unsigned char>(c))
+                        {
+                            this->Fail("Invalid class range");
+                            return {};
+                        }
+
+                        bytes |= Range(c, last);
+                    }
+                    else
+                    {
+                        bytes.set(static_cast<unsigned char>(c));
+                    }
+                }
+
+                if(this->AtEnd())
+                {
+                    this->Fail("Unterminated class");
+                    return {};
+                }
+                this->position_++;
+
+                return negated ? ~bytes : bytes;
+            }
+
+            Fragment Atom()
+            {
+                char c = this->pattern_[this->position_++];
+                switch(c)
+                {
+                    case '(':
+                    {
+                        if(this->pattern_.substr(this->position_).starts_with("?:"))
+                        {
+                            this->position_ += 2;
+                        }
+
+                        Fragment group = this->Alternation();
+                        if(this->AtEnd() || this->pattern_[this->position_] != ')')
+                        {
+                            this->Fail("Unterminated group");
+                            return group;
+                        }
+                        this->position_++;
+
+                        return group;
+                    }
+
+                    case '[': return this->Bytes(this->Class());
+                    case '.': return this->Bytes(~Range('\n', '\n'));
+                    case '\\': return this->Bytes(this->Escape());
+
+                    case '*':
+                    case '+':
+                    case '?':
+                    case '{':
+                    {
+                        this->Fail("Nothing to repeat");
+                        return this->Empty();
+                    }
+
+                    case '^':
+                    case '$':
+                    {
+                        this->position_--;
+                        this->Fail("Anchors are not supported");
+                        return this->Empty();
+                    }
+
+                    default: return this->Bytes(Range(c, c));
+                }
+            }
+
+            /**
+             * Parses a `{n}`, `{n,}` or `{n,m}` quantifier.
+             * @return Minimum and maximum (npos if unbounded) count.
+             */
+            std::pair<std::size_t, std::size_t> Bounds()
+            {
+                auto number = [this]() -> std::optional<std::size_t>
+                {
+                    std::size_t begin = this->position_;
+                    std::size_t value = 0;
+                    while(!this->AtEnd() && std::isdigit(static_cast<unsigned char>(this->pattern_[this->position_])))
+                    {
+                        value = value * 10 + (this->pattern_[this->position_++] - '0');
+                        if(value > kMaxRepetitions) return std::nullopt;
+                    }
+
+                    return this->position_ == begin ? std::nullopt : std::optional(value);
+                };
+
+                auto min = number();
+                std::optional<std::size_t> max = min;
+
+                if(!this->AtEnd() && this->pattern_[this->position_] == ',')
+                {
+                    this->position_++;
+                    max = (!this->AtEnd() && this->pattern_[this->position_] == '}') ? std::optional(std::string_view::npos) : number();
+                }
+
+                if(!min || !max || this->AtEnd() || this->pattern_[this->position_] != '}' || *min > *max)
+                {
+                    this->Fail("Invalid repetition bounds");
+                    return { 0, 0 };
+                }
+                this->position_++;
+
+                return { *min, *max };
+            }
+
+            Fragment Repeat(Fragment fragment, std::size_t atom_begin, std::size_t min, std::size_t max)
+            {
+                // Copies of the atom are made by parsing it again.
+                auto copy = [&]()
+                {
+                    std::size_t resume = this->position_;
+                    this->position_ = atom_begin;
+                    Fragment result = this->Atom();
+                    this->position_ = resume;
+
+                    return result;
+                };
+
+                Fragment result = this->Empty();
+                int tail = result.accept;
+
+                for(std::size_t i = 0; i < min && !this->error_; i++)
+                {
+                    Fragment part = i == 0 ? fragment : copy();
+                    this->states[tail].epsilon.push_back(part.start);
+                    tail = part.accept;
+                }
+
+                if(max == std::string_view::npos)
+                {
+                    Fragment loop = min == 0 ? fragment : copy();
+                    int accept = this->NewState();
+
+                    this->states[tail].epsilon.push_back(loop.start);
+                    this->states[tail].epsilon.push_back(accept);
+                    this->states[loop.accept].epsilon.push_back(loop.start);
+                    this->states[loop.accept].epsilon.push_back(accept);
+
+                    return { result.start, accept };
+                }
+
+                int accept = this->NewState();
+                for(std::size_t i = min; i < max && !this->error_; i++)
+                {
+                    Fragment part = i == 0 ? fragment : copy();
+                    this->states[tail].epsilon.push_back(accept);
+                    this->states[tail].epsilon.push_back(part.start);
+                    tail = part.accept;
+                }
+                this->states[tail].epsilon.push_back(accept);
+
+                return { result.start, accept };
+            }
+
+            Fragment Concatenation()
+            {
+                Fragment result = this->Empty();
+
+                while(!this->AtEnd() && this->pattern_[this->position_] != '|' && this->pattern_[this->position_] != ')' && !this->error_)
+                {
+                    std::size_t atom_begin = this->position_;
+                    Fragment atom = this->Atom();
+
+                    if(!this->AtEnd() && !this->error_)
+                    {
+                        char quantifier = this->pattern_[this->position_];
+
+                        std::optional<std::pair<std::size_t, std::size_t>> bounds;
+                        if(quantifier == '*') bounds = { 0, std::string_view::npos };
+                        else if(quantifier == '+') bounds = { 1, std::string_view::npos };
+                        else if(quantifier == '?') bounds = { 0, 1 };
+
+                        if(bounds || quantifier == '{')
+                        {
+                            this->position_++;
+                            if(quantifier == '{')
+                            {
+                                bounds = this->Bounds();
+                            }
+
+                            atom = this->Repeat(atom, atom_begin, bounds->first, bounds->second);
+
+                            // Lazy and possessive quantifiers have no meaning for a longest-match DFA.
+                            if(!this->AtEnd() && std::string_view("*+?{").contains(this->pattern_[this->position_]))
+                            {
+                                this->Fail("Stacked quantifier");
+                            }
+                        }
+                    }
+
+                    this->states[result.accept].epsilon.push_back(atom.start);
+                    result.accept = atom.accept;
+                }
+
+                return result;
+            }
+
+            Fragment Alternation()
+            {
+                Fragment first = this->Concatenation();
+                if(this->AtEnd() || this->pattern_[this->position_] != '|')
+                {
+                    return first;
+                }
+
+                int start = this->NewState();
+                int accept = this->NewState();
+
+                this->states[start].epsilon.push_back(first.start);
+                this->states[first.accept].epsilon.push_back(accept);
+
+                while(!this->AtEnd() && this->pattern_[this->position_] == '|' && !this->error_)
+                {
+                    this->position_++;
+
+                    Fragment next = this->Concatenation();
+                    this->states[start].epsilon.push_back(next.start);
+                    this->states[next.accept].epsilon.push_back(accept);
+                }
+
+                return { start, accept };
+            }
+
+        public:
+            /**
+             * @return Start and accepting NFA state of the pattern.
+             */
+            std::expected<Fragment, std::string> Compile()
+            {
+                Fragment fragment = this->Alternation();
+
+                if(!this->AtEnd() && !this->error_)
+                {
+                    this->Fail("Unbalanced parenthesis");
+                }
+
+                if(this->error_)
+                {
+                    return std::unexpected(*this->error_);
+                }
+
+                return fragment;
+            }
+
+            explicit Compiler(std::string_view pattern) : pattern_(pattern) {}
+        };
+
+        /// Byte to equivalence class, i.e. the column of `transitions_`.
+        std::array<std::uint8_t, 256> classes_{};
+        std::size_t class_count_ = 0;
+
+        /// Row per state, -1 for the dead state. State 0 is the start state.
+        std::vector<std::int32_t> transitions_;
+        std::vector<std::uint8_t> accepting_;
+
+    public:
+        /**
+         * @param input
+         * @return Length of the longest prefix of `input` matched, if any.
+         */
+        std::optional<std::size_t> Match(std::string_view input) const
+        {
+            std::optional<std::size_t> match;
+            if(this->accepting_[0])
+            {
+                match = 0;
+            }
+
+            std::int32_t state = 0;
+            for(std::size_t i = 0; i < input.size(); i++)
+            {
+                state = this->transitions_[state * this->class_count_ + this->classes_[static_cast<unsigned char>(input[i])]];
+                if(state < 0) break;
+
+                if(this->accepting_[state])
+                {
+                    match = i + 1;
+                }
+            }
+
+            return match;
+        }
+
+        std::size_t StateCount() const
+        {
+            return this->accepting_.size();
+        }
+
+        /**
+         * @return Bytes a match can start with, or all bytes if the empty string matches.
+         */
+        ByteSet FirstBytes() const
+        {
+            ByteSet bytes;
+            for(unsigned b = 0; b < 256; b++)
+            {
+                bytes[b] = this->accepting_[0] || this->transitions_[this->classes_[b]] >= 0;
+            }
+
+            return bytes;
+        }
+
+        /**
+         * Compiles `pattern` into a DFA by subset construction over classes of bytes the pattern does not distinguish.
+         * @param pattern
+         * @return
+         */
+        static std::expected<DFA, Error> Compile(std::string_view pattern)
+        {
+            Compiler compiler(pattern);
+
+            auto fragment = compiler.Compile();
+            if(!fragment)
+            {
+                return std::unexpected(Error{"Invalid pattern \"" + std::string(pattern) + "\": " + fragment.error()});
+            }
+
+            auto const &nfa = compiler.states;
+
+            DFA dfa;
+
+            // Bytes are equivalent if every transition of the NFA either accepts or rejects them all.
+            std::map<std::vector<bool>, std::uint8_t> signatures;
+            for(unsigned b = 0; b < 256; b++)
+            {
+                std::vector<bool> signature;
+                for(auto const &state : nfa)
+                {
+                    if(state.next >= 0)
+                    {
+                        signature.push_back(state.bytes.test(b));
+                    }
+                }
+
+                auto [it, inserted] = signatures.try_emplace(std::move(signature), static_cast<std::uint8_t>(signatures.size()));
+                dfa.classes_[b] = it->second;
+            }
+            dfa.class_count_ = signatures.size();
+
+            std::array<unsigned, 256> representatives{};
+            for(unsigned b = 256; b-- > 0;)
+            {
+                representatives[dfa.classes_[b]] = b;
+            }
+
+            auto closure = [&](std::vector<int> states)
+            {
+                std::vector<bool> seen(nfa.size(), false);
+                for(int state : states) seen[state] = true;
+
+                for(std::size_t i = 0; i < states.size(); i++)
+                {
+                    for(int next : nfa[states[i]].epsilon)
+                    {
+                        if(!seen[next])
+                        {
+                            seen[next] = true;
+                            states.push_back(next);
+                        }
+                    }
+                }
+
+                std::ranges::sort(states);
+                return states;
+            };
+
+            std::map<std::vector<int>, std::int32_t> ids;
+            std::vector<std::vector<int>> subsets = { closure({ fragment->start }) };
+            ids[subsets[0]] = 0;
+
+            for(std::size_t i = 0; i < subsets.size(); i++)
+            {
+                dfa.accepting_.push_back(std::ranges::binary_search(subsets[i], fragment->accept));
+
+                for(std::size_t c = 0; c < dfa.class_count_; c++)
+                {
+                    std::vector<int> moved;
+                    for(int state : subsets[i])
+                    {
+                        if(nfa[state].next >= 0 && nfa[state].bytes.test(representatives[c]))
+                        {
+                            moved.push_back(nfa[state].next);
+                        }
+                    }
+
+                    if(moved.empty())
+                    {
+                        dfa.transitions_.push_back(-1);
+                        continue;
+                    }
+
+                    auto target = closure(std::move(moved));
+                    auto [it, inserted] = ids.try_emplace(target, static_cast<std::int32_t>(subsets.size()));
+                    if(inserted)
+                    {
+                        if(subsets.size() == kMaxStates)
+                        {
+                            return std::unexpected(Error{"Invalid pattern \"" + std::string(pattern) + "\": more than " + std::to_string(kMaxStates) + " DFA states"});
+                        }
+
+                        subsets.push_back(std::move(target));
+                    }
+
+                    dfa.transitions_.push_back(it->second);
+                }
+            }
+
+            return dfa;
+        }
+    };
+
+    /**
+     * COMBINED DFA
+     * Product of several DFAs, running them all in a single pass over the input instead of one pass each. Every state
+     * records, one bit per DFA, which of them accept and which can still match further.
+     */
+    class CombinedDFA
+    {
+        std::array<std::uint8_t, 256> classes_{};
+        std::size_t class_count_ = 0;
+
+        /// Row per state, -1 for the dead state. State 0 is the start state.
+        std::vector<std::int32_t> transitions_;
+
+        /// Bitsets of `words_` words per state.
+        std::vector<std::uint64_t> accepting_;
+        std::vector<std::uint64_t> alive_;
+
+        std::size_t size_ = 0;
+        std::size_t words_ = 0;
+
+    public:
+        /**
+         * Upper bound for the states of a combined DFA. Terminals of larger products are scanned one at a time.
+         */
+        static constexpr std::size_t kMaxStates = 50000;
+
+        /**
+         * @return Number of DFAs combined.
+         */
+        std::size_t Size() const
+        {
+            return this->size_;
+        }
+
+        /**
+         * @return Words of the bitsets over the combined DFAs, e.g. the masks given to Run.
+         */
+        std::size_t Words() const
+        {
+            return this->words_;
+        }
+
+        std::size_t StateCount() const
+        {
+            return this->alive_.size() / this->words_;
+        }
+
+        /**
+         * Runs the DFAs in `mask` over `input`, until none of them can match any further.
+         * @param input
+         * @param mask Bitset of Words() words.
+         * @param path States after each byte consumed, starting with the start state.
+         */
+        void Run(std::string_view input, std::span<std::uint64_t const> mask, std::vector<std::int32_t> &path) const
+        {
+            path.assign(1, 0);
+
+            std::int32_t state = 0;
+            for(std::size_t i = 0; i < input.size() && this->Alive(state, mask); i++)
+            {
+                state = this->transitions_[state * this->class_count_ + this->classes_[static_cast<unsigned char>(input[i])]];
+                if(state < 0) break;
+
+                path.push_back(state);
+            }
+        }
+
+        /**
+         * @param path Path of a Run whose mask included `dfa`.
+         * @param dfa
+         * @return Length of the longest prefix matched by `dfa`, as DFA::Match would return it.
+         */
+        std::optional<std::size_t> Longest(std::span<std::int32_t const> path, std::size_t dfa) const
+        {
+            std::uint64_t bit = std::uint64_t(1) << (dfa % 64);
+            for(std::size_t i = path.size(); i-- > 0;)
+            {
+                if(this->accepting_[path[i] * this->words_ + dfa / 64] & bit)
+                {
+                    return i;
+                }
+            }
+
+            return std::nullopt;
+        }
+
+        /**
+         * Combines `dfas` by product construction over classes of bytes none of them distinguish.
+         * @param dfas
+         * @return
+         */
+        static std::expected<CombinedDFA, Error> Combine(std::span<DFA const *const> dfas)
+        {
+            CombinedDFA combined;
+            combined.size_ = dfas.size();
+            combined.words_ = std::max<std::size_t>(1, (dfas.size() + 63) / 64);
+
+            std::map<std::vector<std::uint8_t>, std::uint8_t> signatures;
+            for(unsigned b = 0; b < 256; b++)
+            {
+                std::vector<std::uint8_t> signature;
+                for(auto dfa : dfas)
+                {
+                    signature.push_back(dfa->classes_[b]);
+                }
+
+                auto [it, inserted] = signatures.try_emplace(std::move(signature), static_cast<std::uint8_t>(signatures.size()));
+                combined.classes_[b] = it->second;
+            }
+            combined.class_count_ = signatures.size();
+
+            std::array<unsigned, 256> representatives{};
+            for(unsigned b = 256; b-- > 0;)
+            {
+                representatives[combined.classes_[b]] = b;
+            }
+
+            std::map<std::vector<std::int32_t>, std::int32_t> ids;
+            std::vector<std::vector<std::int32_t>> tuples = { std::vector<std::int32_t>(dfas.size(), 0) };
+            ids[tuples[0]] = 0;
+
+            for(std::size_t i = 0; i < tuples.size(); i++)
+            {
+                combined.accepting_.resize(combined.accepting_.size() + combined.words_);
+                combined.alive_.resize(combined.alive_.size() + combined.words_);
+                for(std::size_t k = 0; k < dfas.size(); k++)
+                {
+                    std::int32_t state = tuples[i][k];
+                    if(state < 0) continue;
+
+                    auto row = std::span(dfas[k]->transitions_).subspan(state * dfas[k]->class_count_, dfas[k]->class_count_);
+                    if(std::ranges::any_of(row, [](std::int32_t next) { return next >= 0; }))
+                    {
+                        combined.alive_[i * combined.words_ + k / 64] |= std::uint64_t(1) << (k % 64);
+                    }
+
+                    if(dfas[k]->accepting_[state])
+                    {
+                        combined.accepting_[i * combined.words_ + k / 64] |= std::uint64_t(1) << (k % 64);
+                    }
+                }
+
+                for(std::size_t c = 0; c < combined.class_count_; c++)
+                {
+                    std::vector<std::int32_t> moved(dfas.size(), -1);
+                    bool alive = false;
+                    for(std::size_t k = 0; k < dfas.size(); k++)
+                    {
+                        std::int32_t state = tuples[i][k];
+                        if(state < 0) continue;
+
+                        moved[k] = dfas[k]->transitions_[state * dfas[k]->class_count_ + dfas[k]->classes_[representatives[c]]];
+                        alive = alive || moved[k] >= 0;
+                    }
+
+                    if(!alive)
+                    {
+                        combined.transitions_.push_back(-1);
+                        continue;
+                    }
+
+                    auto [it, inserted] = ids.try_emplace(moved, static_cast<std::int32_t>(tuples.size()));
+                    if(inserted)
+                    {
+                        if(tuples.size() == kMaxStates)
+                        {
+                            return std::unexpected(Error{"Combined scanner has more than " + std::to_string(kMaxStates) + " DFA states"});
+                        }
+
+                        tuples.push_back(std::move(moved));
+                    }
+
+                    combined.transitions_.push_back(it->second);
+                }
+            }
+
+            return combined;
+        }
+
+    private:
+        bool Alive(std::int32_t state, std::span<std::uint64_t const> mask) const
+        {
+            for(std::size_t w = 0; w < this->words_; w++)
+            {
+                if(this->alive_[state * this->words_ + w] & mask[w])
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+    };
+
+    /**
+     * TERMINAL REGISTRY
+     * Scanners shared by the runtime terminals of several grammars, e.g. dialects of a language loaded from grammar
+     * files. Terminals compiled against a registry (RuntimeTerminal::Compile(TerminalRegistry &)) share one DFA per
+     * pattern, and each pattern gets a stable id. Terminals themselves stay per grammar, as their precedence and
+     * associativity may differ between grammars.
+     *
+     * Parsers built from such terminals share one CombinedDFA over all patterns of the registry (see Combined), each
+     * masking it down to the candidates of its states. Terminals and parsers share ownership of the scanners they use,
+     * so the registry only has to outlive the builds of parsers using its terminals.
+     */
+    class TerminalRegistry
+    {
+        std::map<std::string, std::size_t, std::less<>> ids_;
+        std::vector<std::shared_ptr<DFA const>> scanners_;
+
+        /// Scanner over `scanners_`, rebuilt on demand after new registrations.
+        mutable std::shared_ptr<CombinedDFA const> combined_;
+
+        mutable std::mutex mutex_;
+
+    public:
+        /**
+         * @return Id of `pattern`, compiled on first registration.
+         */
+        std::expected<std::size_t, Error> Register(std::string_view pattern)
+        {
+            std::lock_guard lock(this->mutex_);
+
+            auto it = this->ids_.find(pattern);
+            if(it != this->ids_.end())
+            {
+                return it->second;
+            }
+
+            auto dfa = DFA::Compile(pattern);
+            if(!dfa)
+            {
+                return std::unexpected(dfa.error());
+            }
+
+            this->scanners_.push_back(std::make_shared<DFA const>(std::move(*dfa)));
+            this->ids_.emplace(std::string(pattern), this->scanners_.size() - 1);
+
+            return this->scanners_.size() - 1;
+        }
+
+        std::shared_ptr<DFA const> Scanner(std::size_t id) const
+        {
+            std::lock_guard lock(this->mutex_);
+            return this->scanners_[id];
+        }
+
+        std::size_t Size() const
+        {
+            std::lock_guard lock(this->mutex_);
+            return this->scanners_.size();
+        }
+
+        /**
+         * Scanner running the DFAs of all patterns registered so far, indexed by pattern id. It is built on the first
+         * call after a registration, so loading all dialects before building their parsers gives them a single one.
+         * @return
+         */
+        std::expected<std::shared_ptr<CombinedDFA const>, Error> Combined() const
+        {
+            std::lock_guard lock(this->mutex_);
+
+            if(!this->combined_ || this->combined_->Size() != this->scanners_.size())
+            {
+                std::vector<DFA const *> dfas;
+                for(auto const &scanner : this->scanners_)
+                {
+                    dfas.push_back(scanner.get());
+                }
+
+                auto combined = CombinedDFA::Combine(dfas);
+                if(!combined)
+                {
+                    return std::unexpected(combined.error());
+                }
+
+                this->combined_ = std::make_shared<CombinedDFA const>(std::move(*combined));
+            }
+
+            return this->combined_;
+        }
+    };
+
+    /**
+     * RUNTIME TERMINAL
+     * Terminal whose pattern is only known at runtime, e.g. keywords or operators read from configuration. The pattern
+     * is compiled to a DFA when a parser using the terminal is built; invalid patterns fail the build. Unlike
+     * DefineTerminal, the longest match is taken.
+     * @tparam G
+     */
+    template<IGrammar G>
+    class RuntimeTerminal : public Terminal<G>
+    {
+        std::string pattern_;
+        std::shared_ptr<DFA const> dfa_;
+
+        /// Either Compile() runs once, even when parsers using the terminal are built concurrently.
+        std::once_flag compiled_;
+        std::optional<Error> error_;
+
+        /// TerminalRegistry the terminal was compiled against, and the id of its pattern there.
+        TerminalRegistry const *registry_ = nullptr;
+        std::optional<std::size_t> registry_id_;
+
+    public:
+        std::string_view Pattern() const
+        {
+            return this->pattern_;
+        }
+
+        std::optional<std::size_t> RegistryId() const
+        {
+            return this->registry_id_;
+        }
+
+        std::optional<Error> Compile() override
+        {
+            std::call_once(this->compiled_, [this]
+            {
+                auto dfa = DFA::Compile(this->pattern_);
+                if(!dfa)
+                {
+                    this->error_ = dfa.error();
+                    return;
+                }
+
+                this->dfa_ = std::make_shared<DFA const>(std::move(*dfa));
+            });
+
+            return this->error_;
+        }
+
+        /**
+         * Compiles the pattern through `registry`, sharing the DFA with other terminals of the same pattern. Must be
+         * called before any parser using the terminal is built, which compiles it on its own otherwise; later calls
+         * with another registry fail.
+         * @param registry
+         * @return
+         */
+        std::optional<Error> Compile(TerminalRegistry &registry)
+        {
+            bool registered = false;
+            std::call_once(this->compiled_, [&]
+            {
+                registered = true;
+
+                auto id = registry.Register(this->pattern_);
+                if(!id)
+                {
+                    this->error_ = id.error();
+                    return;
+                }
+
+                this->dfa_ = registry.Scanner(*id);
+                this->registry_ = &registry;
+                this->registry_id_ = *id;
+            });
+
+            if(!registered && this->registry_ != &registry)
+            {
+                return Error{"Terminal \"" + this->pattern_ + "\" is already compiled"};
+            }
+
+            return this->error_;
+        }
+
+        std::optional<Token<G>> Lex(std::string_view input) const override
+        {
+            auto length = this->dfa_->Match(input);
+
+            if(!length)
+            {
+                return std::nullopt;
+            }
+
+            return Token<G> {
+                    .terminal = (Terminal<G>*)this,
+                    .raw = input.substr(0, *length),
+                    .location = {
+                            .buffer = {},
+                            .begin = 0,
+                            .end = *length,
+                    },
+            };
+        }
+
+        std::bitset<256> FirstBytes() const override
+        {
+            return this->dfa_ ? this->dfa_->FirstBytes() : Terminal<G>::FirstBytes();
+        }
+
+        std::shared_ptr<DFA const> Automaton() const override
+        {
+            return this->dfa_;
+        }
+
+        std::pair<TerminalRegistry const *, std::size_t> Registration() const override
+        {
+            return { this->registry_, this->registry_id_.value_or(0) };
+        }
+
+        RuntimeTerminal(std::string pattern, Associativity assoc = bf::None, typename G::UserDataType user_data = {}, typename Terminal<G>::ReasonerType reasoner = nullptr) : pattern_(std::move(pattern))
+        {
+            this->associativity = assoc;
+            this->user_data = user_data;
+            this->reasoner_ = reasoner;
+        }
+
+        RuntimeTerminal(std::string pattern, Associativity assoc, typename Terminal<G>::ReasonerType reasoner) : RuntimeTerminal(std::move(pattern), assoc, {}, reasoner) {}
+
+        RuntimeTerminal(std::string pattern, typename Terminal<G>::ReasonerType reasoner) : RuntimeTerminal(std::move(pattern), bf::None, {}, reasoner) {}
+    };
+
+    /**
+     * NON-TERMINAL
+     */
+    template<IGrammar G>
+    class NonTerminal
+    {
+        friend class Grammar<G>;
+        friend struct LRState<G>;
+        friend class Subrule<G>;
+
+    public:
+        using TransductorType = typename G::ValueType(*)(std::vector<typename G::ValueType> &);
+
+    protected:
+        std::vector<ProductionRule<G>> rules_;
+
+    public:
+        NonTerminal(NonTerminal  &) = delete;
+        NonTerminal(NonTerminal &&) = delete;
+
+        NonTerminal() = default;
+
+        NonTerminal(ProductionRule<G> const &rule) : rules_({rule}) {}
+        NonTerminal(ProductionRuleList<G> const &rule_list) : rules_(rule_list.rules) {}
+    };
+
+    /**
+     * DEFINE NON-TERMINAL
+     */
+    template<IGrammar G, typename SemanticValue = void>
+    class DefineNonTerminal : public NonTerminal<G>
+    {
+    public:
+        SemanticValue operator()(typename G::ValueType &value)
+        {
+            if constexpr(std::variant_size<typename G::ValueType>::value != 0)
+            {
+                if(!std::holds_alternative<SemanticValue>(value))
+                {
+                    throw std::runtime_error("failed to convert type");
+                }
+
+                return std::move(std::get<SemanticValue>(value));
+            }
+            else
+            {
+                return std::move(reinterpret_cast<SemanticValue>(value));
+            }
+        }
+
+        DefineNonTerminal() = delete;
+
+        DefineNonTerminal(ProductionRule<G> const &rule) : NonTerminal<G>(rule) {}
+        DefineNonTerminal(ProductionRuleList<G> const &rule_list) : NonTerminal<G>(rule_list) {}
+    };
+
+    /**
+     * SYMBOL
+     */
+    template<IGrammar G>
+    using Symbol = std::variant<Terminal<G>*, NonTerminal<G>*>;
+
+    /*
+     * PRODUCTION RULES
+     */
+    template<IGrammar G>
+    class ProductionRule
+    {
+        friend class Grammar<G>;
+        friend struct LRItem<G>;
+        friend class Parser<G>;
+        friend class LRParser<G>;
+        friend class SLRParser<G>;
+        friend class LR1Parser<G>;
+        friend class Subrule<G>;
+
+    protected:
+        typename NonTerminal<G>::TransductorType transductor_ = nullptr;
+        std::vector<Symbol<G>> sequence_;
+        std::size_t precedence = -1;
+        FeatureMask features_ = kAllFeatures;
+
+        NonTerminal<G> *non_terminal_ = nullptr;
+
+        /// Keeps NonTerminals generated by repetition combinators in `sequence_` alive.
+        std::vector<std::shared_ptr<NonTerminal<G>>> subrules_;
+
+    public:
+        ProductionRule &operator+(Terminal<G> &rhs)
+        {
+            this->sequence_.push_back(&rhs);
+
+            return *this;
+        }
+
+        ProductionRule &operator+(NonTerminal<G> &rhs)
+        {
+            this->sequence_.push_back(&rhs);
+
+            return *this;
+        }
+
+        ProductionRule &operator+(Subrule<G> const &rhs)
+        {
+            this->sequence_.push_back(rhs.non_terminal_.get());
+            this->subrules_.push_back(rhs.non_terminal_);
+
+            return *this;
+        }
+
+        /**
+         * Restricts the rule to the dialects in `features`, e.g. `(KW_ASYNC + block).Features(kV2)<=>action`.
+         */
+        ProductionRule &Features(FeatureMask features)
+        {
+            this->features_ = features;
+
+            return *this;
+        }
+
+        ProductionRule &operator<=>(typename NonTerminal<G>::TransductorType tranductor)
+        {
+            this->transductor_ = tranductor;
+
+            return *this;
+        }
+
+        bool operator==(ProductionRule<G> const &other) const
+        {
+            if(this->non_terminal_ && other.non_terminal_)
+            {
+                if(this->non_terminal_ != other.non_terminal_) return false;
+            }
+            else if(this->non_terminal_ != other.non_terminal_)
+            {
+                return false;
+            }
+
+            if(this->sequence_.size() != other.sequence_.size()) return false;
+
+            for(auto const &[first, second] : std::views::zip(this->sequence_, other.sequence_))
+            {
+                if(first != second) return false;
+            }
+
+            return true;
+        }
+
+        std::optional<typename G::ValueType> Transduce(std::vector<typename G::ValueType> &args) const
+        {
+            if(this->transductor_)
+            {
+                return std::move(this->transductor_(args));
+            }
+
+            return std::nullopt;
+        }
+
+        ProductionRule(Terminal<G>       &terminal) : sequence_({ &terminal }) {}
+        ProductionRule(NonTerminal<G> &nonterminal) : sequence_({ &nonterminal }) {}
+        ProductionRule(Subrule<G> const   &subrule) : sequence_({ subrule.non_terminal_.get() }), subrules_({ subrule.non_terminal_ }) {}
+
+        /**
+         * Empty production.
+         */
+        ProductionRule() = default;
+    };
+
+    template<IGrammar G>
+    using PR = ProductionRule<G>;
+
+    /**
+     * Semantic action passing on the value of a single-symbol production. NonTerminals whose rules all use it can be
+     * inlined into their only use by the grammar optimization passes.
+     */
+    template<IGrammar G>
+    typename G::ValueType Forward(std::vector<typename G::ValueType> &$)
+    {
+        return std::move($[0]);
+    }
+
+    /**
+     * Accesses the T held by a grammar's ValueType, which is either T itself or a std::variant holding T.
+     */
+    template<typename T, typename ValueType>
+    T &ValueAs(ValueType &value)
+    {
+        if constexpr(std::same_as<T, ValueType>)
+        {
+            return value;
+        }
+        else
+        {
+            if(!std::holds_alternative<T>(value))
+            {
+                throw std::runtime_error("failed to convert type");
+            }
+
+            return std::get<T>(value);
+        }
+    }
+
+    /**
+     * SUBRULE
+     * Anonymous NonTerminal generated by the repetition combinators (bf::ZeroOrMore, bf::OneOrMore, bf::Optional).
+     * Repetitions expand to left-recursive rules that append to the list value in place, so reading N items does O(N)
+     * work with a constant parse stack depth. Subrules are owned by the ProductionRules they are used in.
+     * @tparam G
+     */
+    template<IGrammar G>
+    class Subrule
+    {
+        friend class ProductionRule<G>;
+
+        using ValueType = typename G::ValueType;
+
+        std::shared_ptr<NonTerminal<G>> non_terminal_ = std::make_shared<NonTerminal<G>>();
+
+        explicit Subrule(std::vector<ProductionRule<G>> rules)
+        {
+            this->non_terminal_->rules_ = std::move(rules);
+        }
+
+    public:
+        /**
+         * `H -> H item | item`, where the value of H is a ListType holding the item values.
+         */
+        template<typename ListType>
+        static Subrule OneOrMore(ProductionRule<G> item)
+        {
+            Subrule subrule({});
+
+            ProductionRule<G> append(*subrule.non_terminal_);
+            append.sequence_.insert(append.sequence_.end(), item.sequence_.begin(), item.sequence_.end());
+            append.subrules_ = item.subrules_;
+
+            ProductionRule<G> first = std::move(item);
+            first <=> [](std::vector<ValueType> &$) -> ValueType
+            {
+                ListType list;
+                list.push_back(std::move(ValueAs<typename ListType::value_type>($[0])));
+                return list;
+            };
+
+            append <=> [](std::vector<ValueType> &$) -> ValueType
+            {
+                ValueAs<ListType>($[0]).push_back(std::move(ValueAs<typename ListType::value_type>($[1])));
+                return std::move($[0]);
+            };
+
+            subrule.non_terminal_->rules_ = { first, append };
+            return subrule;
+        }
+
+        /**
+         * `H -> H item | <empty>`, where the value of H is a ListType holding the item values.
+         */
+        template<typename ListType>
+        static Subrule ZeroOrMore(ProductionRule<G> item)
+        {
+            Subrule subrule = OneOrMore<ListType>(std::move(item));
+
+            subrule.non_terminal_->rules_[0] = ProductionRule<G>() <=> [](std::vector<ValueType> &) -> ValueType
+            {
+                return ListType{};
+            };
+
+            return subrule;
+        }
+
+        /**
+         * `H -> item | <empty>`, where the value of H is the item's value or a default constructed ValueType.
+         */
+        static Subrule Optional(ProductionRule<G> item)
+        {
+            item <=> Forward<G>;
+
+            return Subrule({ item, ProductionRule<G>() });
+        }
+    };
+
+    /*
+     * REPETITION COMBINATORS
+     */
+    template<typename ListType, IGrammar G>
+    Subrule<G> ZeroOrMore(Terminal<G> &item)
+    {
+        return Subrule<G>::template ZeroOrMore<ListType>(item);
+    }
+
+    template<typename ListType, IGrammar G>
+    Subrule<G> ZeroOrMore(NonTerminal<G> &item)
+    {
+        return Subrule<G>::template ZeroOrMore<ListType>(item);
+    }
+
+    template<typename ListType, IGrammar G>
+    Subrule<G> OneOrMore(Terminal<G> &item)
+    {
+        return Subrule<G>::template OneOrMore<ListType>(item);
+    }
+
+    template<typename ListType, IGrammar G>
+    Subrule<G> OneOrMore(NonTerminal<G> &item)
+    {
+        return Subrule<G>::template OneOrMore<ListType>(item);
+    }
+
+    template<IGrammar G>
+    Subrule<G> Optional(Terminal<G> &item)
+    {
+        return Subrule<G>::Optional(item);
+    }
+
+    template<IGrammar G>
+    Subrule<G> Optional(NonTerminal<G> &item)
+    {
+        return Subrule<G>::Optional(item);
+    }
+
+    /**
+     * RIGHT RECURSION
+     * Production found by the stack-depth analysis whose last symbol derives its own NonTerminal again. Every
+     * repetition of such a construct stays on the parse stack until the whole construct has been read.
+     * @tparam G
+     */
+    template<IGrammar G>
+    struct RightRecursion
+    {
+        NonTerminal<G> *non_terminal;
+
+        /// Index of the production in the order it was defined on `non_terminal`, after the grammar optimization passes.
+        std::size_t rule_index;
+
+        /// Parse stack entries added per repetition, i.e. worst-case stack depth grows by this much per item.
+        std::size_t stack_growth;
+
+        /**
+         * Equivalent left-recursive sequence for `non_terminal` that keeps the stack depth constant, if one can be
+         * derived from a non-recursive alternative (e.g. `list -> item list | item` becomes `list -> list item`).
+         * Empty if no such rewrite was found.
+         */
+        std::vector<Symbol<G>> left_recursive_sequence;
+    };
+
+    /*
+     * GRAMMAR
+     */
+    template<IGrammar G>
+    class Grammar
+    {
+        friend class Parser<G>;
+        friend class LRParser<G>;
+        friend class SLRParser<G>;
+        friend class LR1Parser<G>;
+        friend struct LRState<G>;
+
+    protected:
+        /**
+         * Unique pointer to an EOS terminal for this grammar. This allows the grammar to be moved while still
+         * retaining the ability to perform pointer comparison on the EOS terminal.
+         */
+        std::unique_ptr<Terminal<G>> EOS;
+
+        std::set<NonTerminal<G>*> nonterminals_;
+        std::set<Terminal<G>*> terminals_;
+
+        std::map<NonTerminal<G>*, std::set<Terminal<G>*>> first_;
+        std::map<NonTerminal<G>*, std::set<Terminal<G>*>> follow_;
+
+        /// NonTerminals that can derive the empty sequence.
+        std::set<NonTerminal<G>*> nullable_;
+
+        /// Production rules of each NonTerminal, as rewritten by the grammar optimization passes.
+        std::map<NonTerminal<G>*, std::vector<ProductionRule<G>>> rules_;
+
+        /// NonTerminals removed as unproductive or unreachable, and NonTerminals inlined into their only use.
+        std::vector<NonTerminal<G>*> removed_;
+        std::vector<NonTerminal<G>*> inlined_;
+
+        /**
+         * @return View over all production rules of the grammar.
+         */
+        auto ProductionRules() const
+        {
+            return this->rules_ | std::views::values | std::views::join;
+        }
+
+    public:
+        NonTerminal<G> &root;
+
+        bool HasNonTerminal(NonTerminal<G> &non_terminal) const
+        {
+            return this->nonterminals_.contains(&non_terminal);
+        }
+
+        bool NonTerminalHasFollow(NonTerminal<G> &non_terminal, Terminal<G> &terminal) const
+        {
+            return this->follow_.at(&non_terminal).contains(&terminal);
+        }
+
+        bool NonTerminalHasFirst(NonTerminal<G> &non_terminal, Terminal<G> &terminal) const
+        {
+            return this->first_.at(&non_terminal).contains(&terminal);
+        }
+
+        /**
+         * Generates the set of NonTerminals that can derive the empty sequence.
+         */
+        void GenerateNullableSet()
+        {
+            bool has_change;
+            do
+            {
+                has_change = false;
+
+                for(auto const &rule : this->ProductionRules())
+                {
+                    NonTerminal<G> *nonterminal = rule.non_terminal_;
+
+                    if(this->nullable_.contains(nonterminal)) continue;
+
+                    bool nullable = std::ranges::all_of(rule.sequence_, [&](Symbol<G> const &symbol)
+                    {
+                        return std::holds_alternative<NonTerminal<G>*>(symbol) && this->nullable_.contains(std::get<NonTerminal<G>*>(symbol));
+                    });
+
+                    if(nullable)
+                    {
+                        this->nullable_.insert(nonterminal);
+                        has_change = true;
+                    }
+                }
+            } while(has_change);
+        }
+
+        /**
+         * Simple, but somewhat inefficient algorithm for generating FIRST sets.
+         * The FIRST set is the set of all Terminals that a NonTerminal can begin with.
+         */
+        void GenerateFirstSet()
+        {
+            bool has_change;
+            do
+            {
+                has_change = false;
+
+                for(auto const &rule : this->ProductionRules())
+                {
+                    NonTerminal<G> *nonterminal = rule.non_terminal_;
+
+                    for(auto const &symbol : rule.sequence_)
+                    {
+                        // Continue with the next symbol as long as the current one can be empty.
+                        bool nullable = std::visit(overload{
+                            [&](Terminal<G> *terminal)
+                            {
+                                auto [it, inserted] = this->first_[nonterminal].insert(terminal);
+                                has_change |= inserted;
+
+                                return false;
+                            },
+                            [&](NonTerminal<G> *child_nonterminal)
+                            {
+                                if(child_nonterminal != nonterminal)
+                                {
+                                    auto &parent_first = this->first_[nonterminal];
+                                    auto &child_first = this->first_[child_nonterminal];
+
+                                    std::size_t parent_size = parent_first.size();
+                                    parent_first.insert(child_first.begin(), child_first.end());
+
+                                    has_change |= parent_size != parent_first.size();
+                                }
+
+                                return this->nullable_.contains(child_nonterminal);
+                            }
+                        }, symbol);
+
+                        if(!nullable) break;
+                    }
+                }
+            } while(has_change);
+        }
+
+        /**
+         * Simple, but somewhat inefficient algorithm for generating FOLLOW sets.
+         * The FOLLOW set is the set of all Terminals that can follow a NonTerminal.
+         */
+        void GenerateFollowSet()
+        {
+            this->follow_[&root] = { this->EOS.get() };
+
+            bool has_change;
+            do
+            {
+                has_change = false;
+
+                for(auto const &rule : this->ProductionRules())
+                {
+                    NonTerminal<G> *nonterminal = rule.non_terminal_;
+
+                    for(int i = 0; i < rule.sequence_.size(); i++)
+                    {
+                        // Skip over Terminals
+                        if(std::holds_alternative<Terminal<G>*>(rule.sequence_[i])) continue;
+
+                        // Process NonTerminal
+                        auto symbol = std::get<NonTerminal<G>*>(rule.sequence_[i]);
+                        auto &symbol_follow = this->follow_[symbol];
+                        std::size_t symbol_size = symbol_follow.size();
+
+                        // Add FIRST of the following symbols, up to and including the first one that cannot be empty.
+                        bool rest_nullable = true;
+                        for(int j = i + 1; j < rule.sequence_.size() && rest_nullable; j++)
+                        {
+                            rest_nullable = std::visit(overload{
+                                [&](Terminal<G> *terminal)
+                                {
+                                    symbol_follow.insert(terminal);
+                                    return false;
+                                },
+                                [&](NonTerminal<G> *follow_nonterminal)
+                                {
+                                    auto &follow_first = this->first_[follow_nonterminal];
+                                    symbol_follow.insert(follow_first.begin(), follow_first.end());
+
+                                    return this->nullable_.contains(follow_nonterminal);
+                                }
+                            }, rule.sequence_[j]);
+                        }
+
+                        // If the rest of the sequence can be empty, then it gets all of the FOLLOW of parent.
+                        if(rest_nullable && symbol != nonterminal)
+                        {
+                            auto &parent_follow = this->follow_[nonterminal];
+                            symbol_follow.insert(parent_follow.begin(), parent_follow.end());
+                        }
+
+                        has_change |= symbol_size != symbol_follow.size();
+                    }
+                }
+            } while(has_change);
+        }
+
+        /**
+         * Stack-depth analysis. Finds productions that are right-recursive, directly or through the last symbol of
+         * other productions, without also being left-recursive (binary operator rules are resolved by precedence).
+         * @return
+         */
+        std::vector<RightRecursion<G>> FindRightRecursions() const
+        {
+            // tail[A][B]: minimum stack entries left behind when A derives a sequence ending in B.
+            std::map<NonTerminal<G>*, std::map<NonTerminal<G>*, std::size_t>> tail;
+
+            for(auto const &rule : this->ProductionRules())
+            {
+                NonTerminal<G> *nonterminal = rule.non_terminal_;
+
+                if(rule.sequence_.empty() || !std::holds_alternative<NonTerminal<G>*>(rule.sequence_.back())) continue;
+
+                auto last = std::get<NonTerminal<G>*>(rule.sequence_.back());
+                auto [it, inserted] = tail[nonterminal].try_emplace(last, rule.sequence_.size() - 1);
+                it->second = std::min(it->second, rule.sequence_.size() - 1);
+            }
+
+            for(auto via : this->nonterminals_)
+            {
+                for(auto from : this->nonterminals_)
+                {
+                    if(!tail[from].contains(via)) continue;
+
+                    for(auto const &[to, weight] : std::map(tail[via]))
+                    {
+                        std::size_t total = tail[from][via] + weight;
+                        auto [it, inserted] = tail[from].try_emplace(to, total);
+                        it->second = std::min(it->second, total);
+                    }
+                }
+            }
+
+            std::vector<RightRecursion<G>> recursions;
+
+            for(auto nonterminal : this->nonterminals_)
+            {
+                auto const &rules = this->rules_.at(nonterminal);
+
+                for(std::size_t i = 0; i < rules.size(); i++)
+                {
+                    auto const &sequence = rules[i].sequence_;
+
+                    if(sequence.empty() || sequence.front() == Symbol<G>(nonterminal)) continue;
+                    if(!std::holds_alternative<NonTerminal<G>*>(sequence.back())) continue;
+
+                    auto last = std::get<NonTerminal<G>*>(sequence.back());
+
+                    std::size_t growth = sequence.size() - 1;
+                    if(last != nonterminal)
+                    {
+                        if(!tail[last].contains(nonterminal)) continue;
+                        growth += tail[last][nonterminal];
+                    }
+
+                    if(growth == 0) continue;
+
+                    RightRecursion<G> recursion{
+                        .non_terminal = nonterminal,
+                        .rule_index = i,
+                        .stack_growth = growth,
+                        .left_recursive_sequence = {},
+                    };
+
+                    // `N -> a b N | a` is equivalent to `N -> N b a | a`.
+                    if(last == nonterminal)
+                    {
+                        for(auto const &base : rules)
+                        {
+                            auto const &base_sequence = base.sequence_;
+                            if(std::ranges::find(base_sequence, Symbol<G>(nonterminal)) != base_sequence.end()) continue;
+                            if(base_sequence.size() > sequence.size() - 1) continue;
+                            if(!std::ranges::equal(base_sequence, sequence | std::views::take(base_sequence.size()))) continue;
+
+                            recursion.left_recursive_sequence.push_back(nonterminal);
+                            for(std::size_t j = base_sequence.size(); j < sequence.size() - 1; j++)
+                            {
+                                recursion.left_recursive_sequence.push_back(sequence[j]);
+                            }
+                            recursion.left_recursive_sequence.insert(recursion.left_recursive_sequence.end(), base_sequence.begin(), base_sequence.end());
+                            break;
+                        }
+                    }
+
+                    recursions.push_back(std::move(recursion));
+                }
+            }
+
+            return recursions;
+        }
+
+        /**
+         * Rule precedence defaults to the precedence of the LAST terminal in sequence.
+         * @param rule
+         */
+        static void AssignPrecedence(ProductionRule<G> &rule)
+        {
+            rule.precedence = -1;
+
+            for(auto const &symbol : rule.sequence_ | std::views::reverse)
+            {
+                if(std::holds_alternative<Terminal<G>*>(symbol))
+                {
+                    rule.precedence = std::get<Terminal<G>*>(symbol)->precedence;
+                    break;
+                }
+            }
+        }
+
+        void RegisterSymbols(NonTerminal<G> *nonterminal)
+        {
+            this->nonterminals_.insert(nonterminal);
+
+            auto &rules = this->rules_[nonterminal];
+            rules = nonterminal->rules_;
+
+            for(auto &rule : rules)
+            {
+                rule.non_terminal_ = nonterminal;
+
+                for(auto &symbol : rule.sequence_)
+                {
+                    std::visit(overload{
+                        [&](Terminal<G> *terminal)
+                        {
+                            this->terminals_.insert(terminal);
+                        },
+                        [&](NonTerminal<G> *child_nonterminal)
+                        {
+                            if(this->nonterminals_.contains(child_nonterminal)) return;
+
+                            this->RegisterSymbols(child_nonterminal);
+                        }
+                    }, symbol);
+                }
+
+                AssignPrecedence(rule);
+            }
+        }
+
+        /**
+         * Optimization pass removing rules that use unproductive NonTerminals (those that cannot derive a string of
+         * Terminals), followed by the NonTerminals that are no longer reachable from the root.
+         */
+        void RemoveUselessSymbols()
+        {
+            std::set<NonTerminal<G>*> productive;
+
+            bool has_change;
+            do
+            {
+                has_change = false;
+
+                for(auto const &rule : this->ProductionRules())
+                {
+                    if(productive.contains(rule.non_terminal_)) continue;
+
+                    bool is_productive = std::ranges::all_of(rule.sequence_, [&](Symbol<G> const &symbol)
+                    {
+                        return std::holds_alternative<Terminal<G>*>(symbol) || productive.contains(std::get<NonTerminal<G>*>(symbol));
+                    });
+
+                    if(is_productive)
+                    {
+                        productive.insert(rule.non_terminal_);
+                        has_change = true;
+                    }
+                }
+            } while(has_change);
+
+            for(auto &rules : this->rules_ | std::views::values)
+            {
+                std::erase_if(rules, [&](ProductionRule<G> const &rule)
+                {
+                    return std::ranges::any_of(rule.sequence_, [&](Symbol<G> const &symbol)
+                    {
+                        return std::holds_alternative<NonTerminal<G>*>(symbol) && !productive.contains(std::get<NonTerminal<G>*>(symbol));
+                    });
+                });
+            }
+
+            std::set<NonTerminal<G>*> reachable = { &this->root };
+            std::vector<NonTerminal<G>*> worklist = { &this->root };
+            while(!worklist.empty())
+            {
+                NonTerminal<G> *nonterminal = worklist.back();
+                worklist.pop_back();
+
+                for(auto const &rule : this->rules_.at(nonterminal))
+                {
+                    for(auto const &symbol : rule.sequence_)
+                    {
+                        if(!std::holds_alternative<NonTerminal<G>*>(symbol)) continue;
+
+                        auto [it, inserted] = reachable.insert(std::get<NonTerminal<G>*>(symbol));
+                        if(inserted)
+                        {
+                            worklist.push_back(*it);
+                        }
+                    }
+                }
+            }
+
+            for(auto nonterminal : std::set(this->nonterminals_))
+            {
+                if(reachable.contains(nonterminal)) continue;
+
+                this->nonterminals_.erase(nonterminal);
+                this->rules_.erase(nonterminal);
+                this->removed_.push_back(nonterminal);
+            }
+
+            // Drop Terminals only used by removed rules.
+            this->terminals_ = { this->EOS.get() };
+            for(auto const &rule : this->ProductionRules())
+            {
+                for(auto const &symbol : rule.sequence_)
+                {
+                    if(std::holds_alternative<Terminal<G>*>(symbol))
+                    {
+                        this->terminals_.insert(std::get<Terminal<G>*>(symbol));
+                    }
+                }
+            }
+        }
+
+        /**
+         * Optimization pass inlining NonTerminals that are used exactly once and whose rules are all single symbols
+         * with the bf::Forward action, e.g. `operand -> NUMBER | IDENTIFIER`. Saves one reduction per occurrence.
+         */
+        void InlineNonTerminals()
+        {
+            std::map<NonTerminal<G>*, std::size_t> references;
+            for(auto const &rule : this->ProductionRules())
+            {
+                for(auto const &symbol : rule.sequence_)
+                {
+                    if(std::holds_alternative<NonTerminal<G>*>(symbol))
+                    {
+                        references[std::get<NonTerminal<G>*>(symbol)]++;
+                    }
+                }
+            }
+
+            for(auto nonterminal : std::set(this->nonterminals_))
+            {
+                if(nonterminal == &this->root || references[nonterminal] != 1) continue;
+
+                auto const &rules = this->rules_.at(nonterminal);
+
+                bool trivial = std::ranges::all_of(rules, [&](ProductionRule<G> const &rule)
+                {
+                    return rule.sequence_.size() == 1 && rule.sequence_[0] != Symbol<G>(nonterminal) && rule.transductor_ == &Forward<G>;
+                });
+                if(!trivial) continue;
+
+                // Replace the only use by one rule per alternative. Moving symbols keeps the reference counts valid.
+                bool inlined = false;
+                for(auto &parent_rules : this->rules_ | std::views::values)
+                {
+                    for(std::size_t i = 0; i < parent_rules.size() && !inlined; i++)
+                    {
+                        auto const &sequence = parent_rules[i].sequence_;
+
+                        auto position = std::ranges::find(sequence, Symbol<G>(nonterminal));
+                        if(position == sequence.end()) continue;
+
+                        std::size_t index = std::distance(sequence.begin(), position);
+
+                        std::vector<ProductionRule<G>> expansions;
+                        for(auto const &rule : rules)
+                        {
+                            // The expansion keeps the parent's precedence, so conflicts resolve as before inlining.
+                            ProductionRule<G> expansion = parent_rules[i];
+                            expansion.sequence_[index] = rule.sequence_[0];
+                            expansion.features_ &= rule.features_;
+
+                            expansions.push_back(std::move(expansion));
+                        }
+
+                        parent_rules.erase(parent_rules.begin() + i);
+                        parent_rules.insert(parent_rules.begin() + i, expansions.begin(), expansions.end());
+                        inlined = true;
+                    }
+
+                    if(inlined) break;
+                }
+
+                this->nonterminals_.erase(nonterminal);
+                this->rules_.erase(nonterminal);
+                this->inlined_.push_back(nonterminal);
+            }
+        }
+
+        Grammar(NonTerminal<G> &start) : root(start)
+        {
+            this->EOS = std::make_unique<DefineTerminal<G, R"(\Z)">>();
+            this->terminals_.insert(this->EOS.get());
+
+            this->RegisterSymbols(&start);
+
+            this->RemoveUselessSymbols();
+            this->InlineNonTerminals();
+
+            this->GenerateNullableSet();
+            this->GenerateFirstSet();
+            this->GenerateFollowSet();
+        }
+
+        Grammar() = delete;
+    };
+
+    /*
+     * PRODUCTION RULE COMPOSITION FUNCTIONS
+     */
+    template<IGrammar G>
+    ProductionRule<G> operator+(Terminal<G> &lhs, Terminal<G> &rhs)
+    {
+        return ProductionRule(lhs) + rhs;
+    }
+
+    template<IGrammar G>
+    ProductionRule<G> operator+(Terminal<G> &lhs, NonTerminal<G> &rhs)
+    {
+        return ProductionRule(lhs) + rhs;
+    }
+
+    template<IGrammar G>
+    ProductionRule<G> operator+(NonTerminal<G> &lhs, NonTerminal<G> &rhs)
+    {
+        return ProductionRule(lhs) + rhs;
+    }
+
+    template<IGrammar G>
+    ProductionRule<G> operator+(NonTerminal<G> &lhs, Terminal<G> &rhs)
+    {
+        return ProductionRule(lhs) + rhs;
+    }
+
+    template<IGrammar G>
+    ProductionRule<G> operator+(Terminal<G> &lhs, Subrule<G> const &rhs)
+    {
+        return ProductionRule(lhs) + rhs;
+    }
+
+    template<IGrammar G>
+    ProductionRule<G> operator+(NonTerminal<G> &lhs, Subrule<G> const &rhs)
+    {
+        return ProductionRule(lhs) + rhs;
+    }
+
+    template<IGrammar G>
+    ProductionRule<G> operator+(Subrule<G> const &lhs, Terminal<G> &rhs)
+    {
+        return ProductionRule(lhs) + rhs;
+    }
+
+    template<IGrammar G>
+    ProductionRule<G> operator+(Subrule<G> const &lhs, NonTerminal<G> &rhs)
+    {
+        return ProductionRule(lhs) + rhs;
+    }
+
+    template<IGrammar G>
+    ProductionRule<G> operator+(Subrule<G> const &lhs, Subrule<G> const &rhs)
+    {
+        return ProductionRule(lhs) + rhs;
+    }
+
+    template<IGrammar G>
+    ProductionRuleList<G> operator|(ProductionRule<G> const &lhs, ProductionRule<G> const &rhs)
+    {
+        return ProductionRuleList<G>() | lhs | rhs;
+    }
+
+    /**
+     * LR ITEM
+     * @tparam G
+     */
+    template<IGrammar G>
+    struct LRItem
+    {
+        ProductionRule<G> const *rule;
+        std::size_t position;
+
+        [[nodiscard]] bool Complete() const
+        {
+            return this->position >= this->rule->sequence_.size();
+        }
+
+        [[nodiscard]] LRItem Advance() const
+        {
+            return LRItem(this->rule, this->position + 1);
+        }
+
+        [[nodiscard]] Symbol<G> NextSymbol() const
+        {
+            return this->rule->sequence_[this->position];
+        }
+
+        bool operator==(LRItem const &other) const
+        {
+            return *this->rule == *other.rule && this->position == other.position;
+        }
+
+        LRItem(ProductionRule<G> const *rule, int position = 0) : rule(rule), position(position) {}
+
+        LRItem() = delete;
+    };
+
+    using lrstate_id_t = std::size_t;
+
+    /**
+     * LR State
+     * @tparam G
+     */
+    template<IGrammar G>
+    struct LRState
+    {
+        std::vector<LRItem<G>> kernel_items;
+
+        std::vector<LRItem<G>> GenerateClosure(Grammar<G> const &grammar) const
+        {
+            std::vector<LRItem<G>> closure = this->kernel_items;
+            std::set<NonTerminal<G>*> closed_nonterminals;
+
+            for(int i = 0; i < closure.size(); i++)
+            {
+                if(closure[i].Complete()) continue;
+
+                std::visit(overload{
+                    [](Terminal<G> *terminal) { /* Do Nothing */ },
+                    [&](NonTerminal<G> *non_terminal)
+                    {
+                        if(closed_nonterminals.contains(non_terminal)) return;
+                        closed_nonterminals.insert(non_terminal);
+
+                        for(auto const &rule : grammar.rules_.at(non_terminal))
+                        {
+                            closure.emplace_back(&rule);
+                        }
+                    }
+                }, closure[i].NextSymbol());
+            }
+
+            return closure;
+        }
+
+        std::map<Symbol<G>, LRState<G>> GenerateTransitions(Grammar<G> const &grammar) const
+        {
+            std::map<Symbol<G>, LRState<G>> transitions;
+
+            auto closure = this->GenerateClosure(grammar);
+
+            for(auto const &item : closure)
+            {
+                if(item.Complete()) continue;
+
                 transitions[item.NextSymbol()].kernel_items.push_back(item.Advance());
             }
 
-            return transitions;
+            return transitions;
+        }
+
+        /**
+         * This is very slow and needs to be remedied.
+         * @param other
+         * @return
+         */
+        bool operator==(LRState const &other) const
+        {
+            if(this->kernel_items.size() != other.kernel_items.size()) return false;
+
+            for(int i = 0; i < this->kernel_items.size(); i++)
+            {
+                if(this->kernel_items[i] != other.kernel_items[i]) return false;
+            }
+
+            return true;
+        }
+
+        LRState(std::vector<ProductionRule<G>> const &rules)
+        {
+            for(auto const &rule : rules)
+            {
+                this->kernel_items.emplace_back(&rule);
+            }
+        }
+
+        LRState() = default;
+    };
+
+    /**
+     * LR ACTION TYPE
+     */
+    enum class LRActionType
+    {
+        kError,
+        kAccept,
+        kShift,
+        kReduce,
+    };
+
+    /**
+     * LR ACTION
+     * @tparam G
+     */
+    template<IGrammar G>
+    struct LRAction
+    {
+        LRActionType type = LRActionType::kError;
+
+        union
+        {
+            lrstate_id_t state;
+
+            /// Index into the parser's reductions.
+            std::size_t reduction;
+        };
+    };
+
+    /**
+     * LR REDUCTION
+     * Everything the parser needs to perform a REDUCE action without consulting the grammar.
+     * @tparam G
+     */
+    template<IGrammar G>
+    struct LRReduction
+    {
+        ProductionRule<G> const *rule;
+
+        /// Number of symbols popped off the parse stack.
+        std::size_t length;
+
+        /// GOTO column of the rule's NonTerminal.
+        std::size_t non_terminal;
+
+        /// Dialects the rule belongs to, see FeatureMask.
+        FeatureMask features;
+    };
+
+    /**
+     * PACKED TABLES
+     * Finalized ACTION and GOTO tables, row-major with one row per state, using the narrowest entry type that fits
+     * the automaton. An ACTION entry is 0 for an error, `s + 1` to shift to state `s`, `-(r + 1)` to reduce by
+     * reduction `r`, and the minimum value to accept.
+     * @tparam G
+     * @tparam Entry
+     */
+    template<IGrammar G, std::signed_integral Entry>
+    struct PackedTables
+    {
+        using EntryType = Entry;
+        using StateType = std::make_unsigned_t<Entry>;
+
+        static constexpr Entry kAccept = std::numeric_limits<Entry>::min();
+
+        std::size_t terminals = 0;
+        std::size_t nonterminals = 0;
+
+        std::vector<Entry> action;
+        std::vector<StateType> gotos;
+
+        static constexpr bool Fits(std::size_t states, std::size_t reductions)
+        {
+            return states < std::numeric_limits<Entry>::max() && reductions < std::numeric_limits<Entry>::max();
+        }
+
+        PackedTables() = default;
+
+        PackedTables(std::vector<LRAction<G>> const &action, std::vector<lrstate_id_t> const &gotos, std::size_t terminals, std::size_t nonterminals) : terminals(terminals), nonterminals(nonterminals)
+        {
+            this->action.reserve(action.size());
+            for(auto const &entry : action)
+            {
+                switch(entry.type)
+                {
+                    case LRActionType::kShift: this->action.push_back(static_cast<Entry>(entry.state + 1)); break;
+                    case LRActionType::kReduce: this->action.push_back(static_cast<Entry>(-static_cast<Entry>(entry.reduction) - 1)); break;
+                    case LRActionType::kAccept: this->action.push_back(kAccept); break;
+                    default: this->action.push_back(0); break;
+                }
+            }
+
+            this->gotos.assign(gotos.begin(), gotos.end());
+        }
+
+        LRAction<G> Action(lrstate_id_t state, std::size_t terminal_column) const
+        {
+            Entry entry = this->action[state * this->terminals + terminal_column];
+
+            if(entry > 0)
+            {
+                return { .type = LRActionType::kShift, .state = static_cast<lrstate_id_t>(entry - 1) };
+            }
+            if(entry == kAccept)
+            {
+                return { .type = LRActionType::kAccept };
+            }
+            if(entry < 0)
+            {
+                return { .type = LRActionType::kReduce, .reduction = static_cast<std::size_t>(-(entry + 1)) };
+            }
+
+            return {};
+        }
+
+        lrstate_id_t Goto(lrstate_id_t state, std::size_t nonterminal_column) const
+        {
+            return this->gotos[state * this->nonterminals + nonterminal_column];
+        }
+    };
+
+    /**
+     * PARSE PROFILE
+     * Lookahead counters per (state, terminal) recorded by an instrumented parser (LRParser<G>::Instrument), to be
+     * fed back into Build. States and terminals are identified by ids that only depend on the grammar's rules (see
+     * LRParser<G>::NumberProfileStates), not on where symbols live in memory, so a profile saved by one program can
+     * be loaded by another. Along with the counters, the profile stores a fingerprint of the automaton it was
+     * recorded with, and Build rejects profiles of a different one.
+     */
+    class ParseProfile
+    {
+        std::uint64_t fingerprint_ = 0;
+        std::size_t states_ = 0;
+        std::size_t terminals_ = 0;
+        std::vector<std::uint64_t> counts_;
+
+        template<IGrammar G>
+        friend class LRParser;
+
+    public:
+        /// Largest number of counters (states times terminals) Load accepts.
+        static constexpr std::size_t kMaxCounters = std::size_t(1) << 28;
+
+        std::uint64_t Count(std::size_t state, std::size_t terminal) const
+        {
+            return this->counts_[state * this->terminals_ + terminal];
+        }
+
+        std::uint64_t Visits(std::size_t state) const
+        {
+            std::uint64_t visits = 0;
+            for(std::size_t terminal = 0; terminal < this->terminals_; terminal++)
+            {
+                visits += this->Count(state, terminal);
+            }
+
+            return visits;
+        }
+
+        /**
+         * Writes the counters as text: a header line, the automaton fingerprint and table shape, then one
+         * `state terminal count` line per non-zero counter.
+         * @param out
+         */
+        void Save(std::ostream &out) const
+        {
+            out << "buffalo-profile 2\n" << this->fingerprint_ << ' ' << this->states_ << ' ' << this->terminals_ << '\n';
+            for(std::size_t i = 0; i < this->counts_.size(); i++)
+            {
+                if(this->counts_[i])
+                {
+                    out << i / this->terminals_ << ' ' << i % this->terminals_ << ' ' << this->counts_[i] << '\n';
+                }
+            }
+        }
+
+        std::optional<Error> Save(std::filesystem::path const &path) const
+        {
+            std::ofstream out(path);
+            this->Save(out);
+
+            if(!out)
+            {
+                return Error{"Unable to write profile"};
+            }
+
+            return std::nullopt;
+        }
+
+        static std::expected<ParseProfile, Error> Load(std::istream &in)
+        {
+            ParseProfile profile;
+
+            std::string magic;
+            int version = 0;
+            if(!(in >> magic >> version >> profile.fingerprint_ >> profile.states_ >> profile.terminals_) || magic != "buffalo-profile" || version != 2)
+            {
+                return std::unexpected(Error{"Invalid profile header"});
+            }
+
+            // Bounds the product, and with it every counter index below.
+            if(profile.terminals_ && profile.states_ > kMaxCounters / profile.terminals_)
+            {
+                return std::unexpected(Error{"Profile too large"});
+            }
+
+            profile.counts_.assign(profile.states_ * profile.terminals_, 0);
+
+            std::size_t state, terminal;
+            std::uint64_t count;
+            while(in >> state >> terminal >> count)
+            {
+                if(state >= profile.states_ || terminal >= profile.terminals_)
+                {
+                    return std::unexpected(Error{"Profile counter out of range"});
+                }
+
+                profile.counts_[state * profile.terminals_ + terminal] += count;
+            }
+
+            if(!in.eof())
+            {
+                return std::unexpected(Error{"Malformed profile counter"});
+            }
+
+            return profile;
+        }
+
+        static std::expected<ParseProfile, Error> Load(std::filesystem::path const &path)
+        {
+            std::ifstream in(path);
+            if(!in)
+            {
+                return std::unexpected(Error{"Unable to read profile"});
+            }
+
+            return Load(in);
+        }
+    };
+
+    /**
+     * UTF-8 SCAN
+     * Result of bf::ScanUTF8.
+     */
+    struct UTF8Scan
+    {
+        /// Offset of the first ill-formed sequence, or npos.
+        std::size_t error = std::string_view::npos;
+
+        /// The error is a sequence cut off by the end of the input.
+        bool truncated = false;
+
+        /// The input (up to `error`) only contains ASCII.
+        bool ascii = true;
+
+        bool Valid() const
+        {
+            return this->error == std::string_view::npos;
+        }
+    };
+
+    /**
+     * @return Offset of the first non-ASCII byte at or after `index`, or `input.size()`.
+     */
+    inline std::size_t SkipASCII(std::string_view input, std::size_t index)
+    {
+#if defined(__SSE2__) || defined(_M_X64)
+        while(index + 16 <= input.size())
+        {
+            int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(input.data() + index)));
+            if(mask)
+            {
+                return index + std::countr_zero(static_cast<unsigned>(mask));
+            }
+            index += 16;
+        }
+#endif
+
+        // Eight bytes at a time elsewhere and for the tail.
+        while(index + 8 <= input.size())
+        {
+            std::uint64_t word;
+            std::memcpy(&word, input.data() + index, sizeof(word));
+            if(word & 0x8080808080808080)
+            {
+                break;
+            }
+            index += 8;
+        }
+
+        while(index < input.size() && static_cast<unsigned char>(input[index]) < 0x80) index++;
+
+        return index;
+    }
+
+    /**
+     * Validates UTF-8 (well-formed sequences as defined by the Unicode standard, i.e. no overlong forms, surrogates
+     * or code points above U+10FFFF). ASCII runs are skipped with SIMD, only multibyte sequences are decoded.
+     * @param input
+     * @return
+     */
+    inline UTF8Scan ScanUTF8(std::string_view input)
+    {
+        UTF8Scan scan;
+
+        std::size_t i = SkipASCII(input, 0);
+        while(i < input.size())
+        {
+            scan.ascii = false;
+
+            // Length and valid range of the second byte by lead byte.
+            unsigned char lead = input[i];
+            std::size_t length = 0;
+            unsigned char low = 0x80, high = 0xBF;
+
+            if(lead >= 0xC2 && lead <= 0xDF) length = 2;
+            else if(lead == 0xE0) { length = 3; low = 0xA0; }
+            else if(lead == 0xED) { length = 3; high = 0x9F; }
+            else if(lead >= 0xE1 && lead <= 0xEF) length = 3;
+            else if(lead == 0xF0) { length = 4; low = 0x90; }
+            else if(lead >= 0xF1 && lead <= 0xF3) length = 4;
+            else if(lead == 0xF4) { length = 4; high = 0x8F; }
+
+            if(!length)
+            {
+                scan.error = i;
+                return scan;
+            }
+
+            for(std::size_t k = 1; k < length; k++)
+            {
+                if(i + k >= input.size())
+                {
+                    scan.error = i;
+                    scan.truncated = true;
+                    return scan;
+                }
+
+                unsigned char c = input[i + k];
+                if(c < (k == 1 ? low : 0x80) || c > (k == 1 ? high : 0xBF))
+                {
+                    scan.error = i;
+                    return scan;
+                }
+            }
+
+            i = SkipASCII(input, i + length);
+        }
+
+        return scan;
+    }
+
+    /**
+     * UTF-8 VALIDATOR
+     * bf::ScanUTF8 over consecutive chunks of an input, which may cut characters anywhere. Lets validation run
+     * alongside a consumer of the input, e.g. just ahead of the tokenizer.
+     */
+    class UTF8Validator
+    {
+        UTF8Scan result_;
+
+        /// Offset in the whole input of the next byte to be fed.
+        std::size_t offset_;
+
+        /// Start of a character cut off by the end of a chunk, completed from the next ones.
+        std::string carry_;
+        std::size_t carry_offset_ = 0;
+
+    public:
+        /**
+         * Validates the next `chunk` of the input.
+         * @param chunk
+         * @return Whether the input is valid so far.
+         */
+        bool Feed(std::string_view chunk)
+        {
+            if(!this->result_.Valid())
+            {
+                return false;
+            }
+
+            std::size_t base = this->offset_;
+            this->offset_ += chunk.size();
+
+            std::size_t start = 0;
+            if(!this->carry_.empty())
+            {
+                unsigned char lead = this->carry_[0];
+                std::size_t length = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : 2;
+
+                start = std::min(length - this->carry_.size(), chunk.size());
+                this->carry_ += chunk.substr(0, start);
+
+                if(this->carry_.size() < length)
+                {
+                    return true;
+                }
+
+                if(!ScanUTF8(this->carry_).Valid())
+                {
+                    this->result_.error = this->carry_offset_;
+                    return false;
+                }
+                this->carry_.clear();
+            }
+
+            UTF8Scan scan = ScanUTF8(chunk.substr(start));
+            this->result_.ascii = this->result_.ascii && scan.ascii;
+
+            if(scan.truncated)
+            {
+                this->carry_ = chunk.substr(start + scan.error);
+                this->carry_offset_ = base + start + scan.error;
+            }
+            else if(!scan.Valid())
+            {
+                this->result_.error = base + start + scan.error;
+                return false;
+            }
+
+            return true;
+        }
+
+        /**
+         * Ends the input.
+         * @return Result for all chunks, with offsets into the whole input.
+         */
+        UTF8Scan Finish()
+        {
+            if(this->result_.Valid() && !this->carry_.empty())
+            {
+                this->result_.error = this->carry_offset_;
+                this->result_.truncated = true;
+            }
+
+            return this->result_;
+        }
+
+        /**
+         * @return Result so far. A character cut off by the end of the last chunk is not an error yet.
+         */
+        UTF8Scan const &Result() const
+        {
+            return this->result_;
+        }
+
+        /**
+         * @return Offset of the next byte to be fed.
+         */
+        std::size_t Offset() const
+        {
+            return this->offset_;
+        }
+
+        /**
+         * @param offset Offset of the first chunk in the whole input.
+         */
+        explicit UTF8Validator(std::size_t offset = 0) : offset_(offset) {}
+    };
+
+    /**
+     * Validates UTF-8 split into segments, which may cut characters anywhere. Offsets are into the whole input.
+     * @param segments
+     * @return
+     */
+    inline UTF8Scan ScanUTF8(std::span<std::string_view const> segments)
+    {
+        UTF8Validator validator;
+        for(std::string_view segment : segments)
+        {
+            if(!validator.Feed(segment)) break;
+        }
+
+        return validator.Finish();
+    }
+
+    /**
+     * BUILD OPTIONS
+     */
+    struct BuildOptions
+    {
+        /// Reorder the rows of the parsing tables for locality, see LRParser<G>::LocalityOrder.
+        bool renumber_states = true;
+
+        /// Use 16-bit table entries and parse stack states when the automaton is small enough.
+        bool narrow_tables = true;
+
+        /// Merge states with identical behavior, see LRParser<G>::EquivalentStates.
+        bool merge_states = true;
+
+        /**
+         * Recorded traffic to optimize for: terminals are tried most-frequent-first (among those that cannot match
+         * the same input, which keep their order, see LRParser<G>::OrderCandidates), visited rows are placed
+         * together ahead of the others, and visited states whose only action is a single reduction reduce without
+         * scanning a lookahead.
+         */
+        ParseProfile const *profile = nullptr;
+
+        /**
+         * Reject input that is not valid UTF-8 (see bf::ScanUTF8) and, once a non-ASCII character was seen, tokens
+         * that end inside a multibyte character. Validation runs block by block just ahead of the tokenizer, so
+         * input after the point where a parse stops (ParseUntil) is not checked.
+         */
+        bool validate_utf8 = false;
+    };
+
+    /**
+     * PARSE CHECKPOINT
+     * Snapshot of a suspended parse (parse stack and input position) created by LRParser<G>::ParsePrefix.
+     * The parse stack is stored as an immutable, shared linked list, so copying a checkpoint is O(1). Parses resumed
+     * from a checkpoint share the stack below the suspension point and only copy semantic values they pop from it.
+     * @tparam G
+     */
+    template<IGrammar G>
+    class ParseCheckpoint
+    {
+        friend class LRParser<G>;
+
+        struct Node
+        {
+            lrstate_id_t state;
+            typename G::ValueType value;
+            std::shared_ptr<Node> next;
+        };
+
+        std::shared_ptr<Node> top_;
+        std::size_t index_ = 0;
+
+        /// State numbering of the parser that created the checkpoint, and the dialect it was parsed in.
+        std::uint64_t automaton_ = 0;
+        FeatureMask features_ = kAllFeatures;
+
+        ParseCheckpoint(std::shared_ptr<Node> top, std::size_t index, std::uint64_t automaton, FeatureMask features) : top_(std::move(top)), index_(index), automaton_(automaton), features_(features) {}
+
+    public:
+        /**
+         * @return Byte offset in the prefix up to which input has been consumed. Resumed inputs must share the prefix
+         * up to this offset.
+         */
+        [[nodiscard]] std::size_t Position() const
+        {
+            return this->index_;
+        }
+    };
+
+    /**
+     * PARTIAL PARSE
+     * Result of LRParser<G>::ParseUntil.
+     * @tparam G
+     */
+    template<IGrammar G>
+    struct PartialParse
+    {
+        typename G::ValueType value;
+
+        /// End of the last consumed token, i.e. the length of the input the value was parsed from.
+        std::size_t offset;
+
+        /// Parsing stopped before the end of the input.
+        bool stopped;
+    };
+
+    /**
+     * BUILD REPORT
+     * Grammar analyses gathered while building a parser.
+     * @tparam G
+     */
+    template<IGrammar G>
+    struct BuildReport
+    {
+        /// Productions that make the parse stack grow linearly with input length.
+        std::vector<RightRecursion<G>> right_recursions;
+
+        /// NonTerminals removed from the grammar because they are unproductive or unreachable.
+        std::vector<NonTerminal<G>*> removed_nonterminals;
+
+        /// NonTerminals inlined into their only use.
+        std::vector<NonTerminal<G>*> inlined_nonterminals;
+
+        /// Size in bytes of an ACTION table entry.
+        std::size_t action_entry_size = 0;
+
+        /// Number of states merged into an equivalent one.
+        std::size_t merged_states = 0;
+
+        /// Number of states of the finalized automaton.
+        std::size_t states = 0;
+    };
+
+    /**
+     * FLAT TREE
+     * Read-only view of a syntax tree and its tokens, serialized by LRParser<G>::ParseFlatTree. The format only
+     * contains offsets, so a buffer can be written to a file and mapped by other processes (e.g. with mmap), then
+     * navigated in place. Symbols are numbered by a walk of the grammar from its root (see LRParser<G>::TerminalId and
+     * LRParser<G>::NonTerminalId), which gives the same ids in every program defining the same grammar. The input
+     * hash and size let consumers check that a cached tree belongs to their input before skipping the parse.
+     *
+     * Layout: Header, then `node_count` Nodes, `token_count` Tokens and `child_count` child node indices. Nodes are
+     * stored in post-order, so children always precede their parent. Integers are stored in native byte order, so
+     * mapped files are only portable between hosts of the same endianness.
+     */
+    class FlatTree
+    {
+    public:
+        /// Node::symbol of a leaf.
+        static constexpr std::uint32_t kLeaf = std::numeric_limits<std::uint32_t>::max();
+
+        static constexpr std::uint32_t kVersion = 1;
+
+        struct Header
+        {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t root;
+
+            /// Fingerprint of the grammar's structure, see LRParser<G>::TreeFingerprint.
+            std::uint64_t grammar;
+
+            std::uint64_t input_hash;
+            std::uint64_t input_size;
+
+            std::uint32_t node_count;
+            std::uint32_t token_count;
+            std::uint32_t child_count;
+            std::uint32_t reserved;
+        };
+
+        struct Token
+        {
+            std::uint32_t terminal;
+            std::uint32_t begin;
+            std::uint32_t end;
+        };
+
+        struct Node
+        {
+            /// NonTerminal id, or kLeaf.
+            std::uint32_t symbol;
+
+            /// Index of the production among the NonTerminal's rules.
+            std::uint32_t rule;
+
+            /// First child index in the child array, or the token index of a leaf.
+            std::uint32_t first;
+            std::uint32_t count;
+
+            /// Input bytes covered by the node.
+            std::uint32_t begin;
+            std::uint32_t end;
+        };
+
+    private:
+        static constexpr char kMagic[8] = { 'b', 'f', '-', 't', 'r', 'e', 'e', '\0' };
+
+        Header const *header_ = nullptr;
+        Node const *nodes_ = nullptr;
+        Token const *tokens_ = nullptr;
+        std::uint32_t const *children_ = nullptr;
+
+        FlatTree() = default;
+
+    public:
+        /**
+         * 64-bit FNV-1a hash of `input`.
+         */
+        static std::uint64_t Hash(std::string_view input)
+        {
+            std::uint64_t hash = 0xcbf29ce484222325;
+            for(unsigned char c : input)
+            {
+                hash = (hash ^ c) * 0x100000001b3;
+            }
+
+            return hash;
+        }
+
+        /**
+         * Serializes a tree. Used by LRParser<G>::ParseFlatTree.
+         */
+        static std::vector<std::byte> Write(std::uint64_t grammar, std::string_view input, std::uint32_t root, std::span<Node const> nodes, std::span<Token const> tokens, std::span<std::uint32_t const> children)
+        {
+            Header header = {
+                .magic = {},
+                .version = kVersion,
+                .root = root,
+                .grammar = grammar,
+                .input_hash = Hash(input),
+                .input_size = input.size(),
+                .node_count = static_cast<std::uint32_t>(nodes.size()),
+                .token_count = static_cast<std::uint32_t>(tokens.size()),
+                .child_count = static_cast<std::uint32_t>(children.size()),
+                .reserved = 0,
+            };
+            std::ranges::copy(kMagic, header.magic);
+
+            std::vector<std::byte> bytes;
+            bytes.reserve(sizeof(Header) + nodes.size_bytes() + tokens.size_bytes() + children.size_bytes());
+
+            auto append = [&](std::span<std::byte const> data)
+            {
+                bytes.insert(bytes.end(), data.begin(), data.end());
+            };
+
+            append(std::as_bytes(std::span(&header, 1)));
+            append(std::as_bytes(nodes));
+            append(std::as_bytes(tokens));
+            append(std::as_bytes(children));
+
+            return bytes;
+        }
+
+        /**
+         * Checks the structure of a serialized tree and returns a view of it. `bytes` must be 8-byte aligned (as
+         * mapped files are) and outlive the view.
+         * @param bytes
+         * @return
+         */
+        static std::expected<FlatTree, Error> View(std::span<std::byte const> bytes)
+        {
+            if(bytes.size() < sizeof(Header) || reinterpret_cast<std::uintptr_t>(bytes.data()) % alignof(Header))
+            {
+                return std::unexpected(Error{"Invalid tree buffer"});
+            }
+
+            FlatTree tree;
+            tree.header_ = reinterpret_cast<Header const*>(bytes.data());
+
+            Header const &header = *tree.header_;
+            if(!std::ranges::equal(header.magic, kMagic) || header.version != kVersion)
+            {
+                return std::unexpected(Error{"Invalid tree header"});
+            }
+
+            std::size_t size = sizeof(Header) + header.node_count * sizeof(Node) + header.token_count * sizeof(Token) + header.child_count * sizeof(std::uint32_t);
+            if(bytes.size() < size || header.root >= header.node_count)
+            {
+                return std::unexpected(Error{"Truncated tree"});
+            }
+
+            tree.nodes_ = reinterpret_cast<Node const*>(bytes.data() + sizeof(Header));
+            tree.tokens_ = reinterpret_cast<Token const*>(tree.nodes_ + header.node_count);
+            tree.children_ = reinterpret_cast<std::uint32_t const*>(tree.tokens_ + header.token_count);
+
+            // Offsets are used to slice the input, so they must lie within it.
+            auto in_input = [&](std::uint32_t begin, std::uint32_t end)
+            {
+                return begin <= end && end <= header.input_size;
+            };
+
+            for(Token const &token : tree.Tokens())
+            {
+                if(!in_input(token.begin, token.end))
+                {
+                    return std::unexpected(Error{"Corrupt tree token"});
+                }
+            }
+
+            // Children must precede their parent, which also rules out cycles.
+            for(std::uint32_t i = 0; i < header.node_count; i++)
+            {
+                Node const &node = tree.nodes_[i];
+                if(node.symbol == kLeaf ? node.first >= header.token_count : node.count > header.child_count || node.first > header.child_count - node.count)
+                {
+                    return std::unexpected(Error{"Corrupt tree node"});
+                }
+
+                if(!in_input(node.begin, node.end))
+                {
+                    return std::unexpected(Error{"Corrupt tree node"});
+                }
+
+                for(std::uint32_t child : tree.Children(node))
+                {
+                    if(child >= i)
+                    {
+                        return std::unexpected(Error{"Corrupt tree node"});
+                    }
+                }
+            }
+
+            return tree;
+        }
+
+        /**
+         * @return Whether the tree was created from `input`.
+         */
+        bool Matches(std::string_view input) const
+        {
+            return this->header_->input_size == input.size() && this->header_->input_hash == Hash(input);
+        }
+
+        std::uint64_t GrammarFingerprint() const
+        {
+            return this->header_->grammar;
+        }
+
+        Node const &Root() const
+        {
+            return this->nodes_[this->header_->root];
+        }
+
+        std::span<Node const> Nodes() const
+        {
+            return { this->nodes_, this->header_->node_count };
+        }
+
+        std::span<Token const> Tokens() const
+        {
+            return { this->tokens_, this->header_->token_count };
+        }
+
+        std::span<std::uint32_t const> Children(Node const &node) const
+        {
+            if(node.symbol == kLeaf)
+            {
+                return {};
+            }
+
+            return { this->children_ + node.first, node.count };
+        }
+    };
+
+    /**
+     * PARSE TRACE
+     * Binary log of the steps of a parse, written by LRParser<G>::ParseTraced and read by LRParser<G>::Replay. After
+     * the header (magic, then version, automaton fingerprint, table dimensions, input size and input hash as varints), every
+     * automaton step is a run of LEB128 varints:
+     * - the state;
+     * - the lookahead's terminal + 1 (0 for reductions taken without lookahead), shifted left by one, with the low
+     *   bit set when the lookahead was not seen by the previous step;
+     * - the action, as its type | operand << 2, the operand being the target state of a shift or the NonTerminal of
+     *   a reduction;
+     * - for a reduction, the index of the rule among the rules of its NonTerminal;
+     * - for a new lookahead, its offset from the end of the last shifted token and its length.
+     *
+     * States and symbols are identified by the ids of ParseProfile and FlatTree, which do not depend on where symbols
+     * live in memory, so a trace can be replayed by another program.
+     */
+    class ParseTrace
+    {
+        static constexpr char kMagic[8] = { 'b', 'f', '-', 't', 'r', 'a', 'c', 'e' };
+
+    public:
+        static constexpr std::uint64_t kVersion = 3;
+
+        struct Header
+        {
+            /// Fingerprint of the automaton, see LRParser<G>::NumberProfileStates.
+            std::uint64_t grammar;
+
+            std::uint64_t states;
+            std::uint64_t columns;
+            std::uint64_t input_size;
+
+            /// See FlatTree::Hash.
+            std::uint64_t input_hash;
+        };
+
+        struct Step
+        {
+            std::uint64_t state;
+
+            /// Terminal of the lookahead, if any.
+            std::optional<std::uint64_t> terminal;
+
+            std::uint64_t action;
+
+            /// Rule of a reduction.
+            std::uint64_t rule = 0;
+
+            /// The lookahead was not seen by the previous step, so `gap` and `length` locate it.
+            bool fresh = false;
+            std::uint64_t gap = 0;
+            std::uint64_t length = 0;
+        };
+
+        static void Put(std::vector<std::byte> &bytes, std::uint64_t value)
+        {
+            while(value >= 0x80)
+            {
+                bytes.push_back(static_cast<std::byte>(value | 0x80));
+                value >>= 7;
+            }
+            bytes.push_back(static_cast<std::byte>(value));
+        }
+
+        static std::optional<std::uint64_t> Get(std::span<std::byte const> bytes, std::size_t &offset)
+        {
+            std::uint64_t value = 0;
+            for(unsigned shift = 0; offset < bytes.size() && shift < 64; shift += 7)
+            {
+                auto byte = static_cast<std::uint8_t>(bytes[offset++]);
+                value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+
+                if(!(byte & 0x80))
+                {
+                    return value;
+                }
+            }
+
+            return std::nullopt;
+        }
+
+        static void WriteHeader(std::vector<std::byte> &bytes, Header const &header)
+        {
+            for(char c : kMagic)
+            {
+                bytes.push_back(static_cast<std::byte>(c));
+            }
+
+            Put(bytes, kVersion);
+            Put(bytes, header.grammar);
+            Put(bytes, header.states);
+            Put(bytes, header.columns);
+            Put(bytes, header.input_size);
+            Put(bytes, header.input_hash);
+        }
+
+        /**
+         * @return Header of a trace, with `offset` set to its first step.
+         */
+        static std::expected<Header, Error> ReadHeader(std::span<std::byte const> bytes, std::size_t &offset)
+        {
+            if(bytes.size() < sizeof(kMagic) || !std::ranges::equal(bytes.first(sizeof(kMagic)), std::as_bytes(std::span(kMagic))))
+            {
+                return std::unexpected(Error{"Invalid trace header"});
+            }
+
+            offset = sizeof(kMagic);
+            auto version = Get(bytes, offset);
+            auto grammar = Get(bytes, offset);
+            auto states = Get(bytes, offset);
+            auto columns = Get(bytes, offset);
+            auto input_size = Get(bytes, offset);
+            auto input_hash = Get(bytes, offset);
+
+            if(!version || !grammar || !states || !columns || !input_size || !input_hash || *version != kVersion)
+            {
+                return std::unexpected(Error{"Invalid trace header"});
+            }
+
+            return Header{ *grammar, *states, *columns, *input_size, *input_hash };
+        }
+
+        static bool Reduces(Step const &step)
+        {
+            return (step.action & 3) == static_cast<std::uint64_t>(LRActionType::kReduce);
+        }
+
+        /**
+         * @return Whether both steps take the same action in the same state and on the same terminal.
+         */
+        static bool SameAction(Step const &a, Step const &b)
+        {
+            return a.state == b.state && a.terminal == b.terminal && a.action == b.action && a.rule == b.rule;
+        }
+
+        static void WriteStep(std::vector<std::byte> &bytes, Step const &step)
+        {
+            Put(bytes, step.state);
+            Put(bytes, (step.terminal ? *step.terminal + 1 : 0) << 1 | step.fresh);
+            Put(bytes, step.action);
+
+            if(Reduces(step))
+            {
+                Put(bytes, step.rule);
+            }
+
+            if(step.fresh)
+            {
+                Put(bytes, step.gap);
+                Put(bytes, step.length);
+            }
+        }
+
+        /**
+         * @return Next step, or nullopt at the end of the trace or on malformed input.
+         */
+        static std::optional<Step> ReadStep(std::span<std::byte const> bytes, std::size_t &offset)
+        {
+            auto state = Get(bytes, offset);
+            auto terminal = Get(bytes, offset);
+            auto action = Get(bytes, offset);
+
+            if(!state || !terminal || !action)
+            {
+                return std::nullopt;
+            }
+
+            Step step = {
+                .state = *state,
+                .terminal = *terminal >> 1 ? std::optional(std::uint64_t(*terminal >> 1) - 1) : std::nullopt,
+                .action = *action,
+                .fresh = static_cast<bool>(*terminal & 1),
+            };
+
+            if(Reduces(step))
+            {
+                auto rule = Get(bytes, offset);
+                if(!rule)
+                {
+                    return std::nullopt;
+                }
+
+                step.rule = *rule;
+            }
+
+            if(step.fresh)
+            {
+                auto gap = Get(bytes, offset);
+                auto length = Get(bytes, offset);
+
+                if(!gap || !length)
+                {
+                    return std::nullopt;
+                }
+
+                step.gap = *gap;
+                step.length = *length;
+            }
+
+            return step;
+        }
+    };
+
+    /**
+     * PARSER
+     * @tparam G
+     */
+    template<IGrammar G>
+    class Parser
+    {
+    public:
+        virtual std::expected<typename G::ValueType, Error> Parse(std::string_view input,  std::vector<Token<G>> *tokens) = 0;
+
+        virtual ~Parser() = default;
+    };
+
+    /**
+     * LR PARSER
+     * Table-driven LR runtime shared by all parser backends. A backend fills the build-time ACTION and GOTO tables
+     * (see SLRParser<G>, LR1Parser<G>), which are then finalized into the same packed format and parsed by the same
+     * loop.
+     * @tparam G
+     */
+    template<IGrammar G>
+    class LRParser : public Parser<G>
+    {
+    protected:
+        Grammar<G> grammar_;
+
+        /*
+         * Build-time parsing tables, converted into the flat tables below by FinalizeTables.
+         */
+        std::map<lrstate_id_t, std::map<Terminal<G>*, LRAction<G>>> action_;
+        std::map<lrstate_id_t, std::map<NonTerminal<G>*, lrstate_id_t>> goto_;
+
+        std::map<NonTerminal<G>*, std::size_t> nonterminal_columns_;
+
+        /*
+         * Finalized parsing tables. ACTION and GOTO are row-major with one row per state. ACTION columns index
+         * `terminals_`, GOTO columns are given by `nonterminal_columns_`.
+         */
+        std::size_t state_count_ = 0;
+        std::vector<Terminal<G>*> terminals_;
+        std::variant<PackedTables<G, std::int16_t>, PackedTables<G, std::int32_t>> tables_;
+        std::vector<LRReduction<G>> reductions_;
+
+        /// Terminal columns the tokenizer tries in each state. The candidates of state `s` start at `candidate_offsets_[s]`.
+        std::vector<std::size_t> candidates_;
+        std::vector<std::size_t> candidate_offsets_;
+
+        /**
+         * Scanner running the DFAs of all terminals that have one (Terminal::Automaton) in a single pass, see
+         * CombineScanners. Per column, the index of the terminal's DFA in it, or -1.
+         */
+        std::shared_ptr<CombinedDFA const> scanner_;
+        std::vector<std::int32_t> scanner_dfas_;
+
+        /// Per state, the DFAs of its candidates as a mask for CombinedDFA::Run, and a last row with all of them.
+        std::vector<std::uint64_t> scanner_masks_;
+
+        /**
+         * An operator state is entered by shifting the operator of a binary rule `N -> N op N`, and its only kernel
+         * item is `N -> N op . N`. Chains of such operators are resolved by the operator-precedence fast path in
+         * LRParser<G>::Drive instead of walking the LR automaton.
+         */
+        struct OperatorState
+        {
+            /// Binary rule of this operator, or nullptr if the state is not an operator state.
+            ProductionRule<G> const *rule = nullptr;
+            std::size_t reduction = 0;
+
+            /// State reached after the right operand has been reduced, i.e. GOTO(this, N).
+            lrstate_id_t after_operand = 0;
+        };
+
+        std::vector<OperatorState> operator_states_;
+
+        /// Per state, the reduction performed without scanning a lookahead, or npos. See BuildOptions::profile.
+        std::vector<std::size_t> default_reductions_;
+
+        /// Id of each state in ParseProfile counters, see NumberProfileStates.
+        std::vector<std::size_t> profile_states_;
+        std::uint64_t profile_fingerprint_ = 0;
+
+        /// Fingerprint of the automaton and its runtime state ids, which ParseCheckpoints refer to.
+        std::uint64_t state_fingerprint_ = 0;
+
+        /*
+         * Symbol ids used in FlatTrees, by ACTION column, GOTO column and reduction. See NumberTreeSymbols.
+         */
+        std::vector<std::uint32_t> tree_terminals_;
+        std::vector<std::uint32_t> tree_nonterminals_;
+        std::vector<std::uint32_t> tree_rules_;
+        std::uint64_t tree_fingerprint_ = 0;
+
+        ParseProfile *profile_ = nullptr;
+
+        /// See BuildOptions::validate_utf8.
+        bool validate_utf8_ = false;
+
+        BuildReport<G> report_;
+
+        /**
+         * Operator whose right operand is being parsed by the LR automaton.
+         */
+        struct PendingOperator
+        {
+            /// Operator state that was shifted into.
+            lrstate_id_t state;
+            typename G::ValueType value;
+        };
+
+        /**
+         * Precedence-climbing frame. It owns the operators above `operator_base` and the operands above
+         * `operand_base`, the first of which is the left operand popped off the parse stack when the frame was opened.
+         */
+        struct OperatorFrame
+        {
+            /// State the result is pushed back into once all operators have been reduced.
+            lrstate_id_t state;
+
+            /// Parse stack size while the current operator's state is on top of it.
+            std::size_t marker_depth;
+
+            std::size_t operand_base;
+            std::size_t operator_base;
+        };
+
+        /**
+         * Contiguous parse stack used for regular, non-resumable parses. States are kept apart from values, in the
+         * table's state type, so the part the automaton reads on every step stays small.
+         * @tparam State
+         */
+        template<std::unsigned_integral State>
+        struct ParseStack
+        {
+            static constexpr bool kOperatorPrecedence = true;
+            static constexpr bool kSyntaxTree = false;
+            static constexpr bool kTrace = false;
+            static constexpr bool kEarlyStop = false;
+            static constexpr bool kDefaultReductions = true;
+
+            std::vector<State> states;
+            std::vector<typename G::ValueType> values;
+
+            std::size_t Size() const
+            {
+                return this->states.size();
+            }
+
+            lrstate_id_t TopState() const
+            {
+                return this->states.back();
+            }
+
+            typename G::ValueType &TopValue()
+            {
+                return this->values.back();
+            }
+
+            void Push(lrstate_id_t state, std::optional<typename G::ValueType> value)
+            {
+                this->states.push_back(static_cast<State>(state));
+                if(value)
+                {
+                    this->values.push_back(std::move(*value));
+                }
+                else
+                {
+                    this->values.emplace_back();
+                }
+            }
+
+            typename G::ValueType Pop()
+            {
+                typename G::ValueType value = std::move(this->values.back());
+                this->values.pop_back();
+                this->states.pop_back();
+
+                return value;
+            }
+
+            ParseStack()
+            {
+                this->states.push_back(0);
+                this->values.emplace_back();
+            }
+        };
+
+        /**
+         * Parse stack that also builds the syntax tree written by LRParser<G>::ParseFlatTree. Each stack entry has
+         * the tree node of its symbol. The operator fast path is disabled, as it skips the stack.
+         * @tparam State
+         */
+        template<std::unsigned_integral State>
+        struct TreeParseStack : ParseStack<State>
+        {
+            static constexpr bool kOperatorPrecedence = false;
+            static constexpr bool kSyntaxTree = true;
+
+            std::vector<FlatTree::Node> nodes;
+            std::vector<FlatTree::Token> tokens;
+            std::vector<std::uint32_t> children;
+
+            std::vector<std::uint32_t> node_stack = { FlatTree::kLeaf };
+
+            /// Node of the symbol pushed next.
+            std::uint32_t pending = FlatTree::kLeaf;
+
+            void Shift(Token<G> const &token, std::uint32_t terminal)
+            {
+                this->tokens.push_back({
+                    .terminal = terminal,
+                    .begin = static_cast<std::uint32_t>(token.location.begin),
+                    .end = static_cast<std::uint32_t>(token.location.end),
+                });
+
+                this->pending = static_cast<std::uint32_t>(this->nodes.size());
+                this->nodes.push_back({
+                    .symbol = FlatTree::kLeaf,
+                    .rule = 0,
+                    .first = static_cast<std::uint32_t>(this->tokens.size() - 1),
+                    .count = 0,
+                    .begin = this->tokens.back().begin,
+                    .end = this->tokens.back().end,
+                });
+            }
+
+            /**
+             * Creates the node of a reduction from the top `length` entries, before they are popped.
+             */
+            void Reduce(std::size_t length, std::uint32_t symbol, std::uint32_t rule)
+            {
+                auto operands = std::span(this->node_stack).last(length);
+
+                // Empty productions cover no input, right after the last token.
+                std::uint32_t position = this->tokens.empty() ? 0 : this->tokens.back().end;
+
+                this->pending = static_cast<std::uint32_t>(this->nodes.size());
+                this->nodes.push_back({
+                    .symbol = symbol,
+                    .rule = rule,
+                    .first = static_cast<std::uint32_t>(this->children.size()),
+                    .count = static_cast<std::uint32_t>(length),
+                    .begin = length ? this->nodes[operands.front()].begin : position,
+                    .end = length ? this->nodes[operands.back()].end : position,
+                });
+
+                this->children.insert(this->children.end(), operands.begin(), operands.end());
+            }
+
+            void Push(lrstate_id_t state, std::optional<typename G::ValueType> value)
+            {
+                ParseStack<State>::Push(state, std::move(value));
+                this->node_stack.push_back(this->pending);
+            }
+
+            typename G::ValueType Pop()
+            {
+                this->node_stack.pop_back();
+                return ParseStack<State>::Pop();
+            }
+        };
+
+        /**
+         * Parse stack for traced and replayed parses. The operator fast path is disabled, so every step goes through
+         * the automaton. With `kRecord`, steps are appended to `trace` (see ParseTrace).
+         * @tparam State
+         * @tparam kRecord
+         */
+        template<std::unsigned_integral State, bool kRecord>
+        struct TraceParseStack : ParseStack<State>
+        {
+            static constexpr bool kOperatorPrecedence = false;
+            static constexpr bool kTrace = kRecord;
+
+            std::vector<std::byte> *trace = nullptr;
+
+            /// End of the last shifted token.
+            std::size_t token_end = 0;
+
+            /// The current lookahead was recorded by a previous step.
+            bool seen = false;
+
+            /**
+             * Appends `step` (see LRParser<G>::TraceStep) with the location of `lookahead`, if any.
+             */
+            void Step(ParseTrace::Step step, Token<G> const *lookahead)
+            {
+                if(lookahead && !this->seen)
+                {
+                    step.fresh = true;
+                    step.gap = lookahead->location.begin - this->token_end;
+                    step.length = lookahead->Size();
+                    this->seen = true;
+                }
+
+                if((step.action & 3) == static_cast<std::uint64_t>(LRActionType::kShift))
+                {
+                    this->token_end = lookahead->location.end;
+                    this->seen = false;
+                }
+
+                ParseTrace::WriteStep(*this->trace, step);
+            }
+        };
+
+        /**
+         * Parse stack of LRParser<G>::ParseUntil, which hands every reduction to `stop`. The operator fast path is
+         * disabled, as it reduces operators on its own, and so are default reductions, so that the input scanned
+         * before stopping does not depend on the profile the parser was built with.
+         * @tparam State
+         * @tparam Stop
+         */
+        template<std::unsigned_integral State, typename Stop>
+        struct StoppingParseStack : ParseStack<State>
+        {
+            static constexpr bool kOperatorPrecedence = false;
+            static constexpr bool kEarlyStop = true;
+            static constexpr bool kDefaultReductions = false;
+
+            Stop &stop;
+
+            /// Value of the reduction `stop` held for.
+            std::optional<typename G::ValueType> result;
+
+            StoppingParseStack(Stop &stop) : stop(stop) {}
+        };
+
+        /**
+         * Persistent parse stack backing ParseCheckpoint<G>. Nodes are shared between checkpoints and are only
+         * modified (values moved out) when they are not referenced by any other stack (copy-on-write).
+         */
+        struct SharedParseStack
+        {
+            using Node = typename ParseCheckpoint<G>::Node;
+
+            /// Operator frames are not part of a checkpoint, so resumable parses walk the full automaton.
+            static constexpr bool kOperatorPrecedence = false;
+            static constexpr bool kSyntaxTree = false;
+            static constexpr bool kTrace = false;
+            static constexpr bool kEarlyStop = false;
+            static constexpr bool kDefaultReductions = true;
+
+            std::shared_ptr<Node> top;
+
+            lrstate_id_t TopState() const
+            {
+                return this->top->state;
+            }
+
+            typename G::ValueType &TopValue()
+            {
+                return this->top->value;
+            }
+
+            void Push(lrstate_id_t state, std::optional<typename G::ValueType> value)
+            {
+                auto node = std::make_shared<Node>(state);
+                if(value)
+                {
+                    node->value = std::move(*value);
+                }
+                node->next = std::move(this->top);
+
+                this->top = std::move(node);
+            }
+
+            typename G::ValueType Pop()
+            requires std::copy_constructible<typename G::ValueType>
+            {
+                std::shared_ptr<Node> node = std::move(this->top);
+                this->top = node->next;
+
+                // Node is still referenced by a checkpoint.
+                if(node.use_count() > 1)
+                {
+                    return node->value;
+                }
+
+                return std::move(node->value);
+            }
+
+            SharedParseStack(std::shared_ptr<Node> top) : top(std::move(top)) {}
+
+            SharedParseStack(SharedParseStack const &) = delete;
+
+            /**
+             * Releases uniquely owned nodes iteratively, so deep stacks cannot overflow the call stack.
+             */
+            ~SharedParseStack()
+            {
+                while(this->top && this->top.use_count() == 1)
+                {
+                    this->top = std::move(this->top->next);
+                }
+            }
+        };
+
+        enum class DriveResult
+        {
+            kAccept,
+            kSuspend,
+
+            /// A StoppingParseStack's predicate held.
+            kStop,
+        };
+
+        struct Tokenizer
+        {
+            LRParser<G> const &parser;
+
+            /// Current contiguous segment of the input, and the position in it.
+            std::string_view input;
+            std::size_t index = 0;
+
+            /// Segments after `input`, and the offset of `input` in the whole input.
+            std::span<std::string_view const> segments;
+            std::size_t base = 0;
+
+            /// Copy of the input around a segment boundary, see Peek.
+            std::string side_buffer;
+
+            /// States of the last run of the parser's CombinedDFA.
+            std::vector<std::int32_t> scanner_path;
+
+            std::vector<Token<G>> *tokens;
+
+            /// ACTION column of the token returned by the last strict Peek.
+            std::size_t column = 0;
+
+            /// End of the last consumed token, in the whole input.
+            std::size_t token_end = 0;
+
+            /// Dialect of the parse. Terminals without any of its features are not scanned.
+            FeatureMask features = kAllFeatures;
+
+            /// Input is validated UTF-8 that is not pure ASCII, so tokens must end on character boundaries.
+            bool multibyte = false;
+
+            /// Validation of the input as UTF-8 (BuildOptions::validate_utf8), run just ahead of scanning, see Validate.
+            std::optional<UTF8Validator> validator;
+
+            /// Input not fed to the validator yet: rest of a segment, and the segments after it.
+            std::string_view unvalidated;
+            std::span<std::string_view const> unvalidated_segments;
+
+            /// Input may end in the middle of a character, as the prefixes of ParsePrefix do.
+            bool prefix = false;
+
+            /// Offset of the first ill-formed UTF-8 sequence found by Validate.
+            std::optional<std::size_t> invalid;
+
+            /**
+             * Tokens starting or ending closer than this to the end of a segment are scanned in the side buffer, with
+             * at least this many bytes of the following segments. This covers tokens that continue across the
+             * boundary and terminals that look ahead up to this many bytes past the end of their match. A terminal
+             * that looks further ahead before settling on a shorter match (e.g. `a.{100}x|a`) can still be scanned
+             * differently near a boundary than in contiguous input.
+             */
+            static constexpr std::size_t kStraddleWindow = 64;
+
+            /// Bytes validated at a time, ahead of the scanner.
+            static constexpr std::size_t kValidationBlock = 4096;
+
+            /**
+             * @return Offset of the current position in the whole input.
+             */
+            std::size_t Position() const
+            {
+                return this->base + this->index;
+            }
+
+            /**
+             * Moves on to the next segment once the current one is consumed.
+             * @return Whether the segment changed.
+             */
+            bool NextSegment()
+            {
+                if(this->index < this->input.size() || this->segments.empty())
+                {
+                    return false;
+                }
+
+                this->index -= this->input.size();
+                this->base += this->input.size();
+                this->input = this->segments.front();
+                this->segments = this->segments.subspan(1);
+                return true;
+            }
+
+            /**
+             * Validates the rest of the input as UTF-8 while it is tokenized.
+             * @param prefix Input may end in the middle of a character.
+             */
+            void ValidateUTF8(bool prefix = false)
+            {
+                this->validator.emplace(this->Position());
+                this->unvalidated = this->input.substr(this->index);
+                this->unvalidated_segments = this->segments;
+                this->prefix = prefix;
+            }
+
+            /**
+             * @return Offset up to which the input was validated (npos once all of it was, or without validation).
+             */
+            std::size_t Validated() const
+            {
+                return this->validator ? this->validator->Offset() : std::string_view::npos;
+            }
+
+            /**
+             * Validates the input up to at least `end`, a block at a time. Validation thus stays just ahead of the
+             * scanner, over bytes that are about to be scanned anyway, instead of taking a separate pass over the
+             * input. Sets `multibyte` once a non-ASCII character was seen.
+             * @param end Offset in the whole input.
+             * @return Whether the input is valid so far.
+             */
+            bool Validate(std::size_t end)
+            {
+                while(this->validator && !this->invalid && this->validator->Offset() < end)
+                {
+                    while(this->unvalidated.empty() && !this->unvalidated_segments.empty())
+                    {
+                        this->unvalidated = this->unvalidated_segments.front();
+                        this->unvalidated_segments = this->unvalidated_segments.subspan(1);
+                    }
+
+                    if(this->unvalidated.empty())
+                    {
+                        UTF8Scan scan = this->validator->Finish();
+                        if(!scan.Valid() && !(this->prefix && scan.truncated))
+                        {
+                            this->invalid = scan.error;
+                        }
+
+                        this->validator.reset();
+                        break;
+                    }
+
+                    std::string_view block = this->unvalidated.substr(0, kValidationBlock);
+                    this->unvalidated.remove_prefix(block.size());
+
+                    if(!this->validator->Feed(block))
+                    {
+                        this->invalid = this->validator->Result().error;
+                    }
+                    this->multibyte = this->multibyte || !this->validator->Result().ascii;
+                }
+
+                return !this->invalid;
+            }
+
+            /**
+             * @return Error for the ill-formed UTF-8 found by Validate, if any.
+             */
+            std::optional<Error> InvalidInput() const
+            {
+                if(!this->invalid)
+                {
+                    return std::nullopt;
+                }
+
+                std::string_view buffer = this->base == 0 && this->segments.empty() ? this->input : std::string_view();
+                return ParsingError({ .buffer = buffer, .begin = *this->invalid, .end = *this->invalid + 1 }, "Invalid UTF-8");
+            }
+
+            /**
+             * @return Whether `token`, scanned at the start of `view`, ends in the middle of a multibyte character.
+             */
+            bool SplitsCharacter(std::string_view view, Token<G> const &token) const
+            {
+                return this->multibyte && token.location.end < view.size() && (static_cast<unsigned char>(view[token.location.end]) & 0xC0) == 0x80;
+            }
+
+            /**
+             * Scans a token at the start of `view`, with its location relative to `view`.
+             */
+            std::optional<Token<G>> Lex(std::string_view view, lrstate_id_t state, bool permissive)
+            {
+                // IMPORTANT: No need to check for EOF, because it is checked for by special EOF terminal!
+
+                bool scanned = false;
+
+                if(permissive)
+                {
+                    for(std::size_t column = 0; column < this->parser.terminals_.size(); column++)
+                    {
+                        auto token = this->LexTerminal(view, column, this->parser.state_count_, scanned);
+                        if(token && !this->SplitsCharacter(view, *token))
+                        {
+                            return token;
+                        }
+                    }
+                }
+                else
+                {
+                    for(std::size_t column : this->parser.Candidates(state))
+                    {
+                        auto token = this->LexTerminal(view, column, state, scanned);
+                        if(token && !this->SplitsCharacter(view, *token))
+                        {
+                            this->column = column;
+                            return token;
+                        }
+                    }
+                }
+
+                return std::nullopt;
+            }
+
+            /**
+             * Scans the terminal of `column` at the start of `view`. Terminals of the parser's CombinedDFA share a
+             * single run of it per view, over the candidates of `state` (all terminals for `state_count_`).
+             */
+            std::optional<Token<G>> LexTerminal(std::string_view view, std::size_t column, std::size_t state, bool &scanned)
+            {
+                Terminal<G> *terminal = this->parser.terminals_[column];
+                if(!(terminal->features & this->features))
+                {
+                    return std::nullopt;
+                }
+
+                if(!this->parser.scanner_ || this->parser.scanner_dfas_[column] < 0)
+                {
+                    return terminal->Lex(view);
+                }
+
+                if(!scanned)
+                {
+                    std::size_t words = this->parser.scanner_->Words();
+                    this->parser.scanner_->Run(view, std::span(this->parser.scanner_masks_).subspan(state * words, words), this->scanner_path);
+                    scanned = true;
+                }
+
+                auto length = this->parser.scanner_->Longest(this->scanner_path, this->parser.scanner_dfas_[column]);
+                if(!length)
+                {
+                    return std::nullopt;
+                }
+
+                return Token<G> {
+                        .terminal = terminal,
+                        .raw = view.substr(0, *length),
+                        .location = {
+                                .buffer = {},
+                                .begin = 0,
+                                .end = *length,
+                        },
+                };
+            }
+
+            /**
+             * Scans a token at the current position, across segment boundaries if needed.
+             * @return Token with its location relative to the current position.
+             */
+            std::optional<Token<G>> Scan(lrstate_id_t state, bool permissive)
+            {
+                std::string_view view = this->input.substr(this->index);
+                std::optional<Token<G>> token;
+
+                if(this->segments.empty() || view.size() >= kStraddleWindow)
+                {
+                    token = this->Lex(view, state, permissive);
+                }
+
+                // The token may continue in the next segments, or may have stopped short because of the boundary (e.g.
+                // `1.` without its fraction): scan a copy of the input across the boundary, growing it until the match
+                // ends at least kStraddleWindow bytes before the end of the copy.
+                if(!this->segments.empty() && (view.size() < kStraddleWindow || !token || token->location.end + kStraddleWindow > view.size()))
+                {
+                    this->side_buffer.assign(view);
+
+                    std::size_t next = 0;
+                    do
+                    {
+                        std::size_t target = std::max(this->side_buffer.size() * 2, view.size() + kStraddleWindow);
+                        while(this->side_buffer.size() < target && next < this->segments.size())
+                        {
+                            this->side_buffer += this->segments[next++];
+                        }
+
+                        token = this->Lex(this->side_buffer, state, permissive);
+                    }
+                    while(next < this->segments.size() && (!token || token->location.end + kStraddleWindow > this->side_buffer.size()));
+                }
+
+                return token;
+            }
+
+            std::optional<Token<G>> Peek(lrstate_id_t state = 0, bool permissive = false)
+            {
+                do
+                {
+                    while(this->index < this->input.size() && std::isspace(static_cast<unsigned char>(this->input[this->index]))) this->index++;
+                }
+                while(this->NextSegment());
+
+                if(!this->Validate(this->Position() + kValidationBlock))
+                {
+                    return std::nullopt;
+                }
+
+                std::optional<Token<G>> token = this->Scan(state, permissive);
+
+                // A token reaching past the validated block: validate it as well, and scan again if it turned out to
+                // contain the first multibyte character, which the token must not split.
+                while(token && this->Position() + token->location.end >= this->Validated())
+                {
+                    bool multibyte = this->multibyte;
+                    if(!this->Validate(this->Position() + token->location.end + kValidationBlock))
+                    {
+                        return std::nullopt;
+                    }
+
+                    if(this->multibyte != multibyte)
+                    {
+                        token = this->Scan(state, permissive);
+                    }
+                }
+
+                if(!token)
+                {
+                    BUFFALO_PROBE(lex__miss, state, this->Position());
+
+                    if(permissive)
+                    {
+                        // No token was matched. So we increment the index to skip this character.
+                        this->index++;
+                    }
+
+                    return std::nullopt;
+                }
+
+                token->location.begin += this->Position();
+                token->location.end += this->Position();
+                return token;
+            }
+
+            void Consume(Token<G> const &token)
+            {
+                this->index += token.Size();
+                this->token_end = this->Position();
+                while(this->NextSegment());
+
+                if(tokens)
+                {
+                    tokens->push_back(token);
+                }
+            }
+
+            Tokenizer(LRParser<G> const &parser, std::string_view input, std::vector<Token<G>> *tokens = nullptr) : parser(parser), input(input), tokens(tokens) {}
+
+            Tokenizer(LRParser<G> const &parser, std::span<std::string_view const> segments) : parser(parser), tokens(nullptr)
+            {
+                if(!segments.empty())
+                {
+                    this->input = segments.front();
+                    this->segments = segments.subspan(1);
+                }
+            }
+        };
+
+        /**
+         * Stands in for the Tokenizer when replaying a ParseTrace: lookaheads are read from the trace instead of
+         * being scanned.
+         */
+        struct TraceTokenizer
+        {
+            LRParser<G> const &parser;
+            std::string_view input;
+
+            std::span<std::byte const> trace;
+            std::size_t offset = 0;
+
+            std::vector<Token<G>> *tokens = nullptr;
+            std::size_t column = 0;
+            FeatureMask features = kAllFeatures;
+
+            /// End of the last consumed token, and the current lookahead.
+            std::size_t token_end = 0;
+            std::optional<Token<G>> lookahead;
+
+            /// The trace ended early or does not match the parser.
+            bool mismatch = false;
+
+            /// ACTION column of each terminal id, or npos, and state of each state id of the trace.
+            std::vector<std::size_t> columns;
+            std::map<std::uint64_t, lrstate_id_t> states;
+
+            TraceTokenizer(LRParser<G> const &parser, std::string_view input, std::span<std::byte const> trace, std::size_t offset) : parser(parser), input(input), trace(trace), offset(offset)
+            {
+                this->columns.assign(parser.terminals_.size(), std::string_view::npos);
+                for(std::size_t column = 0; column < parser.terminals_.size(); column++)
+                {
+                    this->columns[parser.tree_terminals_[column]] = column;
+                }
+
+                for(lrstate_id_t state = 0; state < parser.profile_states_.size(); state++)
+                {
+                    this->states[parser.profile_states_[state]] = state;
+                }
+            }
+
+            /**
+             * @return Whether a reduction without lookahead was recorded where the parser takes the same one.
+             */
+            bool DefaultReduction(ParseTrace::Step const &step) const
+            {
+                auto it = this->states.find(step.state);
+                if(it == this->states.end() || this->parser.default_reductions_[it->second] == std::string_view::npos)
+                {
+                    return false;
+                }
+
+                LRAction<G> action = { .type = LRActionType::kReduce, .reduction = this->parser.default_reductions_[it->second] };
+                return ParseTrace::SameAction(step, this->parser.TraceStep(it->second, std::nullopt, action));
+            }
+
+            std::size_t Position() const
+            {
+                return this->token_end;
+            }
+
+            std::optional<Token<G>> Peek(lrstate_id_t state = 0, [[maybe_unused]] bool permissive = false)
+            {
+                std::optional<ParseTrace::Step> step;
+                do
+                {
+                    step = ParseTrace::ReadStep(this->trace, this->offset);
+
+                    // Reductions without lookahead are taken from the tables, which must have them as well.
+                    if(step && !step->terminal && !this->DefaultReduction(*step))
+                    {
+                        step.reset();
+                    }
+                }
+                while(step && !step->terminal);
+
+                if(!step || *step->terminal >= this->columns.size() || this->columns[*step->terminal] == std::string_view::npos || !(step->fresh || this->lookahead))
+                {
+                    this->mismatch = true;
+                    return std::nullopt;
+                }
+
+                // The recorded action must be the one of the tables, before the lookahead reaches a reasoner.
+                std::size_t column = this->columns[*step->terminal];
+                LRAction<G> action = std::visit([&](auto const &tables) { return tables.Action(state, column); }, this->parser.tables_);
+                if(!ParseTrace::SameAction(*step, this->parser.TraceStep(state, column, action)))
+                {
+                    this->mismatch = true;
+                    return std::nullopt;
+                }
+
+                if(step->fresh)
+                {
+                    std::size_t rest = this->input.size() - this->token_end;
+                    if(step->gap > rest || step->length > rest - step->gap)
+                    {
+                        this->mismatch = true;
+                        return std::nullopt;
+                    }
+
+                    std::size_t begin = this->token_end + step->gap;
+                    this->lookahead = Token<G>{
+                        .terminal = this->parser.terminals_[column],
+                        .raw = this->input.substr(begin, step->length),
+                        .location = {
+                            .buffer = this->input,
+                            .begin = begin,
+                            .end = begin + step->length,
+                        },
+                    };
+                }
+
+                this->column = column;
+                return this->lookahead;
+            }
+
+            void Consume(Token<G> const &token)
+            {
+                this->token_end = token.location.end;
+                this->lookahead.reset();
+            }
+
+            /**
+             * @return Always empty: traces are replayed over the input they were recorded from.
+             */
+            std::optional<Error> InvalidInput() const
+            {
+                return std::nullopt;
+            }
+        };
+
+        /**
+         * @return ParseTrace step for `action` in `state` on the terminal of ACTION column `column`, if any, in the
+         * ids of NumberProfileStates and NumberTreeSymbols.
+         */
+        ParseTrace::Step TraceStep(lrstate_id_t state, std::optional<std::size_t> column, LRAction<G> const &action) const
+        {
+            ParseTrace::Step step = {
+                .state = this->profile_states_[state],
+                .terminal = column ? std::optional<std::uint64_t>(this->tree_terminals_[*column]) : std::nullopt,
+                .action = static_cast<std::uint64_t>(action.type),
+            };
+
+            if(action.type == LRActionType::kShift)
+            {
+                step.action |= static_cast<std::uint64_t>(this->profile_states_[action.state]) << 2;
+            }
+            else if(action.type == LRActionType::kReduce)
+            {
+                step.action |= static_cast<std::uint64_t>(this->tree_nonterminals_[this->reductions_[action.reduction].non_terminal]) << 2;
+                step.rule = this->tree_rules_[action.reduction];
+            }
+
+            return step;
+        }
+
+        /**
+         * Numbers NonTerminals (GOTO columns) and production rules (reductions).
+         * @return Reduction id of each production rule.
+         */
+        std::map<ProductionRule<G> const*, std::size_t> NumberSymbols()
+        {
+            for(auto nonterminal : this->grammar_.nonterminals_)
+            {
+                this->nonterminal_columns_[nonterminal] = this->nonterminal_columns_.size();
+            }
+
+            std::map<ProductionRule<G> const*, std::size_t> reduction_ids;
+            for(auto const &rule : this->grammar_.ProductionRules())
+            {
+                reduction_ids[&rule] = this->reductions_.size();
+                this->reductions_.push_back({
+                    .rule = &rule,
+                    .length = rule.sequence_.size(),
+                    .non_terminal = this->nonterminal_columns_.at(rule.non_terminal_),
+                    .features = rule.features_,
+                });
+            }
+
+            return reduction_ids;
+        }
+
+        /**
+         * Creates a REDUCE entry by `rule` on `terminal` in `state`, resolving a conflict with an existing SHIFT
+         * through precedence and associativity.
+         * @param state
+         * @param terminal
+         * @param rule
+         * @param reduction Reduction id of `rule`.
+         * @return
+         */
+        std::optional<Error> AddReduction(lrstate_id_t state, Terminal<G> *terminal, ProductionRule<G> const *rule, std::size_t reduction)
+        {
+            switch(this->action_[state][terminal].type)
+            {
+                /* SHIFT-REDUCE CONFLICT */
+                case LRActionType::kShift:
+                {
+                    // Reduce due to higher precedence
+                    if(rule->precedence < terminal->precedence)
+                    {
+                        this->action_[state][terminal] = {
+                            .type = LRActionType::kReduce,
+                            .reduction = reduction,
+                        };
+                        break;
+                    }
+
+                    // Shift due to lower precedence
+                    if(rule->precedence > terminal->precedence)
+                    {
+                        break;
+                    }
+
+                    // Reduce due to associativity rule
+                    if(terminal->associativity == Associativity::Left)
+                    {
+                        this->action_[state][terminal] = {
+                            .type = LRActionType::kReduce,
+                            .reduction = reduction,
+                        };
+                        break;
+                    }
+
+                    // Shift due to associativity rule
+                    if(terminal->associativity == Right)
+                    {
+                        break;
+                    }
+
+                    // Unable to resolve conflict
+                    return GrammarDefinitionError("ShiftReduce");
+                }
+
+                case LRActionType::kReduce:
+                {
+                    return GrammarDefinitionError("ReduceReduce");
+                }
+
+                default:
+                {
+                    this->action_[state][terminal] = {
+                        .type = LRActionType::kReduce,
+                        .reduction = reduction,
+                    };
+                }
+            }
+
+            return std::nullopt;
+        }
+
+        /**
+         * Creates the SHIFT or GOTO entry of a transition.
+         * @param state
+         * @param symbol
+         * @param target
+         */
+        void AddTransition(lrstate_id_t state, Symbol<G> symbol, lrstate_id_t target)
+        {
+            std::visit(overload{
+                // Create ACTION
+                [&](Terminal<G> *terminal)
+                {
+                    this->action_[state][terminal] = {
+                        .type = LRActionType::kShift,
+                        .state = target,
+                    };
+                },
+
+                // Create GOTO
+                [&](NonTerminal<G> *non_terminal)
+                {
+                    this->goto_[state][non_terminal] = target;
+                },
+            }, symbol);
+        }
+
+        /**
+         * Orders states so that each state is followed by the states it transitions into (depth-first from the start
+         * state, GOTO transitions first as one is taken after every reduction). A shift or goto then usually lands on
+         * a nearby row of the parsing tables.
+         * @return Build-time state ids in their new order. The start state remains first.
+         */
+        std::vector<lrstate_id_t> LocalityOrder() const
+        {
+            std::vector<lrstate_id_t> order;
+            std::vector<bool> visited(this->state_count_, false);
+            std::vector<lrstate_id_t> stack = { 0 };
+
+            while(!stack.empty())
+            {
+                lrstate_id_t state = stack.back();
+                stack.pop_back();
+
+                if(visited[state]) continue;
+                visited[state] = true;
+                order.push_back(state);
+
+                std::vector<lrstate_id_t> successors;
+                if(this->goto_.contains(state))
+                {
+                    for(lrstate_id_t successor : this->goto_.at(state) | std::views::values)
+                    {
+                        successors.push_back(successor);
+                    }
+                }
+                if(this->action_.contains(state))
+                {
+                    for(auto const &action : this->action_.at(state) | std::views::values)
+                    {
+                        if(action.type == LRActionType::kShift)
+                        {
+                            successors.push_back(action.state);
+                        }
+                    }
+                }
+
+                stack.insert(stack.end(), successors.rbegin(), successors.rend());
+            }
+
+            return order;
+        }
+
+        /**
+         * Partitions states by behavior: two states are equivalent if their ACTION and GOTO rows (and operator fast
+         * path entries) are identical up to equivalence of the states they lead to. Starting from a single class,
+         * classes are split until stable, as in DFA minimization.
+         * @return Representative (lowest id) of each state's class.
+         */
+        std::vector<lrstate_id_t> EquivalentStates()
+        {
+            using RowEntry = std::tuple<void const*, int, std::size_t>;
+
+            std::vector<lrstate_id_t> classes(this->state_count_, 0);
+            std::size_t class_count = 1;
+
+            while(true)
+            {
+                std::map<std::pair<lrstate_id_t, std::vector<RowEntry>>, lrstate_id_t> ids;
+                std::vector<lrstate_id_t> next(this->state_count_);
+
+                for(lrstate_id_t state = 0; state < this->state_count_; state++)
+                {
+                    std::vector<RowEntry> row;
+                    for(auto const &[terminal, action] : this->action_[state])
+                    {
+                        switch(action.type)
+                        {
+                            case LRActionType::kShift: row.emplace_back(terminal, static_cast<int>(action.type), classes[action.state]); break;
+                            case LRActionType::kReduce: row.emplace_back(terminal, static_cast<int>(action.type), action.reduction); break;
+                            default: row.emplace_back(terminal, static_cast<int>(action.type), 0); break;
+                        }
+                    }
+                    for(auto const &[nonterminal, target] : this->goto_[state])
+                    {
+                        row.emplace_back(nonterminal, -1, classes[target]);
+                    }
+
+                    OperatorState const &operator_state = this->operator_states_[state];
+                    if(operator_state.rule)
+                    {
+                        row.emplace_back(operator_state.rule, -2, classes[operator_state.after_operand]);
+                    }
+
+                    next[state] = ids.try_emplace({ classes[state], std::move(row) }, ids.size()).first->second;
+                }
+
+                classes = std::move(next);
+                if(ids.size() == class_count) break;
+                class_count = ids.size();
+            }
+
+            std::vector<lrstate_id_t> representatives(class_count, this->state_count_);
+            std::vector<lrstate_id_t> result(this->state_count_);
+            for(lrstate_id_t state = 0; state < this->state_count_; state++)
+            {
+                representatives[classes[state]] = std::min(representatives[classes[state]], state);
+            }
+            for(lrstate_id_t state = 0; state < this->state_count_; state++)
+            {
+                result[state] = representatives[classes[state]];
+            }
+
+            return result;
+        }
+
+        /**
+         * Redirects all transitions to the representatives of their target states and drops the other states' rows.
+         * @param representatives
+         */
+        void MergeStates(std::vector<lrstate_id_t> const &representatives)
+        {
+            for(lrstate_id_t state = 0; state < this->state_count_; state++)
+            {
+                if(representatives[state] != state)
+                {
+                    this->action_.erase(state);
+                    this->goto_.erase(state);
+                    this->operator_states_[state] = {};
+                    this->report_.merged_states++;
+                    continue;
+                }
+
+                for(auto &action : this->action_[state] | std::views::values)
+                {
+                    if(action.type == LRActionType::kShift)
+                    {
+                        action.state = representatives[action.state];
+                    }
+                }
+                for(auto &target : this->goto_[state] | std::views::values)
+                {
+                    target = representatives[target];
+                }
+
+                this->operator_states_[state].after_operand = representatives[this->operator_states_[state].after_operand];
+            }
+        }
+
+        /**
+         * Numbers the build-time states by a breadth-first walk from the start state, following transitions in the
+         * order of the symbol ids of NumberTreeSymbols, and fingerprints the automaton along the way. Build-time ids
+         * follow symbol addresses; these ids, like the symbol ids, are the same in every program building the
+         * grammar, and key ParseProfile counters.
+         * @return Id of each build-time state.
+         */
+        std::vector<std::size_t> NumberProfileStates()
+        {
+            std::map<Terminal<G>*, std::uint32_t> terminal_ids;
+            for(std::size_t column = 0; column < this->terminals_.size(); column++)
+            {
+                terminal_ids[this->terminals_[column]] = this->tree_terminals_[column];
+            }
+
+            std::vector<std::size_t> ids(this->state_count_, std::string_view::npos);
+            std::vector<lrstate_id_t> order;
+            auto visit = [&](lrstate_id_t state)
+            {
+                if(ids[state] == std::string_view::npos)
+                {
+                    ids[state] = order.size();
+                    order.push_back(state);
+                }
+
+                return ids[state];
+            };
+
+            std::uint64_t fingerprint = this->tree_fingerprint_;
+            auto mix = [&](std::uint64_t value)
+            {
+                fingerprint = (fingerprint ^ value) * 0x100000001b3;
+            };
+
+            visit(0);
+            for(std::size_t i = 0; i < order.size(); i++)
+            {
+                std::vector<std::pair<std::uint32_t, LRAction<G>>> actions;
+                for(auto const &[terminal, action] : this->action_[order[i]])
+                {
+                    if(action.type != LRActionType::kError)
+                    {
+                        actions.emplace_back(terminal_ids.at(terminal), action);
+                    }
+                }
+                std::ranges::sort(actions, {}, [](auto const &action) { return action.first; });
+
+                std::vector<std::pair<std::uint32_t, lrstate_id_t>> gotos;
+                for(auto const &[nonterminal, target] : this->goto_[order[i]])
+                {
+                    gotos.emplace_back(this->tree_nonterminals_[this->nonterminal_columns_.at(nonterminal)], target);
+                }
+                std::ranges::sort(gotos);
+
+                mix(actions.size());
+                for(auto const &[terminal, action] : actions)
+                {
+                    mix(terminal);
+                    mix(static_cast<std::uint64_t>(action.type));
+
+                    if(action.type == LRActionType::kShift)
+                    {
+                        mix(visit(action.state));
+                    }
+                    else if(action.type == LRActionType::kReduce)
+                    {
+                        mix(this->tree_nonterminals_[this->reductions_[action.reduction].non_terminal]);
+                        mix(this->tree_rules_[action.reduction]);
+                    }
+                }
+
+                mix(gotos.size());
+                for(auto const &[nonterminal, target] : gotos)
+                {
+                    mix(nonterminal);
+                    mix(visit(target));
+                }
+            }
+
+            // Unreachable states are never visited by a parse.
+            for(lrstate_id_t state = 0; state < this->state_count_; state++)
+            {
+                visit(state);
+            }
+
+            this->profile_fingerprint_ = fingerprint;
+            return ids;
+        }
+
+        bool Matches(ParseProfile const &profile) const
+        {
+            return profile.fingerprint_ == this->profile_fingerprint_ && profile.states_ == this->state_count_ && profile.terminals_ == this->terminals_.size();
+        }
+
+        /**
+         * Checks that `checkpoint` was created by this parser, in the dialect `features`, and that `input` reaches its
+         * position.
+         */
+        std::optional<Error> Resumable(std::string_view input, ParseCheckpoint<G> const &checkpoint, FeatureMask features) const
+        {
+            if(checkpoint.automaton_ != this->state_fingerprint_)
+            {
+                return Error{"Checkpoint does not match the parser"};
+            }
+
+            if(checkpoint.features_ != features)
+            {
+                return Error{"Checkpoint was created for other features"};
+            }
+
+            if(checkpoint.index_ > input.size())
+            {
+                return Error{"Input ends before the checkpoint"};
+            }
+
+            return std::nullopt;
+        }
+
+        /**
+         * Converts the build-time tables into the flat tables used while parsing, optionally merging and renumbering
+         * states.
+         * @param options
+         */
+        std::optional<Error> FinalizeTables(BuildOptions const &options)
+        {
+            std::vector<std::size_t> profile_ids = this->NumberProfileStates();
+
+            ParseProfile const *profile = options.profile;
+            if(profile && !this->Matches(*profile))
+            {
+                return Error{"Profile does not match grammar"};
+            }
+
+            std::vector<lrstate_id_t> representatives(this->state_count_);
+            if(options.merge_states)
+            {
+                representatives = this->EquivalentStates();
+            }
+            else
+            {
+                std::iota(representatives.begin(), representatives.end(), 0);
+            }
+
+            // A merged state counts for all the states it replaces, under the lowest of their ids.
+            for(lrstate_id_t state = 0; state < this->state_count_; state++)
+            {
+                profile_ids[representatives[state]] = std::min(profile_ids[representatives[state]], profile_ids[state]);
+            }
+
+            this->MergeStates(representatives);
+
+            std::vector<lrstate_id_t> order;
+            if(options.renumber_states)
+            {
+                order = this->LocalityOrder();
+            }
+            else
+            {
+                for(lrstate_id_t state = 0; state < this->state_count_; state++)
+                {
+                    if(representatives[state] == state)
+                    {
+                        order.push_back(state);
+                    }
+                }
+            }
+
+            // Number of states after merging.
+            std::size_t state_count = order.size();
+            this->report_.states = state_count;
+
+            if(options.renumber_states && profile)
+            {
+                // Visited states first, hottest first, keeping the start state at 0.
+                auto visits = [&](lrstate_id_t state) { return profile->Visits(profile_ids[state]); };
+                std::stable_partition(order.begin() + 1, order.end(), [&](lrstate_id_t state) { return visits(state) > 0; });
+
+                auto cold = std::find_if(order.begin() + 1, order.end(), [&](lrstate_id_t state) { return visits(state) == 0; });
+                std::stable_sort(order.begin() + 1, cold, [&](lrstate_id_t a, lrstate_id_t b) { return visits(a) > visits(b); });
+            }
+
+            std::vector<lrstate_id_t> rank(this->state_count_);
+            for(lrstate_id_t i = 0; i < order.size(); i++)
+            {
+                rank[order[i]] = i;
+            }
+
+            std::map<Terminal<G>*, std::size_t> terminal_columns;
+            for(auto terminal : this->terminals_)
+            {
+                terminal_columns[terminal] = terminal_columns.size();
+            }
+
+            std::size_t terminal_count = this->terminals_.size();
+            std::size_t nonterminal_count = this->nonterminal_columns_.size();
+
+            std::vector<LRAction<G>> action_table(state_count * terminal_count);
+            std::vector<lrstate_id_t> goto_table(state_count * nonterminal_count, 0);
+            this->candidate_offsets_.clear();
+            this->candidates_.clear();
+
+            for(lrstate_id_t state = 0; state < state_count; state++)
+            {
+                lrstate_id_t old_state = order[state];
+                this->candidate_offsets_.push_back(this->candidates_.size());
+
+                for(auto const &[terminal, action] : this->action_[old_state])
+                {
+                    LRAction<G> entry = action;
+                    if(entry.type == LRActionType::kShift)
+                    {
+                        entry.state = rank[entry.state];
+                    }
+
+                    action_table[state * terminal_count + terminal_columns.at(terminal)] = entry;
+                    this->candidates_.push_back(terminal_columns.at(terminal));
+                }
+
+                if(profile)
+                {
+                    this->OrderCandidates(std::span(this->candidates_).subspan(this->candidate_offsets_.back()), [&](std::size_t column) { return profile->Count(profile_ids[old_state], this->tree_terminals_[column]); });
+                }
+
+                for(auto const &[nonterminal, target] : this->goto_[old_state])
+                {
+                    goto_table[state * nonterminal_count + this->nonterminal_columns_.at(nonterminal)] = rank[target];
+                }
+            }
+            this->candidate_offsets_.push_back(this->candidates_.size());
+
+            std::vector<OperatorState> operator_states(state_count);
+            for(lrstate_id_t state = 0; state < state_count; state++)
+            {
+                operator_states[state] = this->operator_states_[order[state]];
+                operator_states[state].after_operand = rank[this->operator_states_[order[state]].after_operand];
+            }
+            this->operator_states_ = std::move(operator_states);
+
+            this->default_reductions_.assign(state_count, std::string_view::npos);
+            for(lrstate_id_t state = 0; profile && state < state_count; state++)
+            {
+                if(profile->Visits(profile_ids[order[state]]) == 0) continue;
+
+                std::optional<std::size_t> reduction;
+                bool consistent = true;
+                for(auto const &action : this->action_[order[state]] | std::views::values)
+                {
+                    if(action.type == LRActionType::kError) continue;
+
+                    if(action.type != LRActionType::kReduce || (reduction && *reduction != action.reduction))
+                    {
+                        consistent = false;
+                        break;
+                    }
+                    reduction = action.reduction;
+                }
+
+                if(consistent && reduction)
+                {
+                    this->default_reductions_[state] = *reduction;
+                }
+            }
+
+            this->profile_states_.clear();
+            for(lrstate_id_t state : order)
+            {
+                this->profile_states_.push_back(profile_ids[state]);
+            }
+
+            // Runtime ids also depend on how states were merged and renumbered.
+            this->state_fingerprint_ = this->profile_fingerprint_;
+            for(std::size_t id : this->profile_states_)
+            {
+                this->state_fingerprint_ = (this->state_fingerprint_ ^ id) * 0x100000001b3;
+            }
+
+            if(options.narrow_tables && PackedTables<G, std::int16_t>::Fits(state_count, this->reductions_.size()))
+            {
+                this->tables_.template emplace<PackedTables<G, std::int16_t>>(action_table, goto_table, terminal_count, nonterminal_count);
+            }
+            else if(PackedTables<G, std::int32_t>::Fits(state_count, this->reductions_.size()))
+            {
+                this->tables_.template emplace<PackedTables<G, std::int32_t>>(action_table, goto_table, terminal_count, nonterminal_count);
+            }
+            else
+            {
+                return GrammarDefinitionError("Automaton too large");
+            }
+
+            this->report_.action_entry_size = std::visit([](auto const &tables) { return sizeof(typename std::decay_t<decltype(tables)>::EntryType); }, this->tables_);
+
+            this->action_.clear();
+            this->goto_.clear();
+
+            return std::nullopt;
+        }
+
+        /**
+         * Moves the most frequent candidates first. The first terminal that matches is scanned, so a candidate only
+         * moves ahead of candidates it cannot match the same input as (see Terminal<G>::FirstBytes); the order among
+         * overlapping terminals, e.g. a keyword and identifiers, stays the one of an unprofiled build.
+         * @param row Candidate columns of a state.
+         * @param count
+         */
+        template<typename Count>
+        void OrderCandidates(std::span<std::size_t> row, Count count) const
+        {
+            std::vector<std::size_t> pending(row.begin(), row.end());
+            std::vector<std::bitset<256>> first;
+            for(std::size_t column : pending)
+            {
+                first.push_back(this->terminals_[column]->FirstBytes());
+            }
+
+            // Number of pending candidates that come first and overlap, which must be placed before.
+            std::vector<std::size_t> blockers(pending.size(), 0);
+            for(std::size_t i = 0; i < pending.size(); i++)
+            {
+                for(std::size_t j = 0; j < i; j++)
+                {
+                    blockers[i] += (first[i] & first[j]).any();
+                }
+            }
+
+            std::vector<bool> placed(pending.size(), false);
+            for(auto &slot : row)
+            {
+                std::optional<std::size_t> best;
+                for(std::size_t i = 0; i < pending.size(); i++)
+                {
+                    if(!placed[i] && !blockers[i] && (!best || count(pending[i]) > count(pending[*best])))
+                    {
+                        best = i;
+                    }
+                }
+
+                placed[*best] = true;
+                slot = pending[*best];
+
+                for(std::size_t i = *best + 1; i < pending.size(); i++)
+                {
+                    blockers[i] -= (first[i] & first[*best]).any();
+                }
+            }
+        }
+
+        std::span<std::size_t const> Candidates(lrstate_id_t state) const
+        {
+            return std::span(this->candidates_).subspan(this->candidate_offsets_[state], this->candidate_offsets_[state + 1] - this->candidate_offsets_[state]);
+        }
+
+        /**
+         * Detects operator-precedence subgrammars, i.e. states reached by shifting the operator of a binary rule
+         * `N -> N op N`. Conflicts between such rules have already been resolved into the ACTION table, which the
+         * fast path consults, so it always makes the same decisions as the automaton.
+         * @param states
+         */
+        void FindOperatorStates(std::vector<LRState<G>> const &states, std::map<ProductionRule<G> const*, std::size_t> const &reduction_ids)
+        {
+            this->operator_states_.assign(states.size(), {});
+
+            for(lrstate_id_t i = 0; i < states.size(); i++)
+            {
+                if(states[i].kernel_items.size() != 1) continue;
+
+                auto const &item = states[i].kernel_items[0];
+                auto const &sequence = item.rule->sequence_;
+
+                if(item.position != 2 || sequence.size() != 3) continue;
+
+                Symbol<G> non_terminal = item.rule->non_terminal_;
+                if(sequence[0] != non_terminal || sequence[2] != non_terminal) continue;
+                if(!std::holds_alternative<Terminal<G>*>(sequence[1])) continue;
+
+                this->operator_states_[i] = {
+                    .rule = item.rule,
+                    .reduction = reduction_ids.at(item.rule),
+                    .after_operand = this->goto_[i][item.rule->non_terminal_],
+                };
+            }
+        }
+
+        /**
+         * Reports an unexpected (unlexable) token, or the ill-formed UTF-8 that stopped the scanner. If tokens are
+         * being recorded, the rest of the input is tokenized permissively first.
+         * @param tokenizer
+         * @return
+         */
+        template<typename Input>
+        Error UnexpectedToken(Input &tokenizer)
+        {
+            if(tokenizer.tokens && !tokenizer.InvalidInput())
+            {
+                while(true)
+                {
+                    std::optional<Token<G>> lookahead = tokenizer.Peek(0, true);
+                    if(!lookahead)
+                    {
+                        if(tokenizer.InvalidInput()) break;
+                        continue;
+                    }
+                    if(lookahead->terminal == this->grammar_.EOS.get())
+                    {
+                        break;
+                    }
+                    tokenizer.Consume(*lookahead);
+                }
+            }
+
+            auto invalid = tokenizer.InvalidInput();
+            if(invalid)
+            {
+                return *invalid;
+            }
+
+            return Error{"Unexpected Token!"};
+        }
+
+        /**
+         * @return `scanned`, a lookahead already scanned at the current position in another state, if `state` has an
+         * action for its terminal, otherwise a lookahead scanned in `state`.
+         */
+        template<typename Tables, typename Input>
+        std::optional<Token<G>> Lookahead(Tables const &tables, Input &tokenizer, lrstate_id_t state, std::optional<Token<G>> &scanned)
+        {
+            std::optional<Token<G>> lookahead = std::exchange(scanned, std::nullopt);
+            if(lookahead && tables.Action(state, tokenizer.column).type != LRActionType::kError)
+            {
+                return lookahead;
+            }
+
+            return tokenizer.Peek(state);
+        }
+
+        /**
+         * Called once the right operand of the innermost frame's last operator has been reduced. Reduces pending
+         * operators as long as the ACTION table says so, then either shifts the next operator of the chain or closes
+         * the frame by pushing its result back onto the parse stack. Anything else (errors, postfix operators, ...)
+         * is left to the automaton by materializing the frame.
+         * @param scanned Lookahead at the current position, if already scanned. Receives the lookahead left
+         * unconsumed when the frame closes, so that the automaton does not scan it again.
+         */
+        template<typename Tables, typename Stack, typename Input>
+        void ResolveOperators(Tables const &tables, Input &tokenizer, Stack &parse_stack, std::vector<OperatorFrame> &frames, std::vector<typename G::ValueType> &operands, std::vector<PendingOperator> &operators, std::optional<Token<G>> &scanned)
+        {
+            OperatorFrame &frame = frames.back();
+
+            std::optional<Token<G>> lookahead = this->Lookahead(tables, tokenizer, this->operator_states_[operators.back().state].after_operand, scanned);
+
+            while(lookahead && operators.size() > frame.operator_base)
+            {
+                OperatorState const &top = this->operator_states_[operators.back().state];
+                this->Record(top.after_operand, tokenizer.column);
+                LRAction<G> action = tables.Action(top.after_operand, tokenizer.column);
+
+                if(action.type == LRActionType::kReduce && action.reduction == top.reduction && this->Enabled(top.reduction, tokenizer.features))
+                {
+                    BUFFALO_PROBE(reduce, top.after_operand, top.reduction, 3);
+
+                    std::vector<typename G::ValueType> args(3);
+                    args[2] = std::move(operands.back());
+                    operands.pop_back();
+                    args[1] = std::move(operators.back().value);
+                    operators.pop_back();
+                    args[0] = std::move(operands.back());
+
+                    std::optional<typename G::ValueType> value = top.rule->Transduce(args);
+                    operands.back() = value ? std::move(*value) : typename G::ValueType{};
+                    continue;
+                }
+
+                if(action.type == LRActionType::kShift && this->operator_states_[action.state].rule)
+                {
+                    BUFFALO_PROBE(shift, top.after_operand, tokenizer.column, action.state);
+
+                    std::optional<typename G::ValueType> value = lookahead->terminal->Reason(*lookahead);
+                    operators.push_back({
+                        .state = action.state,
+                        .value = value ? std::move(*value) : typename G::ValueType{},
+                    });
+
+                    parse_stack.Push(action.state, std::nullopt);
+                    tokenizer.Consume(*lookahead);
+                    return;
+                }
+
+                break;
+            }
+
+            if(operators.size() == frame.operator_base)
+            {
+                parse_stack.Push(frame.state, std::move(operands.back()));
+            }
+            else
+            {
+                // Rebuild the stack the automaton would have had: state, (operator, after_operand)...
+                parse_stack.Push(frame.state, std::move(operands[frame.operand_base]));
+                for(std::size_t i = frame.operator_base; i < operators.size(); i++)
+                {
+                    parse_stack.Push(operators[i].state, std::move(operators[i].value));
+                    parse_stack.Push(this->operator_states_[operators[i].state].after_operand, std::move(operands[frame.operand_base + 1 + i - frame.operator_base]));
+                }
+            }
+
+            operands.resize(frame.operand_base);
+            operators.resize(frame.operator_base);
+            frames.pop_back();
+
+            scanned = std::move(lookahead);
+        }
+
+        /**
+         * @return Whether a reduction belongs to the dialect given by `features`.
+         */
+        bool Enabled(std::size_t reduction, FeatureMask features) const
+        {
+            return this->reductions_[reduction].features & features;
+        }
+
+        /**
+         * Performs a REDUCE action, handing the result to the operator fast path if it completes the right operand
+         * of the innermost frame.
+         * @param scanned Lookahead at the current position, if already scanned. Only kept for the automaton if the
+         * fast path hands it back, see ResolveOperators.
+         */
+        template<typename Tables, typename Stack, typename Input>
+        void Reduce(Tables const &tables, std::size_t reduction_id, Input &tokenizer, Stack &parse_stack, std::vector<OperatorFrame> &frames, std::vector<typename G::ValueType> &operands, std::vector<PendingOperator> &operators, std::optional<Token<G>> &scanned)
+        {
+            LRReduction<G> const &reduction = this->reductions_[reduction_id];
+            std::vector<typename G::ValueType> args(reduction.length);
+
+            BUFFALO_PROBE(reduce, parse_stack.TopState(), reduction_id, reduction.length);
+
+            if constexpr(Stack::kSyntaxTree)
+            {
+                parse_stack.Reduce(reduction.length, this->tree_nonterminals_[reduction.non_terminal], this->tree_rules_[reduction_id]);
+            }
+
+            for(int i = reduction.length - 1; i >= 0; i--)
+            {
+                args[i] = parse_stack.Pop();
+            }
+
+            std::optional<typename G::ValueType> value = reduction.rule->Transduce(args);
+
+            if constexpr(Stack::kEarlyStop)
+            {
+                if(!value)
+                {
+                    value.emplace();
+                }
+
+                if(parse_stack.stop(static_cast<NonTerminal<G> const &>(*reduction.rule->non_terminal_), static_cast<typename G::ValueType const &>(*value)))
+                {
+                    parse_stack.result = std::move(value);
+                    return;
+                }
+            }
+
+            if constexpr(Stack::kOperatorPrecedence)
+            {
+                // Right operand of the innermost frame's operator is complete.
+                if(!frames.empty() && frames.back().marker_depth == parse_stack.Size() && this->operator_states_[operators.back().state].rule->non_terminal_ == reduction.rule->non_terminal_)
+                {
+                    parse_stack.Pop();
+                    operands.push_back(value ? std::move(*value) : typename G::ValueType{});
+
+                    this->ResolveOperators(tables, tokenizer, parse_stack, frames, operands, operators, scanned);
+                    return;
+                }
+            }
+
+            scanned.reset();
+            parse_stack.Push(tables.Goto(parse_stack.TopState(), reduction.non_terminal), std::move(value));
+        }
+
+        /**
+         * Numbers symbols for FlatTrees by a breadth-first walk of the rules from the root, in definition order.
+         * Unlike ACTION and GOTO columns, which follow symbol addresses, these ids and the fingerprint of the rules
+         * they describe are the same in every program defining the grammar.
+         */
+        void NumberTreeSymbols()
+        {
+            std::map<Terminal<G>*, std::uint32_t> terminal_ids;
+            std::map<NonTerminal<G>*, std::uint32_t> nonterminal_ids = { { &this->grammar_.root, 0 } };
+            std::vector<NonTerminal<G>*> order = { &this->grammar_.root };
+
+            std::uint64_t fingerprint = FlatTree::Hash({});
+            auto mix = [&](std::uint64_t value)
+            {
+                fingerprint = (fingerprint ^ value) * 0x100000001b3;
+            };
+
+            for(std::size_t i = 0; i < order.size(); i++)
+            {
+                auto const &rules = this->grammar_.rules_.at(order[i]);
+                mix(rules.size());
+
+                for(auto const &rule : rules)
+                {
+                    mix(rule.sequence_.size());
+
+                    for(auto const &symbol : rule.sequence_)
+                    {
+                        std::visit(overload{
+                            [&](Terminal<G> *terminal)
+                            {
+                                auto [it, inserted] = terminal_ids.try_emplace(terminal, terminal_ids.size());
+                                mix(2 * it->second);
+                            },
+                            [&](NonTerminal<G> *nonterminal)
+                            {
+                                auto [it, inserted] = nonterminal_ids.try_emplace(nonterminal, nonterminal_ids.size());
+                                if(inserted)
+                                {
+                                    order.push_back(nonterminal);
+                                }
+                                mix(2 * it->second + 1);
+                            }
+                        }, symbol);
+                    }
+                }
+            }
+
+            // EOS and terminals only used by removed rules, which never appear in trees.
+            terminal_ids.try_emplace(this->grammar_.EOS.get(), terminal_ids.size());
+
+            this->tree_terminals_.clear();
+            for(auto terminal : this->terminals_)
+            {
+                auto [it, inserted] = terminal_ids.try_emplace(terminal, terminal_ids.size());
+                this->tree_terminals_.push_back(it->second);
+            }
+
+            this->tree_nonterminals_.assign(this->nonterminal_columns_.size(), FlatTree::kLeaf);
+            for(auto const &[nonterminal, column] : this->nonterminal_columns_)
+            {
+                auto it = nonterminal_ids.find(nonterminal);
+                if(it != nonterminal_ids.end())
+                {
+                    this->tree_nonterminals_[column] = it->second;
+                }
+            }
+
+            this->tree_rules_.clear();
+            for(auto const &reduction : this->reductions_)
+            {
+                this->tree_rules_.push_back(static_cast<std::uint32_t>(reduction.rule - this->grammar_.rules_.at(reduction.rule->non_terminal_).data()));
+            }
+
+            this->tree_fingerprint_ = fingerprint;
+        }
+
+        void Record(lrstate_id_t state, std::size_t terminal_column)
+        {
+            if(this->profile_)
+            {
+                this->profile_->counts_[this->profile_states_[state] * this->profile_->terminals_ + this->tree_terminals_[terminal_column]]++;
+            }
+        }
+
+        /**
+         * Runs the LR automaton over `tokenizer` (see Run), between the parse__start and parse__done probes.
+         */
+        template<typename Tables, typename Stack, typename Input>
+        std::expected<DriveResult, Error> Drive(Tables const &tables, Input &tokenizer, Stack &parse_stack, std::size_t suspend_at = std::string_view::npos)
+        {
+            BUFFALO_PROBE(parse__start, tokenizer.Position());
+
+            auto result = this->Run(tables, tokenizer, parse_stack, suspend_at);
+
+            BUFFALO_PROBE(parse__done, result ? static_cast<int>(*result) : -1, tokenizer.Position());
+            return result;
+        }
+
+        /**
+         * Runs the LR automaton over `tokenizer` until the input is accepted or the next token would reach
+         * `suspend_at`. On acceptance, the result is the top value of `parse_stack`.
+         * @tparam Tables PackedTables
+         * @tparam Stack ParseStack or SharedParseStack
+         * @param tables
+         * @param tokenizer
+         * @param parse_stack
+         * @param suspend_at Input offset at which to suspend the parse.
+         * @return
+         */
+        template<typename Tables, typename Stack, typename Input>
+        std::expected<DriveResult, Error> Run(Tables const &tables, Input &tokenizer, Stack &parse_stack, std::size_t suspend_at)
+        {
+            std::vector<OperatorFrame> frames;
+            std::vector<typename G::ValueType> operands;
+            std::vector<PendingOperator> operators;
+
+            /// Lookahead the operator fast path scanned but did not consume.
+            std::optional<Token<G>> scanned;
+
+            while(true)
+            {
+                lrstate_id_t state = parse_stack.TopState();
+
+                // Reductions that do not depend on the lookahead. Not applied to prefixes, which stop right before
+                // the first token that might still change.
+                if(Stack::kDefaultReductions && this->default_reductions_[state] != std::string_view::npos && suspend_at == std::string_view::npos && this->Enabled(this->default_reductions_[state], tokenizer.features))
+                {
+                    if constexpr(Stack::kTrace)
+                    {
+                        parse_stack.Step(this->TraceStep(state, std::nullopt, { .type = LRActionType::kReduce, .reduction = this->default_reductions_[state] }), nullptr);
+                    }
+
+                    this->Reduce(tables, this->default_reductions_[state], tokenizer, parse_stack, frames, operands, operators, scanned);
+
+                    if constexpr(Stack::kEarlyStop)
+                    {
+                        if(parse_stack.result)
+                        {
+                            return DriveResult::kStop;
+                        }
+                    }
+
+                    continue;
+                }
+
+                std::optional<Token<G>> lookahead = this->Lookahead(tables, tokenizer, state, scanned);
+                if(tokenizer.Position() >= suspend_at || (lookahead && lookahead->location.end >= suspend_at))
+                {
+                    return DriveResult::kSuspend;
+                }
+
+                if(!lookahead)
+                {
+                    return std::unexpected(this->UnexpectedToken(tokenizer));
+                }
+
+                this->Record(state, tokenizer.column);
+                LRAction<G> action = tables.Action(state, tokenizer.column);
+
+                if constexpr(Stack::kTrace)
+                {
+                    parse_stack.Step(this->TraceStep(state, tokenizer.column, action), &*lookahead);
+                }
+
+                switch(action.type)
+                {
+                    case LRActionType::kAccept:
+                    {
+                        return DriveResult::kAccept;
+                    }
+
+                    case LRActionType::kShift:
+                    {
+                        BUFFALO_PROBE(shift, state, tokenizer.column, action.state);
+
+                        std::optional<typename G::ValueType> value = lookahead->terminal->Reason(*lookahead);
+
+                        if constexpr(Stack::kOperatorPrecedence)
+                        {
+                            OperatorState const &operator_state = this->operator_states_[action.state];
+                            if(operator_state.rule)
+                            {
+                                // Open a new frame, taking the left operand off the parse stack.
+                                operands.push_back(parse_stack.Pop());
+                                operators.push_back({
+                                    .state = action.state,
+                                    .value = value ? std::move(*value) : typename G::ValueType{},
+                                });
+                                frames.push_back({
+                                    .state = state,
+                                    .marker_depth = parse_stack.Size() + 1,
+                                    .operand_base = operands.size() - 1,
+                                    .operator_base = operators.size() - 1,
+                                });
+
+                                parse_stack.Push(action.state, std::nullopt);
+                                tokenizer.Consume(*lookahead);
+                                break;
+                            }
+                        }
+
+                        if constexpr(Stack::kSyntaxTree)
+                        {
+                            parse_stack.Shift(*lookahead, this->tree_terminals_[tokenizer.column]);
+                        }
+
+                        parse_stack.Push(action.state, std::move(value));
+                        tokenizer.Consume(*lookahead);
+                        break;
+                    }
+
+                    case LRActionType::kReduce:
+                    {
+                        if(!this->Enabled(action.reduction, tokenizer.features))
+                        {
+                            return std::unexpected(ParsingError(lookahead->location, "Unexpected Token"));
+                        }
+
+                        this->Reduce(tables, action.reduction, tokenizer, parse_stack, frames, operands, operators, lookahead);
+                        scanned = std::move(lookahead);
+
+                        if constexpr(Stack::kEarlyStop)
+                        {
+                            if(parse_stack.result)
+                            {
+                                return DriveResult::kStop;
+                            }
+                        }
+
+                        break;
+                    }
+
+                    default:
+                    {
+                        return std::unexpected(ParsingError(lookahead->location, "Unexpected Token"));
+                    }
+                }
+            }
+        }
+
+    protected:
+        /**
+         * Simply constructs the parser's grammar and empty tables. The backend's BuildParsingTables and then
+         * LRParser<G>::Finalize MUST be called before attempting to parse.
+         * @param start
+         */
+        LRParser(NonTerminal<G> &start) : grammar_(start) {}
+
+        /**
+         * Combines the DFAs of the terminals that have one into `scanner_`, with the mask of each state's candidates.
+         * If they were all compiled through the same TerminalRegistry, the registry's scanner is used, shared with the
+         * parsers of other grammars. With fewer than two such terminals, or if the product is too large, terminals
+         * are scanned one at a time.
+         */
+        void CombineScanners()
+        {
+            this->scanner_.reset();
+            this->scanner_dfas_.assign(this->terminals_.size(), -1);
+            this->scanner_masks_.clear();
+
+            std::vector<std::shared_ptr<DFA const>> automata;
+            std::optional<TerminalRegistry const *> registry;
+            for(std::size_t column = 0; column < this->terminals_.size(); column++)
+            {
+                auto automaton = this->terminals_[column]->Automaton();
+                if(automaton)
+                {
+                    this->scanner_dfas_[column] = static_cast<std::int32_t>(automata.size());
+                    automata.push_back(std::move(automaton));
+
+                    auto [terminal_registry, id] = this->terminals_[column]->Registration();
+                    registry = !registry || *registry == terminal_registry ? terminal_registry : nullptr;
+                }
+            }
+
+            if(automata.size() < 2)
+            {
+                return;
+            }
+
+            if(*registry)
+            {
+                auto shared = (*registry)->Combined();
+                if(shared)
+                {
+                    this->scanner_ = std::move(*shared);
+                    for(std::size_t column = 0; column < this->terminals_.size(); column++)
+                    {
+                        if(this->scanner_dfas_[column] >= 0)
+                        {
+                            this->scanner_dfas_[column] = static_cast<std::int32_t>(this->terminals_[column]->Registration().second);
+                        }
+                    }
+                }
+            }
+
+            if(!this->scanner_)
+            {
+                std::vector<DFA const *> dfas;
+                for(auto const &automaton : automata)
+                {
+                    dfas.push_back(automaton.get());
+                }
+
+                auto combined = CombinedDFA::Combine(dfas);
+                if(!combined)
+                {
+                    return;
+                }
+
+                this->scanner_ = std::make_shared<CombinedDFA const>(std::move(*combined));
+            }
+
+            std::size_t words = this->scanner_->Words();
+            this->scanner_masks_.assign((this->state_count_ + 1) * words, 0);
+            auto add = [&](std::size_t state, std::size_t column)
+            {
+                std::int32_t dfa = this->scanner_dfas_[column];
+                if(dfa >= 0)
+                {
+                    this->scanner_masks_[state * words + dfa / 64] |= std::uint64_t(1) << (dfa % 64);
+                }
+            };
+
+            for(lrstate_id_t state = 0; state < this->state_count_; state++)
+            {
+                for(std::size_t column : this->Candidates(state))
+                {
+                    add(state, column);
+                }
+            }
+
+            for(std::size_t column = 0; column < this->terminals_.size(); column++)
+            {
+                add(this->state_count_, column);
+            }
         }
 
         /**
-         * This is very slow and needs to be remedied.
-         * @param other
+         * Finalizes the tables filled by a backend and fills the build report.
+         * @param options
          * @return
          */
-        bool operator==(LRState const &other) const
+        std::optional<Error> Finalize(BuildOptions const &options)
         {
-            if(this->kernel_items.size() != other.kernel_items.size()) return false;
+            for(auto terminal : this->grammar_.terminals_)
+            {
+                auto error = terminal->Compile();
+                if(error)
+                {
+                    return error;
+                }
+            }
 
-            for(int i = 0; i < this->kernel_items.size(); i++)
+            this->terminals_.assign(this->grammar_.terminals_.begin(), this->grammar_.terminals_.end());
+            this->NumberTreeSymbols();
+
+            auto error = this->FinalizeTables(options);
+            if(error)
             {
-                if(this->kernel_items[i] != other.kernel_items[i]) return false;
+                return error;
             }
 
-            return true;
+            this->CombineScanners();
+            this->validate_utf8_ = options.validate_utf8;
+
+            this->report_.right_recursions = this->grammar_.FindRightRecursions();
+            this->report_.removed_nonterminals = this->grammar_.removed_;
+            this->report_.inlined_nonterminals = this->grammar_.inlined_;
+
+            return std::nullopt;
+        }
+
+    public:
+        Grammar<G> const &GetGrammar() const
+        {
+            return this->grammar_;
+        }
+
+        BuildReport<G> const &GetBuildReport() const
+        {
+            return this->report_;
+        }
+
+        /**
+         * @return Scanner of the terminals matched by a DFA, or nullptr if they are scanned one at a time.
+         */
+        std::shared_ptr<CombinedDFA const> GetScanner() const
+        {
+            return this->scanner_;
         }
 
-        LRState(NonTerminal<G> const *start)
+        /**
+         * Starts counting lookaheads into `profile` on every parse (not thread-safe), or stops if nullptr. An empty
+         * profile is sized for this parser, otherwise it must have been recorded with the same grammar.
+         * @param profile
+         * @return
+         */
+        std::optional<Error> Instrument(ParseProfile *profile)
         {
-            for(auto const &rule : start->rules_)
+            if(profile && profile->counts_.empty())
             {
-                this->kernel_items.emplace_back(&rule);
+                profile->fingerprint_ = this->profile_fingerprint_;
+                profile->states_ = this->state_count_;
+                profile->terminals_ = this->terminals_.size();
+                profile->counts_.assign(profile->states_ * profile->terminals_, 0);
             }
-        }
 
-        LRState() = default;
-    };
+            if(profile && !this->Matches(*profile))
+            {
+                return Error{"Profile does not match grammar"};
+            }
 
-    /**
-     * LR ACTION TYPE
-     */
-    enum class LRActionType
-    {
-        kError,
-        kAccept,
-        kShift,
-        kReduce,
-    };
+            this->profile_ = profile;
+            return std::nullopt;
+        }
 
-    /**
-     * LR ACTION
-     * @tparam G
-     */
-    template<IGrammar G>
-    struct LRAction
-    {
-        LRActionType type = LRActionType::kError;
+        std::expected<typename G::ValueType, Error> Parse(std::string_view input, std::vector<Token<G>> *tokens = nullptr) override
+        {
+            return this->Parse(input, kAllFeatures, tokens);
+        }
 
-        union
+        /**
+         * Parses `input` in the dialect given by `features`: terminals and rules without any of its features are
+         * disabled. Conflicts were resolved over the union of all dialects when the parser was built.
+         * @param input
+         * @param features
+         * @param tokens
+         * @return
+         */
+        std::expected<typename G::ValueType, Error> Parse(std::string_view input, FeatureMask features, std::vector<Token<G>> *tokens = nullptr)
         {
-            lrstate_id_t state;
-            ProductionRule<G> const *rule;
-        };
-    };
+            Tokenizer tokenizer(*this, input, tokens);
+            tokenizer.features = features;
 
-    /**
-     * PARSER
-     * @tparam G
-     */
-    template<IGrammar G>
-    class Parser
-    {
-    public:
-        virtual std::expected<typename G::ValueType, Error> Parse(std::string_view input,  std::vector<Token<G>> *tokens) = 0;
+            if(this->validate_utf8_)
+            {
+                tokenizer.ValidateUTF8();
+            }
 
-        virtual ~Parser() = default;
-    };
+            return std::visit([&]<typename Tables>(Tables const &tables) -> std::expected<typename G::ValueType, Error>
+            {
+                ParseStack<typename Tables::StateType> parse_stack;
 
-    /**
-     * SLR PARSER
-     * @tparam G
-     */
-    template<IGrammar G>
-    class SLRParser final : public Parser<G>
-    {
-        Grammar<G> grammar_;
+                auto result = this->Drive(tables, tokenizer, parse_stack);
+                if(!result)
+                {
+                    return std::unexpected(result.error());
+                }
 
-        std::map<lrstate_id_t, std::map<Terminal<G>*, LRAction<G>>> action_;
-        std::map<lrstate_id_t, std::map<NonTerminal<G>*, lrstate_id_t>> goto_;
+                return std::move(parse_stack.TopValue());
+            }, this->tables_);
+        }
 
-        struct ParseStackItem
+        /**
+         * Parses `input` until `stop(non_terminal, value)` holds for a reduction (e.g. once K top-level items have
+         * been parsed), instead of running to the end of the input. The reduction `stop` holds for only happens once the token
+         * following the reduced symbol has been scanned (default reductions of profiled builds are not applied here),
+         * so an invalid token right after the stop point fails the parse. If `stop` never holds, the whole input is
+         * parsed.
+         * @tparam Stop
+         * @param input
+         * @param stop
+         * @param features Dialect to parse, see Parse.
+         * @return Value of the reduction `stop` held for, or of the whole input.
+         */
+        template<std::predicate<NonTerminal<G> const &, typename G::ValueType const &> Stop>
+        std::expected<PartialParse<G>, Error> ParseUntil(std::string_view input, Stop stop, FeatureMask features = kAllFeatures)
         {
-            lrstate_id_t state;
-            typename G::ValueType value;
+            Tokenizer tokenizer(*this, input);
+            tokenizer.features = features;
 
-            ParseStackItem(lrstate_id_t state) : state(state) {}
-            ParseStackItem(lrstate_id_t state, typename G::ValueType value) : state(state), value(std::move(value)) {}
-        };
+            if(this->validate_utf8_)
+            {
+                tokenizer.ValidateUTF8();
+            }
 
-        struct Tokenizer
+            return std::visit([&]<typename Tables>(Tables const &tables) -> std::expected<PartialParse<G>, Error>
+            {
+                StoppingParseStack<typename Tables::StateType, Stop> parse_stack(stop);
+
+                auto result = this->Drive(tables, tokenizer, parse_stack);
+                if(!result)
+                {
+                    return std::unexpected(result.error());
+                }
+
+                if(*result == DriveResult::kStop)
+                {
+                    return PartialParse<G>{ std::move(*parse_stack.result), tokenizer.token_end, true };
+                }
+
+                return PartialParse<G>{ std::move(parse_stack.TopValue()), tokenizer.token_end, false };
+            }, this->tables_);
+        }
+
+        /**
+         * Parses `input` until `target` is first reduced, e.g. to check whether the input starts with a valid
+         * construct.
+         * @param input
+         * @param target NonTerminal of the grammar that was not removed or inlined when building the parser.
+         * @param features
+         * @return
+         */
+        std::expected<PartialParse<G>, Error> ParseUntil(std::string_view input, NonTerminal<G> &target, FeatureMask features = kAllFeatures)
         {
-            SLRParser<G> const &parser;
-            std::string_view input;
-            std::size_t index = 0;
+            if(!this->nonterminal_columns_.contains(&target))
+            {
+                return std::unexpected(Error{"NonTerminal is not part of the parsing tables"});
+            }
 
-            std::vector<Token<G>> *tokens;
+            return this->ParseUntil(input, [&target](NonTerminal<G> const &non_terminal, typename G::ValueType const &)
+            {
+                return &non_terminal == &target;
+            }, features);
+        }
 
-            std::optional<Token<G>> Peek(lrstate_id_t state = 0, bool permissive = false)
+        /**
+         * Parses `input` like Parse, appending a ParseTrace of every step of the automaton to `trace`. The operator
+         * fast path is not used, so that replays interpret the same steps.
+         * @param input
+         * @param trace Receives the trace. If null, `input` is parsed the same way without recording, which gives
+         * the baseline for Replay: the same parse loop with the scanner.
+         * @param features Dialect to parse, see Parse. Replays must be given the same one.
+         * @return
+         */
+        std::expected<typename G::ValueType, Error> ParseTraced(std::string_view input, std::vector<std::byte> *trace, FeatureMask features = kAllFeatures)
+        {
+            Tokenizer tokenizer(*this, input);
+            tokenizer.features = features;
+
+            if(this->validate_utf8_)
             {
-                while(this->index < this->input.size() && std::isspace(this->input[this->index])) this->index++;
+                tokenizer.ValidateUTF8();
+            }
 
-                // IMPORTANT: No need to check for EOF, because it is checked for by special EOF terminal!
+            if(trace)
+            {
+                ParseTrace::WriteHeader(*trace, {
+                    .grammar = this->profile_fingerprint_,
+                    .states = this->state_count_,
+                    .columns = this->terminals_.size(),
+                    .input_size = input.size(),
+                    .input_hash = FlatTree::Hash(input),
+                });
+            }
 
-                if(permissive)
+            return std::visit([&]<typename Tables>(Tables const &tables) -> std::expected<typename G::ValueType, Error>
+            {
+                auto run = [&](auto &parse_stack) -> std::expected<typename G::ValueType, Error>
                 {
-                    for(auto terminal : this->parser.grammar_.terminals_)
+                    auto result = this->Drive(tables, tokenizer, parse_stack);
+                    if(!result)
                     {
-                        auto token = terminal->Lex(this->input.substr(this->index));
-                        if(token)
-                        {
-                            token->location.begin += this->index;
-                            token->location.end += this->index;
+                        return std::unexpected(result.error());
+                    }
+
+                    return std::move(parse_stack.TopValue());
+                };
+
+                if(trace)
+                {
+                    TraceParseStack<typename Tables::StateType, true> parse_stack;
+                    parse_stack.trace = trace;
+                    return run(parse_stack);
+                }
+
+                TraceParseStack<typename Tables::StateType, false> parse_stack;
+                return run(parse_stack);
+            }, this->tables_);
+        }
+
+        std::expected<typename G::ValueType, Error> ParseTraced(std::string_view input, std::vector<std::byte> &trace, FeatureMask features = kAllFeatures)
+        {
+            return this->ParseTraced(input, &trace, features);
+        }
+
+        /**
+         * Replays a trace recorded by ParseTraced on the same input, with a parser built from the same grammar and
+         * options. The tables are interpreted and reasoners and semantic actions run as in the recorded parse, but
+         * lookaheads are read from the trace instead of being scanned, which isolates the cost of the parse loop
+         * from that of the scanner.
+         * @param input
+         * @param trace
+         * @param features Dialect the trace was recorded in.
+         * @return
+         */
+        std::expected<typename G::ValueType, Error> Replay(std::string_view input, std::span<std::byte const> trace, FeatureMask features = kAllFeatures)
+        {
+            std::size_t offset = 0;
+            auto header = ParseTrace::ReadHeader(trace, offset);
+            if(!header)
+            {
+                return std::unexpected(header.error());
+            }
+
+            if(header->grammar != this->profile_fingerprint_ || header->states != this->state_count_ || header->columns != this->terminals_.size() || header->input_size != input.size() || header->input_hash != FlatTree::Hash(input))
+            {
+                return std::unexpected(Error{"Trace does not match the parser or input"});
+            }
+
+            TraceTokenizer tokenizer(*this, input, trace, offset);
+            tokenizer.features = features;
+
+            return std::visit([&]<typename Tables>(Tables const &tables) -> std::expected<typename G::ValueType, Error>
+            {
+                TraceParseStack<typename Tables::StateType, false> parse_stack;
+
+                auto result = this->Drive(tables, tokenizer, parse_stack);
+                if(!result)
+                {
+                    return std::unexpected(tokenizer.mismatch ? Error{"Trace does not match the parser or input"} : result.error());
+                }
+
+                return std::move(parse_stack.TopValue());
+            }, this->tables_);
+        }
+
+        /**
+         * Parses input split into segments (e.g. the chunks of a rope or an iovec chain) without concatenating it.
+         * Tokens are scanned in place inside segments; only those near or across a segment boundary are copied into
+         * a side buffer first. Token locations are offsets into the whole input, and the `raw` view of a copied token
+         * is only valid during its reasoner and semantic action calls. Near a boundary, terminals see 64 bytes
+         * (Tokenizer::kStraddleWindow) past the end of their match, so tokens are the same as in the concatenated
+         * input unless a terminal needs more lookahead than that to decide on its match.
+         * @param segments
+         * @param features Dialect to parse, see Parse.
+         * @return
+         */
+        std::expected<typename G::ValueType, Error> Parse(std::span<std::string_view const> segments, FeatureMask features = kAllFeatures)
+        {
+            Tokenizer tokenizer(*this, segments);
+            tokenizer.features = features;
+
+            if(this->validate_utf8_)
+            {
+                tokenizer.ValidateUTF8();
+            }
+
+            return std::visit([&]<typename Tables>(Tables const &tables) -> std::expected<typename G::ValueType, Error>
+            {
+                ParseStack<typename Tables::StateType> parse_stack;
+
+                auto result = this->Drive(tables, tokenizer, parse_stack);
+                if(!result)
+                {
+                    return std::unexpected(result.error());
+                }
+
+                return std::move(parse_stack.TopValue());
+            }, this->tables_);
+        }
+
+        /**
+         * Parses `input` and serializes its syntax tree and tokens. Semantic actions are run as usual.
+         * @param input
+         * @param features Dialect to parse, see Parse.
+         * @return FlatTree buffer, see FlatTree::View.
+         */
+        std::expected<std::vector<std::byte>, Error> ParseFlatTree(std::string_view input, FeatureMask features = kAllFeatures)
+        {
+            if(input.size() >= std::numeric_limits<std::uint32_t>::max())
+            {
+                return std::unexpected(Error{"Input too large for a flat tree"});
+            }
+
+            Tokenizer tokenizer(*this, input);
+            tokenizer.features = features;
+
+            if(this->validate_utf8_)
+            {
+                tokenizer.ValidateUTF8();
+            }
+
+            return std::visit([&]<typename Tables>(Tables const &tables) -> std::expected<std::vector<std::byte>, Error>
+            {
+                TreeParseStack<typename Tables::StateType> parse_stack;
+
+                auto result = this->Drive(tables, tokenizer, parse_stack);
+                if(!result)
+                {
+                    return std::unexpected(result.error());
+                }
+
+                return FlatTree::Write(this->tree_fingerprint_, input, parse_stack.node_stack.back(), parse_stack.nodes, parse_stack.tokens, parse_stack.children);
+            }, this->tables_);
+        }
+
+        /**
+         * @return Id of `terminal` in FlatTree tokens, if it is part of the grammar.
+         */
+        std::optional<std::uint32_t> TerminalId(Terminal<G> &terminal) const
+        {
+            auto it = std::ranges::find(this->terminals_, &terminal);
+            if(it == this->terminals_.end())
+            {
+                return std::nullopt;
+            }
+
+            return this->tree_terminals_[std::distance(this->terminals_.begin(), it)];
+        }
+
+        /**
+         * @return Id of `non_terminal` in FlatTree nodes, if it is part of the grammar after optimization.
+         */
+        std::optional<std::uint32_t> NonTerminalId(NonTerminal<G> &non_terminal) const
+        {
+            auto it = this->nonterminal_columns_.find(&non_terminal);
+            if(it == this->nonterminal_columns_.end() || this->tree_nonterminals_[it->second] == FlatTree::kLeaf)
+            {
+                return std::nullopt;
+            }
+
+            return this->tree_nonterminals_[it->second];
+        }
+
+        /**
+         * @return Fingerprint of the grammar stored in FlatTrees, to check that a tree uses this parser's symbol ids.
+         */
+        std::uint64_t TreeFingerprint() const
+        {
+            return this->tree_fingerprint_;
+        }
+
+        /**
+         * Parses `input` starting from a checkpoint previously returned by LRParser<G>::ParsePrefix.
+         * `input` must begin with the prefix the checkpoint was created from.
+         * @param input
+         * @param checkpoint
+         * @param tokens Receives tokens consumed after the checkpoint.
+         * @param features Dialect to parse, see Parse. Must be the one of the checkpoint's prefix.
+         * @return
+         */
+        std::expected<typename G::ValueType, Error> Parse(std::string_view input, ParseCheckpoint<G> const &checkpoint, std::vector<Token<G>> *tokens = nullptr, FeatureMask features = kAllFeatures)
+        requires std::copy_constructible<typename G::ValueType>
+        {
+            auto error = this->Resumable(input, checkpoint, features);
+            if(error)
+            {
+                return std::unexpected(*error);
+            }
+
+            Tokenizer tokenizer(*this, input, tokens);
+            tokenizer.index = checkpoint.index_;
+            tokenizer.features = features;
+
+            if(this->validate_utf8_)
+            {
+                tokenizer.ValidateUTF8();
+            }
+
+            SharedParseStack parse_stack(checkpoint.top_);
+
+            auto result = std::visit([&](auto const &tables) { return this->Drive(tables, tokenizer, parse_stack); }, this->tables_);
+            if(!result)
+            {
+                return std::unexpected(result.error());
+            }
 
-                            return token;
-                        }
-                    }
+            return parse_stack.Pop();
+        }
 
-                    // No token was matched. So we increment the index to skip this character.
-                    index++;
-                }
-                else
-                {
-                    for(auto terminal : this->parser.action_.at(state) | std::views::keys)
-                    {
-                        auto token = terminal->Lex(this->input.substr(this->index));
-                        if(token)
-                        {
-                            token->location.begin += this->index;
-                            token->location.end += this->index;
+        /**
+         * Parses as much of `prefix` as can be decided without seeing further input and returns a checkpoint that
+         * can be resumed any number of times with different continuations. A token touching the end of `prefix` is
+         * not consumed, as a continuation could still extend it.
+         * @param prefix
+         * @param tokens Receives tokens consumed before the checkpoint.
+         * @param features Dialect to parse, see Parse.
+         * @return
+         */
+        std::expected<ParseCheckpoint<G>, Error> ParsePrefix(std::string_view prefix, std::vector<Token<G>> *tokens = nullptr, FeatureMask features = kAllFeatures)
+        requires std::copy_constructible<typename G::ValueType>
+        {
+            return this->ParsePrefix(prefix, ParseCheckpoint<G>(std::make_shared<typename ParseCheckpoint<G>::Node>(0), 0, this->state_fingerprint_, features), tokens, features);
+        }
 
-                            return token;
-                        }
-                    }
-                }
+        /**
+         * Continues a suspended parse over a longer prefix.
+         * @param prefix Must begin with the prefix `checkpoint` was created from.
+         * @param checkpoint
+         * @param tokens
+         * @param features
+         * @return
+         */
+        std::expected<ParseCheckpoint<G>, Error> ParsePrefix(std::string_view prefix, ParseCheckpoint<G> const &checkpoint, std::vector<Token<G>> *tokens = nullptr, FeatureMask features = kAllFeatures)
+        requires std::copy_constructible<typename G::ValueType>
+        {
+            auto error = this->Resumable(prefix, checkpoint, features);
+            if(error)
+            {
+                return std::unexpected(*error);
+            }
 
-                return std::nullopt;
+            Tokenizer tokenizer(*this, prefix, tokens);
+            tokenizer.index = checkpoint.index_;
+            tokenizer.features = features;
+
+            if(this->validate_utf8_)
+            {
+                tokenizer.ValidateUTF8(true);
             }
 
-            void Consume(Token<G> const &token)
+            SharedParseStack parse_stack(checkpoint.top_);
+
+            auto result = std::visit([&](auto const &tables) { return this->Drive(tables, tokenizer, parse_stack, prefix.size()); }, this->tables_);
+            if(!result)
             {
-                this->index += token.Size();
-                if(tokens)
-                {
-                    tokens->push_back(token);
-                }
+                return std::unexpected(result.error());
             }
 
-            Tokenizer(SLRParser<G> const &parser, std::string_view input, std::vector<Token<G>> *tokens = nullptr) : parser(parser), input(input), tokens(tokens) {}
-        };
+            return ParseCheckpoint<G>(parse_stack.top, tokenizer.index, this->state_fingerprint_, features);
+        }
+
+        LRParser() = delete;
+    };
 
+    /**
+     * SLR PARSER
+     * @tparam G
+     */
+    template<IGrammar G>
+    class SLRParser final : public LRParser<G>
+    {
         /**
          * Inserts state into list if does not exist, otherwise returns the index of existing equal state.
          * @param state_list
@@ -930,11 +6666,18 @@ namespace bf
          */
         std::optional<Error> BuildParsingTables()
         {
+            if(this->grammar_.rules_.at(&this->grammar_.root).empty())
+            {
+                return GrammarDefinitionError("Unproductive start symbol");
+            }
+
+            auto reduction_ids = this->NumberSymbols();
+
             std::vector<LRState<G>> states;
 
             // Generate first state
             states.clear();
-            states.emplace_back(&this->grammar_.root);
+            states.emplace_back(this->grammar_.rules_.at(&this->grammar_.root));
 
             // Finite State Machine
             std::map<lrstate_id_t, std::map<Symbol<G>, lrstate_id_t>> fsm;
@@ -942,90 +6685,25 @@ namespace bf
             for(lrstate_id_t i = 0; i < states.size(); i++)
             {
                 // Process all transitions
-                for(auto const &[symbol, new_state] : states[i].GenerateTransitions())
+                for(auto const &[symbol, new_state] : states[i].GenerateTransitions(this->grammar_))
                 {
                     lrstate_id_t new_state_id = this->FindOrInsertLRState(states, new_state);
                     fsm[i][symbol] = new_state_id;
 
-                    // Create SHIFT/GOTO entries in parsing tables
-                    std::visit(overload{
-                        // Create ACTION
-                        [&](Terminal<G> *terminal)
-                        {
-                            this->action_[i][terminal] = {
-                                .type = LRActionType::kShift,
-                                .state = new_state_id,
-                            };
-                        },
-
-                        // Create GOTO
-                        [&](NonTerminal<G> *non_terminal)
-                        {
-                            this->goto_[i][non_terminal] = new_state_id;
-                        },
-                    }, symbol);
+                    this->AddTransition(i, symbol, new_state_id);
                 }
 
-                // Create REDUCE/ACCEPT entries in parsing tables
-                for(auto const &item : states[i].kernel_items)
+                // Create REDUCE/ACCEPT entries in parsing tables. Items of empty rules are complete in the closure.
+                for(auto const &item : states[i].GenerateClosure(this->grammar_))
                 {
                     if(item.Complete())
                     {
                         for(auto follow_terminal : this->grammar_.follow_[item.rule->non_terminal_])
                         {
-                            switch(this->action_[i][follow_terminal].type)
+                            auto error = this->AddReduction(i, follow_terminal, item.rule, reduction_ids.at(item.rule));
+                            if(error)
                             {
-                                /* SHIFT-REDUCE CONFLICT */
-                                case LRActionType::kShift:
-                                {
-                                    // Reduce due to higher precedence
-                                    if(item.rule->precedence < follow_terminal->precedence)
-                                    {
-                                        this->action_[i][follow_terminal] = {
-                                            .type = LRActionType::kReduce,
-                                            .rule = item.rule,
-                                        };
-                                        break;
-                                    }
-
-                                    // Shift due to lower precedence
-                                    if(item.rule->precedence > follow_terminal->precedence)
-                                    {
-                                        break;
-                                    }
-
-                                    // Reduce due to associativity rule
-                                    if(follow_terminal->associativity == Associativity::Left)
-                                    {
-                                        this->action_[i][follow_terminal] = {
-                                            .type = LRActionType::kReduce,
-                                            .rule = item.rule,
-                                        };
-                                        break;
-                                    }
-
-                                    // Shift due to associativity rule
-                                    if(follow_terminal->associativity == Right)
-                                    {
-                                        break;
-                                    }
-
-                                    // Unable to resolve conflict
-                                    return GrammarDefinitionError("ShiftReduce");
-                                }
-
-                                case LRActionType::kReduce:
-                                {
-                                    return GrammarDefinitionError("ReduceReduce");
-                                }
-
-                                default:
-                                {
-                                    this->action_[i][follow_terminal] = {
-                                        .type = LRActionType::kReduce,
-                                        .rule = item.rule,
-                                    };
-                                }
+                                return error;
                             }
                         }
                     }
@@ -1036,132 +6714,419 @@ namespace bf
                 .type = LRActionType::kAccept,
             };
 
+            this->state_count_ = states.size();
+            this->FindOperatorStates(states, reduction_ids);
+
             return std::nullopt;
         }
 
     protected:
-        /**
-         * Simply constructs the SLRParser's grammar and empty tables. SLRParser<G>::BuildParsingTables
-         * MUST be called before attempting to parse.
-         * @param tokenizer
-         * @param start
-         */
-        SLRParser(NonTerminal<G> &start) : grammar_(start) {}
+        SLRParser(NonTerminal<G> &start) : LRParser<G>(start) {}
 
     public:
-        Grammar<G> const &GetGrammar() const
+        static std::expected<SLRParser, Error> Build(NonTerminal<G> &start, BuildOptions const &options = {})
         {
-            return this->grammar_;
+            BUFFALO_PROBE(build__phase, "grammar");
+            SLRParser parser(start);
+
+            BUFFALO_PROBE(build__phase, "automaton");
+            auto error = parser.BuildParsingTables();
+            if(error)
+            {
+                return std::unexpected(*error);
+            }
+
+            BUFFALO_PROBE(build__phase, "finalize");
+            error = parser.Finalize(options);
+            if(error)
+            {
+                return std::unexpected(*error);
+            }
+
+            BUFFALO_PROBE(build__done, parser.state_count_);
+            return parser;
         }
 
-        std::expected<typename G::ValueType, Error> Parse(std::string_view input, std::vector<Token<G>> *tokens = nullptr) override
+        /**
+         * Construction of a parser can generate grammar errors. Use SLRParser<G>::Build to create.
+         */
+        SLRParser() = delete;
+    };
+
+    /**
+     * LR(1) PARSER
+     * Builds LR(1) tables for grammars that need more lookahead context than SLR provides, e.g. rules whose FOLLOW
+     * sets overlap but never in the same context. States with the same LR(0) core are merged whenever Pager's weak
+     * compatibility test guarantees the merge cannot introduce a conflict, which keeps the automaton close to
+     * LALR(1) size.
+     * @tparam G
+     */
+    template<IGrammar G>
+    class LR1Parser final : public LRParser<G>
+    {
+        using LookaheadSet = std::set<Terminal<G>*>;
+        using CoreKey = std::vector<std::pair<ProductionRule<G> const*, std::size_t>>;
+
+        /**
+         * LR(0) core with a lookahead set per kernel item.
+         */
+        struct LR1State
         {
-            Tokenizer tokenizer(*this, input, tokens);
+            LRState<G> core;
+            std::vector<LookaheadSet> lookaheads;
+
+            CoreKey Key() const
+            {
+                CoreKey key;
+                for(auto const &item : this->core.kernel_items)
+                {
+                    key.emplace_back(item.rule, item.position);
+                }
 
-            std::stack<ParseStackItem> parse_stack;
-            parse_stack.emplace(0);
+                return key;
+            }
 
-            while(true)
+            /**
+             * Sorts kernel items, so that states with the same core have the same item order.
+             */
+            void Canonicalize()
             {
-                lrstate_id_t state = parse_stack.top().state;
+                std::vector<std::size_t> order(this->lookaheads.size());
+                std::iota(order.begin(), order.end(), 0);
 
-                std::optional<Token<G>> lookahead = tokenizer.Peek(state);
-                if(!lookahead)
+                auto const &items = this->core.kernel_items;
+                std::ranges::sort(order, [&](std::size_t a, std::size_t b)
+                {
+                    return std::pair(items[a].rule, items[a].position) < std::pair(items[b].rule, items[b].position);
+                });
+
+                LR1State sorted;
+                for(std::size_t i : order)
+                {
+                    sorted.core.kernel_items.push_back(items[i]);
+                    sorted.lookaheads.push_back(std::move(this->lookaheads[i]));
+                }
+
+                *this = std::move(sorted);
+            }
+        };
+
+        static bool Intersects(LookaheadSet const &a, LookaheadSet const &b)
+        {
+            return std::ranges::any_of(a, [&](Terminal<G> *terminal) { return b.contains(terminal); });
+        }
+
+        /**
+         * Pager's weak compatibility: merging two states with the same core cannot create a reduce-reduce conflict
+         * that neither state had on its own.
+         * @param a
+         * @param b
+         * @return
+         */
+        static bool WeaklyCompatible(std::vector<LookaheadSet> const &a, std::vector<LookaheadSet> const &b)
+        {
+            for(std::size_t i = 0; i < a.size(); i++)
+            {
+                for(std::size_t j = i + 1; j < a.size(); j++)
                 {
-                    // Permissively consume rest of tokens
-                    if(tokens)
+                    if((Intersects(a[i], b[j]) || Intersects(b[i], a[j])) && !Intersects(a[i], a[j]) && !Intersects(b[i], b[j]))
+                    {
+                        return false;
+                    }
+                }
+            }
+
+            return true;
+        }
+
+        /**
+         * Adds FIRST(sequence) to `first`.
+         * @param sequence
+         * @param first
+         * @return Whether `sequence` can derive the empty string.
+         */
+        bool FirstOfSequence(std::span<Symbol<G> const> sequence, LookaheadSet &first) const
+        {
+            for(auto const &symbol : sequence)
+            {
+                bool nullable = std::visit(overload{
+                    [&](Terminal<G> *terminal)
+                    {
+                        first.insert(terminal);
+                        return false;
+                    },
+                    [&](NonTerminal<G> *nonterminal)
                     {
-                        while(true)
+                        auto it = this->grammar_.first_.find(nonterminal);
+                        if(it != this->grammar_.first_.end())
                         {
-                            lookahead = tokenizer.Peek(0, true);
-                            if(!lookahead) continue;
-                            if(lookahead->terminal == this->grammar_.EOS.get())
-                            {
-                                break;
-                            }
-                            tokenizer.Consume(*lookahead);
+                            first.insert(it->second.begin(), it->second.end());
                         }
-                    }
 
-                    return std::unexpected(Error{"Unexpected Token!"});
+                        return this->grammar_.nullable_.contains(nonterminal);
+                    },
+                }, symbol);
+
+                if(!nullable) return false;
+            }
+
+            return true;
+        }
+
+        /**
+         * @param state
+         * @return Closure items of `state` with their lookaheads.
+         */
+        std::vector<std::pair<LRItem<G>, LookaheadSet>> GenerateClosure(LR1State const &state) const
+        {
+            std::vector<std::pair<LRItem<G>, LookaheadSet>> closure;
+
+            // Index of the initial item of each rule in `closure`.
+            std::map<ProductionRule<G> const*, std::size_t> initial_items;
+
+            for(std::size_t i = 0; i < state.core.kernel_items.size(); i++)
+            {
+                if(state.core.kernel_items[i].position == 0)
+                {
+                    initial_items[state.core.kernel_items[i].rule] = closure.size();
                 }
+                closure.emplace_back(state.core.kernel_items[i], state.lookaheads[i]);
+            }
 
-                LRAction<G> action = this->action_[parse_stack.top().state][lookahead->terminal];
-                switch(action.type)
+            bool has_change;
+            do
+            {
+                has_change = false;
+
+                for(std::size_t i = 0; i < closure.size(); i++)
                 {
-                    case LRActionType::kAccept:
+                    LRItem<G> item = closure[i].first;
+                    if(item.Complete() || !std::holds_alternative<NonTerminal<G>*>(item.NextSymbol())) continue;
+
+                    LookaheadSet lookaheads;
+                    if(this->FirstOfSequence(std::span(item.rule->sequence_).subspan(item.position + 1), lookaheads))
                     {
-                        return std::move(parse_stack.top().value);
+                        lookaheads.insert(closure[i].second.begin(), closure[i].second.end());
                     }
 
-                    case LRActionType::kShift:
+                    for(auto const &rule : this->grammar_.rules_.at(std::get<NonTerminal<G>*>(item.NextSymbol())))
                     {
-                        std::optional<typename G::ValueType> value = std::move(lookahead->terminal->Reason(*lookahead));
-
-                        if(value)
+                        auto [it, inserted] = initial_items.try_emplace(&rule, closure.size());
+                        if(inserted)
                         {
-                            parse_stack.emplace(action.state, std::move(*value));
-                        }
-                        else
-                        {
-                            parse_stack.emplace(action.state);
+                            closure.emplace_back(LRItem<G>(&rule), LookaheadSet{});
+                            has_change = true;
                         }
 
-                        tokenizer.Consume(*lookahead);
-                        break;
+                        auto &target = closure[it->second].second;
+                        std::size_t size = target.size();
+                        target.insert(lookaheads.begin(), lookaheads.end());
+                        has_change |= size != target.size();
                     }
+                }
+            } while(has_change);
 
-                    case LRActionType::kReduce:
-                    {
-                        std::vector<typename G::ValueType> args(action.rule->sequence_.size());
+            return closure;
+        }
 
-                        for(int i = action.rule->sequence_.size() - 1; i >= 0; i--)
-                        {
-                            auto &top = parse_stack.top();
+        std::map<Symbol<G>, LR1State> GenerateTransitions(LR1State const &state) const
+        {
+            std::map<Symbol<G>, LR1State> transitions;
 
-                            args[i] = std::move(top.value);
+            for(auto const &[item, lookaheads] : this->GenerateClosure(state))
+            {
+                if(item.Complete()) continue;
 
-                            parse_stack.pop();
-                        }
+                auto &target = transitions[item.NextSymbol()];
+                target.core.kernel_items.push_back(item.Advance());
+                target.lookaheads.push_back(lookaheads);
+            }
 
-                        std::optional<typename G::ValueType> value = std::move(action.rule->Transduce(args));
-                        if(value)
-                        {
-                            parse_stack.emplace(this->goto_[parse_stack.top().state][action.rule->non_terminal_], std::move(*value));
-                        }
-                        else
+            for(auto &target : transitions | std::views::values)
+            {
+                target.Canonicalize();
+            }
+
+            return transitions;
+        }
+
+        /**
+         * Constructs ACTION and GOTO for table-based LR(1) parsing.
+         */
+        std::optional<Error> BuildParsingTables()
+        {
+            if(this->grammar_.rules_.at(&this->grammar_.root).empty())
+            {
+                return GrammarDefinitionError("Unproductive start symbol");
+            }
+
+            auto reduction_ids = this->NumberSymbols();
+
+            std::vector<LR1State> states(1);
+            states[0].core = LRState<G>(this->grammar_.rules_.at(&this->grammar_.root));
+            states[0].lookaheads.assign(states[0].core.kernel_items.size(), { this->grammar_.EOS.get() });
+            states[0].Canonicalize();
+
+            std::map<CoreKey, std::vector<lrstate_id_t>> cores = { { states[0].Key(), { 0 } } };
+            std::vector<std::map<Symbol<G>, lrstate_id_t>> transitions(1);
+
+            // States whose lookaheads changed since they were last expanded.
+            std::vector<lrstate_id_t> pending = { 0 };
+            std::vector<bool> is_pending = { true };
+
+            while(!pending.empty())
+            {
+                lrstate_id_t i = pending.back();
+                pending.pop_back();
+                is_pending[i] = false;
+
+                for(auto &[symbol, next] : this->GenerateTransitions(states[i]))
+                {
+                    auto &candidates = cores[next.Key()];
+                    auto compatible = std::ranges::find_if(candidates, [&](lrstate_id_t candidate) { return WeaklyCompatible(states[candidate].lookaheads, next.lookaheads); });
+
+                    lrstate_id_t target;
+                    bool changed = false;
+
+                    if(compatible == candidates.end())
+                    {
+                        target = states.size();
+                        candidates.push_back(target);
+
+                        states.push_back(std::move(next));
+                        transitions.emplace_back();
+                        is_pending.push_back(false);
+                        changed = true;
+                    }
+                    else
+                    {
+                        target = *compatible;
+                        for(std::size_t k = 0; k < next.lookaheads.size(); k++)
                         {
-                            parse_stack.emplace(this->goto_[parse_stack.top().state][action.rule->non_terminal_]);
+                            auto &lookaheads = states[target].lookaheads[k];
+                            std::size_t size = lookaheads.size();
+                            lookaheads.insert(next.lookaheads[k].begin(), next.lookaheads[k].end());
+                            changed |= size != lookaheads.size();
                         }
-                        break;
                     }
 
-                    default:
+                    transitions[i][symbol] = target;
+
+                    if(changed && !is_pending[target])
                     {
-                        return std::unexpected(ParsingError(lookahead->location, "Unexpected Token"));
+                        pending.push_back(target);
+                        is_pending[target] = true;
+                    }
+                }
+            }
+
+            // Re-expanded states may have moved their transitions to other states, leaving some unreachable.
+            std::vector<lrstate_id_t> reachable = { 0 };
+            std::vector<lrstate_id_t> ids(states.size(), std::string_view::npos);
+            ids[0] = 0;
+            for(std::size_t k = 0; k < reachable.size(); k++)
+            {
+                for(lrstate_id_t target : transitions[reachable[k]] | std::views::values)
+                {
+                    if(ids[target] == std::string_view::npos)
+                    {
+                        ids[target] = reachable.size();
+                        reachable.push_back(target);
+                    }
+                }
+            }
+
+            std::vector<LRState<G>> cores_by_id;
+            for(lrstate_id_t i = 0; i < reachable.size(); i++)
+            {
+                LR1State const &state = states[reachable[i]];
+                cores_by_id.push_back(state.core);
+
+                for(auto const &[symbol, target] : transitions[reachable[i]])
+                {
+                    this->AddTransition(i, symbol, ids[target]);
+                }
+
+                // Create REDUCE entries on the item's own lookaheads. Items of empty rules are complete in the closure.
+                for(auto const &[item, lookaheads] : this->GenerateClosure(state))
+                {
+                    if(!item.Complete()) continue;
+
+                    for(auto terminal : lookaheads)
+                    {
+                        auto error = this->AddReduction(i, terminal, item.rule, reduction_ids.at(item.rule));
+                        if(error)
+                        {
+                            return error;
+                        }
                     }
                 }
             }
+
+            this->action_[0][this->grammar_.EOS.get()] = {
+                .type = LRActionType::kAccept,
+            };
+
+            this->state_count_ = reachable.size();
+            this->FindOperatorStates(cores_by_id, reduction_ids);
+
+            return std::nullopt;
         }
 
-        static std::expected<SLRParser, Error> Build(NonTerminal<G> &start)
+    protected:
+        LR1Parser(NonTerminal<G> &start) : LRParser<G>(start) {}
+
+    public:
+        static std::expected<LR1Parser, Error> Build(NonTerminal<G> &start, BuildOptions const &options = {})
         {
-            SLRParser parser(start);
+            BUFFALO_PROBE(build__phase, "grammar");
+            LR1Parser parser(start);
 
+            BUFFALO_PROBE(build__phase, "automaton");
             auto error = parser.BuildParsingTables();
             if(error)
             {
                 return std::unexpected(*error);
             }
 
-            return std::move(parser);
+            BUFFALO_PROBE(build__phase, "finalize");
+            error = parser.Finalize(options);
+            if(error)
+            {
+                return std::unexpected(*error);
+            }
+
+            BUFFALO_PROBE(build__done, parser.state_count_);
+            return parser;
         }
 
         /**
-         * Construction of a parser can generate grammar errors. Use SLRParser<G>::Build to create.
+         * Construction of a parser can generate grammar errors. Use LR1Parser<G>::Build to create.
          */
-        SLRParser() = delete;
+        LR1Parser() = delete;
     };
 }
 
+/**
+ * EXPLICIT INSTANTIATION
+ * Every TU that builds or runs a parser instantiates the whole parser for its grammar. To compile the parser once,
+ * declare the instantiations next to the grammar's ValueType with BUFFALO_EXTERN_TEMPLATES(G) and define them in one
+ * source file with BUFFALO_INSTANTIATE_TEMPLATES(G). Terminal scanners (DefineTerminal) are still compiled where the
+ * terminals are defined. A move-only ValueType is fine; members that copy values, such as resuming ParseCheckpoints,
+ * are then left out.
+ */
+#define BUFFALO_TEMPLATES(prefix, G) \
+    prefix class bf::Terminal<G>; \
+    prefix class bf::NonTerminal<G>; \
+    prefix class bf::ProductionRule<G>; \
+    prefix class bf::Grammar<G>; \
+    prefix struct bf::LRItem<G>; \
+    prefix struct bf::LRState<G>; \
+    prefix class bf::LRParser<G>; \
+    prefix class bf::SLRParser<G>; \
+    prefix class bf::LR1Parser<G>;
+
+#define BUFFALO_EXTERN_TEMPLATES(G) BUFFALO_TEMPLATES(extern template, G)
+#define BUFFALO_INSTANTIATE_TEMPLATES(G) BUFFALO_TEMPLATES(template, G)
+
 #endif //BUFFALO2_H
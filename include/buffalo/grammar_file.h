@@ -0,0 +1,688 @@
+#ifndef BUFFALO_GRAMMAR_FILE_H
+#define BUFFALO_GRAMMAR_FILE_H
+
+#include <buffalo/buffalo.h>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bf
+{
+    /**
+     * ACTION REGISTRY
+     * Semantic actions and reasoners that grammar files refer to by name.
+     * @tparam G
+     */
+    template<IGrammar G>
+    class ActionRegistry
+    {
+        std::map<std::string, typename NonTerminal<G>::TransductorType, std::less<>> actions_;
+        std::map<std::string, typename Terminal<G>::ReasonerType, std::less<>> reasoners_;
+
+    public:
+        ActionRegistry &Action(std::string name, typename NonTerminal<G>::TransductorType action)
+        {
+            this->actions_[std::move(name)] = action;
+
+            return *this;
+        }
+
+        ActionRegistry &Reasoner(std::string name, typename Terminal<G>::ReasonerType reasoner)
+        {
+            this->reasoners_[std::move(name)] = reasoner;
+
+            return *this;
+        }
+
+        /**
+         * @return Action registered as `name`, or nullptr.
+         */
+        typename NonTerminal<G>::TransductorType FindAction(std::string_view name) const
+        {
+            auto it = this->actions_.find(name);
+            return it != this->actions_.end() ? it->second : nullptr;
+        }
+
+        /**
+         * @return Reasoner registered as `name`, or nullptr.
+         */
+        typename Terminal<G>::ReasonerType FindReasoner(std::string_view name) const
+        {
+            auto it = this->reasoners_.find(name);
+            return it != this->reasoners_.end() ? it->second : nullptr;
+        }
+    };
+
+    /**
+     * GRAMMAR FILE
+     * Grammar loaded at runtime from yacc-like text. Terminals become RuntimeTerminals and rules become ordinary
+     * NonTerminals, so parsers built from `Root()` use the same tables and scanner as grammars defined in C++. The
+     * GrammarFile owns all symbols and must outlive parsers built from it.
+     *
+     * ```
+     * %token NUMBER /\d+/ number     // regex between slashes, optional reasoner name
+     * %token PLUS "+"                // literal
+     * %left PLUS MINUS               // lowest precedence first, as in yacc
+     * %right POW
+     * %start statement               // defaults to the first rule
+     * %%
+     * expression : NUMBER { forward }
+     *            | expression PLUS expression { add }
+     *            ;
+     * ```
+     *
+     * Actions are looked up in an ActionRegistry. Alternatives without an action pass on the value of their first
+     * symbol, like yacc's `$$ = $1` (empty ones yield a default ValueType). `%empty` may be written for empty
+     * alternatives, and both `//` and C-style block comments are allowed. Terminals without a `%left`, `%right` or
+     * `%nonassoc` declaration bind looser than all declared ones, in the order they were declared. As with bf::None,
+     * conflicts between `%nonassoc` terminals of the same level fail the build.
+     *
+     * Files loaded with the same TerminalRegistry (e.g. dialects of a language) share the compiled scanners of their
+     * common patterns, and their parsers share the registry's combined scanner.
+     * @tparam G
+     */
+    template<IGrammar G>
+    class GrammarFile
+    {
+        /// Gives the loader access to the rules of the NonTerminals it creates.
+        struct FileNonTerminal : NonTerminal<G>
+        {
+            using NonTerminal<G>::rules_;
+        };
+
+        /**
+         * Recursive-descent reader of the grammar file syntax.
+         */
+        class Reader
+        {
+            std::string_view source_;
+            std::size_t position_ = 0;
+            std::size_t line_ = 1;
+
+            ActionRegistry<G> const &actions_;
+            GrammarFile &file_;
+
+            std::optional<std::string> error_;
+
+            /// Precedence declarations in file order.
+            std::vector<std::pair<Associativity, std::vector<std::string>>> levels_;
+            std::string start_;
+
+            /// NonTerminals in order of first definition, with their rules.
+            std::vector<std::pair<FileNonTerminal*, std::vector<ProductionRule<G>>>> definitions_;
+
+            void Fail(std::string message)
+            {
+                if(!this->error_)
+                {
+                    this->error_ = std::move(message) + " on line " + std::to_string(this->line_);
+                }
+            }
+
+            bool AtEnd() const
+            {
+                return this->position_ >= this->source_.size();
+            }
+
+            char Current() const
+            {
+                return this->AtEnd() ? '\0' : this->source_[this->position_];
+            }
+
+            void Advance()
+            {
+                if(this->Current() == '\n') this->line_++;
+                this->position_++;
+            }
+
+            bool LooksAt(std::string_view text) const
+            {
+                return this->source_.substr(this->position_).starts_with(text);
+            }
+
+            /**
+             * Skips whitespace and comments. Newlines are only skipped if `lines` is set.
+             */
+            void Skip(bool lines = true)
+            {
+                while(!this->AtEnd())
+                {
+                    char c = this->Current();
+
+                    if(c == '\n' && !lines) return;
+
+                    if(std::isspace(static_cast<unsigned char>(c)))
+                    {
+                        this->Advance();
+                    }
+                    else if(this->LooksAt("//"))
+                    {
+                        while(!this->AtEnd() && this->Current() != '\n') this->Advance();
+                    }
+                    else if(this->LooksAt("/*"))
+                    {
+                        while(!this->AtEnd() && !this->LooksAt("*/")) this->Advance();
+
+                        if(this->AtEnd())
+                        {
+                            this->Fail("Unterminated comment");
+                            return;
+                        }
+
+                        this->position_ += 2;
+                    }
+                    else
+                    {
+                        return;
+                    }
+                }
+            }
+
+            bool AtLineEnd()
+            {
+                this->Skip(false);
+                return this->AtEnd() || this->Current() == '\n';
+            }
+
+            std::string Identifier()
+            {
+                std::size_t begin = this->position_;
+                while(!this->AtEnd() && (std::isalnum(static_cast<unsigned char>(this->Current())) || this->Current() == '_'))
+                {
+                    this->Advance();
+                }
+
+                if(begin == this->position_)
+                {
+                    this->Fail("Expected identifier");
+                }
+
+                return std::string(this->source_.substr(begin, this->position_ - begin));
+            }
+
+            /**
+             * Reads `/regex/` verbatim or `"literal"` with its regex metacharacters escaped.
+             */
+            std::string Pattern()
+            {
+                char delimiter = this->Current();
+                if(delimiter != '/' && delimiter != '"')
+                {
+                    this->Fail("Expected /pattern/ or \"literal\"");
+                    return {};
+                }
+                this->Advance();
+
+                std::string pattern;
+                while(!this->AtEnd() && this->Current() != delimiter && this->Current() != '\n')
+                {
+                    char c = this->Current();
+                    this->Advance();
+
+                    if(c == '\\' && !this->AtEnd())
+                    {
+                        char escaped = this->Current();
+                        this->Advance();
+
+                        if(delimiter == '/')
+                        {
+                            if(escaped != '/') pattern += '\\';
+                            pattern += escaped;
+                            continue;
+                        }
+
+                        c = escaped;
+                    }
+
+                    if(delimiter == '"' && std::string_view(R"(\^$.|?*+()[]{}/)").contains(c))
+                    {
+                        pattern += '\\';
+                    }
+                    pattern += c;
+                }
+
+                if(this->Current() != delimiter)
+                {
+                    this->Fail("Unterminated pattern");
+                    return {};
+                }
+                this->Advance();
+
+                if(pattern.empty())
+                {
+                    this->Fail("Empty pattern");
+                }
+
+                return pattern;
+            }
+
+            void TokenDeclaration()
+            {
+                this->Skip(false);
+                std::string name = this->Identifier();
+                this->Skip(false);
+                std::string pattern = this->Pattern();
+
+                typename Terminal<G>::ReasonerType reasoner = nullptr;
+                if(!this->AtLineEnd())
+                {
+                    std::string reasoner_name = this->Identifier();
+                    reasoner = this->actions_.FindReasoner(reasoner_name);
+
+                    if(!reasoner)
+                    {
+                        this->Fail("Unknown reasoner '" + reasoner_name + "'");
+                    }
+                }
+
+                if(this->error_) return;
+
+                if(this->file_.terminals_.contains(name))
+                {
+                    this->Fail("Duplicate terminal '" + name + "'");
+                    return;
+                }
+
+                auto terminal = std::make_unique<RuntimeTerminal<G>>(std::move(pattern), reasoner);
+
+                if(this->file_.registry_)
+                {
+                    auto error = terminal->Compile(*this->file_.registry_);
+                    if(error)
+                    {
+                        this->Fail(error->message + " in terminal '" + name + "'");
+                        return;
+                    }
+                }
+
+                auto [it, inserted] = this->file_.terminals_.emplace(std::move(name), std::move(terminal));
+                it->second->debug_name = it->first.c_str();
+
+                this->file_.terminal_order_.push_back(it->second.get());
+            }
+
+            void Level(Associativity associativity)
+            {
+                std::vector<std::string> names;
+                while(!this->AtLineEnd() && !this->error_)
+                {
+                    names.push_back(this->Identifier());
+                }
+
+                this->levels_.emplace_back(associativity, std::move(names));
+            }
+
+            /**
+             * Reads the declarations up to `%%`.
+             */
+            void Declarations()
+            {
+                while(!this->error_)
+                {
+                    this->Skip();
+
+                    if(this->AtEnd())
+                    {
+                        this->Fail("Expected %%");
+                        return;
+                    }
+
+                    if(this->LooksAt("%%"))
+                    {
+                        this->position_ += 2;
+                        return;
+                    }
+
+                    if(this->Current() != '%')
+                    {
+                        this->Fail("Expected declaration");
+                        return;
+                    }
+                    this->Advance();
+
+                    std::string keyword = this->Identifier();
+                    if(keyword == "token")
+                    {
+                        this->TokenDeclaration();
+                    }
+                    else if(keyword == "left")
+                    {
+                        this->Level(Associativity::Left);
+                    }
+                    else if(keyword == "right")
+                    {
+                        this->Level(Associativity::Right);
+                    }
+                    else if(keyword == "nonassoc")
+                    {
+                        this->Level(Associativity::None);
+                    }
+                    else if(keyword == "start")
+                    {
+                        this->Skip(false);
+                        this->start_ = this->Identifier();
+                    }
+                    else if(!this->error_)
+                    {
+                        this->Fail("Unknown declaration '%" + keyword + "'");
+                    }
+
+                    if(!this->error_ && !this->AtLineEnd())
+                    {
+                        this->Fail("Unexpected text after declaration");
+                    }
+                }
+            }
+
+            /**
+             * Assigns precedence like yacc: later levels bind tighter, undeclared terminals bind loosest.
+             */
+            void AssignPrecedence()
+            {
+                std::size_t precedence = 0;
+                std::set<Terminal<G>*> declared;
+
+                for(auto const &[associativity, names] : this->levels_ | std::views::reverse)
+                {
+                    for(auto const &name : names)
+                    {
+                        auto it = this->file_.terminals_.find(name);
+                        if(it == this->file_.terminals_.end())
+                        {
+                            this->Fail("Precedence declared for unknown terminal '" + name + "'");
+                            return;
+                        }
+
+                        if(!declared.insert(it->second.get()).second)
+                        {
+                            this->Fail("Precedence declared twice for '" + name + "'");
+                            return;
+                        }
+
+                        it->second->precedence = precedence;
+                        it->second->associativity = associativity;
+                    }
+
+                    precedence++;
+                }
+
+                for(auto terminal : this->file_.terminal_order_)
+                {
+                    if(!declared.contains(terminal))
+                    {
+                        terminal->precedence = precedence++;
+                    }
+                }
+            }
+
+            FileNonTerminal *NonTerminalNamed(std::string const &name)
+            {
+                auto &non_terminal = this->file_.nonterminals_[name];
+                if(!non_terminal)
+                {
+                    non_terminal = std::make_unique<FileNonTerminal>();
+                }
+
+                return non_terminal.get();
+            }
+
+            std::vector<ProductionRule<G>> &RulesOf(FileNonTerminal *non_terminal)
+            {
+                auto it = std::ranges::find(this->definitions_, non_terminal, [](auto const &definition) { return definition.first; });
+                if(it == this->definitions_.end())
+                {
+                    return this->definitions_.emplace_back(non_terminal, std::vector<ProductionRule<G>>{}).second;
+                }
+
+                return it->second;
+            }
+
+            ProductionRule<G> Alternative()
+            {
+                ProductionRule<G> rule;
+                bool empty = true;
+                bool action_given = false;
+
+                while(!this->error_)
+                {
+                    this->Skip();
+
+                    if(this->AtEnd() || this->Current() == '|' || this->Current() == ';')
+                    {
+                        break;
+                    }
+
+                    if(this->Current() == '{')
+                    {
+                        this->Advance();
+                        this->Skip();
+                        std::string name = this->Identifier();
+                        this->Skip();
+
+                        if(this->Current() != '}')
+                        {
+                            this->Fail("Expected }");
+                            break;
+                        }
+                        this->Advance();
+
+                        auto action = this->actions_.FindAction(name);
+                        if(!action)
+                        {
+                            this->Fail("Unknown action '" + name + "'");
+                            break;
+                        }
+
+                        rule <=> action;
+                        action_given = true;
+                        continue;
+                    }
+
+                    if(this->LooksAt("%empty"))
+                    {
+                        this->position_ += 6;
+                        continue;
+                    }
+
+                    std::string name = this->Identifier();
+                    if(this->error_) break;
+
+                    auto terminal = this->file_.terminals_.find(name);
+                    if(terminal != this->file_.terminals_.end())
+                    {
+                        rule + *terminal->second;
+                    }
+                    else
+                    {
+                        rule + *this->NonTerminalNamed(name);
+                    }
+                    empty = false;
+                }
+
+                // As in yacc, the value defaults to that of the first symbol ($$ = $1).
+                if(!action_given && !empty)
+                {
+                    rule <=> Forward<G>;
+                }
+
+                return rule;
+            }
+
+            /**
+             * Reads `name : alternative | ... ;` definitions up to the end of input or a second `%%`.
+             */
+            void Rules()
+            {
+                while(!this->error_)
+                {
+                    this->Skip();
+
+                    if(this->AtEnd() || this->LooksAt("%%"))
+                    {
+                        return;
+                    }
+
+                    std::string name = this->Identifier();
+                    if(this->error_) return;
+
+                    if(this->file_.terminals_.contains(name))
+                    {
+                        this->Fail("Rule defined for terminal '" + name + "'");
+                        return;
+                    }
+
+                    this->Skip();
+                    if(this->Current() != ':')
+                    {
+                        this->Fail("Expected :");
+                        return;
+                    }
+                    this->Advance();
+
+                    auto non_terminal = this->NonTerminalNamed(name);
+                    if(this->start_.empty())
+                    {
+                        this->start_ = name;
+                    }
+
+                    while(!this->error_)
+                    {
+                        ProductionRule<G> rule = this->Alternative();
+                        this->RulesOf(non_terminal).push_back(std::move(rule));
+
+                        if(this->Current() == '|')
+                        {
+                            this->Advance();
+                            continue;
+                        }
+
+                        if(this->Current() != ';')
+                        {
+                            this->Fail("Expected ;");
+                        }
+                        this->Advance();
+                        break;
+                    }
+                }
+            }
+
+        public:
+            Reader(std::string_view source, ActionRegistry<G> const &actions, GrammarFile &file) : source_(source), actions_(actions), file_(file) {}
+
+            std::optional<Error> Read()
+            {
+                this->Declarations();
+                if(!this->error_) this->AssignPrecedence();
+                if(!this->error_) this->Rules();
+
+                if(this->error_)
+                {
+                    return GrammarDefinitionError(*this->error_);
+                }
+
+                for(auto &[non_terminal, rules] : this->definitions_)
+                {
+                    non_terminal->rules_ = std::move(rules);
+                }
+
+                for(auto const &[name, non_terminal] : this->file_.nonterminals_)
+                {
+                    if(std::ranges::find(this->definitions_, non_terminal.get(), [](auto const &definition) { return definition.first; }) == this->definitions_.end())
+                    {
+                        return GrammarDefinitionError("Undefined symbol '" + name + "'");
+                    }
+                }
+
+                auto root = this->file_.nonterminals_.find(this->start_);
+                if(root == this->file_.nonterminals_.end())
+                {
+                    return GrammarDefinitionError(this->start_.empty() ? "Grammar has no rules" : "Undefined start symbol '" + this->start_ + "'");
+                }
+
+                this->file_.root_ = root->second.get();
+                return std::nullopt;
+            }
+        };
+
+        std::map<std::string, std::unique_ptr<RuntimeTerminal<G>>, std::less<>> terminals_;
+        std::map<std::string, std::unique_ptr<FileNonTerminal>, std::less<>> nonterminals_;
+
+        /// Terminals in declaration order.
+        std::vector<RuntimeTerminal<G>*> terminal_order_;
+
+        NonTerminal<G> *root_ = nullptr;
+
+        TerminalRegistry *registry_ = nullptr;
+
+        GrammarFile() = default;
+
+    public:
+        /**
+         * @return Start symbol to build parsers from.
+         */
+        NonTerminal<G> &Root() const
+        {
+            return *this->root_;
+        }
+
+        Terminal<G> *FindTerminal(std::string_view name) const
+        {
+            auto it = this->terminals_.find(name);
+            return it != this->terminals_.end() ? it->second.get() : nullptr;
+        }
+
+        NonTerminal<G> *FindNonTerminal(std::string_view name) const
+        {
+            auto it = this->nonterminals_.find(name);
+            return it != this->nonterminals_.end() ? it->second.get() : nullptr;
+        }
+
+        /**
+         * Reads a grammar from `source`.
+         * @param source
+         * @param actions
+         * @param registry If given, patterns are compiled through it right away, sharing scanners with other files
+         * loaded with the same registry, which must outlive the builds of parsers from the file. Invalid patterns
+         * then fail the load. Otherwise patterns are only compiled when a parser is built.
+         * @return
+         */
+        static std::expected<GrammarFile, Error> Load(std::string_view source, ActionRegistry<G> const &actions, TerminalRegistry *registry = nullptr)
+        {
+            GrammarFile file;
+            file.registry_ = registry;
+
+            auto error = Reader(source, actions, file).Read();
+            if(error)
+            {
+                return std::unexpected(*error);
+            }
+
+            return file;
+        }
+
+        static std::expected<GrammarFile, Error> LoadFile(std::filesystem::path const &path, ActionRegistry<G> const &actions, TerminalRegistry *registry = nullptr)
+        {
+            std::ifstream in(path);
+            if(!in)
+            {
+                return std::unexpected(Error{"Unable to read grammar file"});
+            }
+
+            std::stringstream source;
+            source << in.rdbuf();
+
+            return Load(source.str(), actions, registry);
+        }
+
+        GrammarFile(GrammarFile &&) = default;
+        GrammarFile &operator=(GrammarFile &&) = default;
+    };
+}
+
+#endif //BUFFALO_GRAMMAR_FILE_H
@@ -0,0 +1,306 @@
+#ifndef BUFFALO_HOT_SWAP_H
+#define BUFFALO_HOT_SWAP_H
+
+#include <buffalo/async.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bf
+{
+    /**
+     * VERSIONED PARSER
+     * Handle to the current version of a parser that can be replaced while parses are running, e.g. when a server
+     * reloads its grammars. Readers pin the current version with Read() and keep using it until their guard is
+     * released, even if a new version is published meanwhile. Replaced versions are destroyed once no reader that
+     * might still use them is left.
+     *
+     * Reclamation is epoch-based: each publish starts a new epoch, and a reader announces the epoch it started in
+     * by claiming one of a fixed set of slots (preferably the same one for a given thread, each on its own cache
+     * line). Readers thus only touch their slot and shared atomics that are written on publish, without locks or a
+     * shared reference count. Publishers take a lock, and so does a reader releasing an old version, if it is free,
+     * to destroy the versions no reader is left on.
+     * @tparam P Parser type, e.g. SLRParser<G>
+     */
+    template<typename P>
+    class VersionedParser
+    {
+        struct Version
+        {
+            std::unique_ptr<P> parser;
+            std::uint64_t number;
+        };
+
+        struct alignas(64) Slot
+        {
+            /// Epoch a reader started in, or 0 when free.
+            std::atomic<std::uint64_t> epoch = 0;
+        };
+
+        std::atomic<Version*> current_;
+        std::atomic<std::uint64_t> epoch_ = 1;
+        std::vector<Slot> slots_;
+
+        std::mutex publish_mutex_;
+
+        /// Replaced versions with the epoch their replacement was published in.
+        std::vector<std::pair<std::uint64_t, std::unique_ptr<Version>>> retired_;
+        std::atomic<std::size_t> retired_count_ = 0;
+
+        /// A reader released an old version while another thread held `publish_mutex_`.
+        std::atomic<bool> collect_pending_ = false;
+
+        /**
+         * Destroys the retired versions no reader can still use. `publish_mutex_` must be held.
+         * @return Number of versions still retired.
+         */
+        std::size_t Collect()
+        {
+            std::uint64_t oldest = std::numeric_limits<std::uint64_t>::max();
+            for(auto const &slot : this->slots_)
+            {
+                std::uint64_t epoch = slot.epoch.load();
+                if(epoch)
+                {
+                    oldest = std::min(oldest, epoch);
+                }
+            }
+
+            // Readers that started in the replacement's epoch or later loaded the replacement. The count is only
+            // lowered here, Publish raises it before the slots are scanned.
+            std::erase_if(this->retired_, [&](auto const &retired) { return retired.first <= oldest; });
+            this->retired_count_.store(this->retired_.size());
+
+            return this->retired_.size();
+        }
+
+        /**
+         * Collects unless another thread holds `publish_mutex_`, in which case that thread collects once it releases
+         * the mutex (see Unlock). Called when a reader of an old epoch is released.
+         */
+        void TryCollect()
+        {
+            this->collect_pending_.store(true);
+            while(this->collect_pending_.load())
+            {
+                std::unique_lock lock(this->publish_mutex_, std::try_to_lock);
+                if(!lock)
+                {
+                    return;
+                }
+
+                this->collect_pending_.store(false);
+                this->Collect();
+            }
+        }
+
+        /**
+         * Releases `lock` on `publish_mutex_`, then collects for readers that were released while it was held.
+         */
+        void Unlock(std::unique_lock<std::mutex> &lock)
+        {
+            lock.unlock();
+            if(this->collect_pending_.load())
+            {
+                this->TryCollect();
+            }
+        }
+
+    public:
+        /**
+         * Pins a version of the parser for as long as it lives.
+         */
+        class Reader
+        {
+            friend class VersionedParser;
+
+            VersionedParser *owner_;
+            Slot *slot_;
+            Version const *version_;
+
+            Reader(VersionedParser *owner, Slot *slot, Version const *version) : owner_(owner), slot_(slot), version_(version) {}
+
+        public:
+            P &operator*() const
+            {
+                return *this->version_->parser;
+            }
+
+            P *operator->() const
+            {
+                return this->version_->parser.get();
+            }
+
+            /**
+             * @return Number of the pinned version, starting at 1 for the initial parser.
+             */
+            std::uint64_t Number() const
+            {
+                return this->version_->number;
+            }
+
+            Reader(Reader &&other) noexcept : owner_(other.owner_), slot_(std::exchange(other.slot_, nullptr)), version_(other.version_) {}
+
+            Reader(Reader const &) = delete;
+
+            ~Reader()
+            {
+                if(!this->slot_)
+                {
+                    return;
+                }
+
+                std::uint64_t epoch = this->slot_->epoch.load(std::memory_order_relaxed);
+                this->slot_->epoch.store(0);
+
+                // This reader may have been the last one on a replaced version.
+                if(epoch < this->owner_->epoch_.load() && this->owner_->retired_count_.load())
+                {
+                    this->owner_->TryCollect();
+                }
+            }
+        };
+
+        /**
+         * Pins the current version. Waits for a free slot if as many readers as slots are active.
+         * @return
+         */
+        Reader Read()
+        {
+            static thread_local std::size_t const hint = std::hash<std::thread::id>{}(std::this_thread::get_id());
+
+            for(std::size_t i = hint; ; i++)
+            {
+                Slot &slot = this->slots_[i % this->slots_.size()];
+
+                std::uint64_t free = 0;
+                if(slot.epoch.load(std::memory_order_relaxed) == 0 && slot.epoch.compare_exchange_strong(free, this->epoch_.load()))
+                {
+                    // Sequentially consistent with Publish: a reader that announced an epoch before the swap is seen
+                    // by Collect, and one that announced it after loads the new version.
+                    return Reader(this, &slot, this->current_.load());
+                }
+
+                // Every slot is taken.
+                if((i + 1 - hint) % this->slots_.size() == 0)
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        /**
+         * Makes `parser` the current version. Readers pinning older versions are not affected, and older versions
+         * are destroyed once these readers are done, by the last of them to be released.
+         * @param parser
+         * @return Number of the new version.
+         */
+        std::uint64_t Publish(P parser)
+        {
+            std::unique_lock lock(this->publish_mutex_);
+
+            Version *current = this->current_.load();
+            auto version = std::make_unique<Version>(std::make_unique<P>(std::move(parser)), current->number + 1);
+            std::uint64_t number = version->number;
+
+            std::unique_ptr<Version> previous(this->current_.exchange(version.release()));
+            std::uint64_t epoch = this->epoch_.fetch_add(1) + 1;
+            this->retired_.emplace_back(epoch, std::move(previous));
+
+            // Before Collect scans the slots: a reader releasing its slot after the scan must see a retired version
+            // to collect it.
+            this->retired_count_.store(this->retired_.size());
+
+            this->Collect();
+            this->Unlock(lock);
+
+            return number;
+        }
+
+        /**
+         * Destroys the replaced versions no reader is using anymore. Not needed for reclamation, which happens as
+         * readers are released, but frees versions right away once readers are known to be done.
+         * @return Number of replaced versions still in use.
+         */
+        std::size_t Reclaim()
+        {
+            std::unique_lock lock(this->publish_mutex_);
+            std::size_t retired = this->Collect();
+            this->Unlock(lock);
+
+            return retired;
+        }
+
+        /**
+         * @return Number of replaced versions not destroyed yet.
+         */
+        std::size_t Retired() const
+        {
+            return this->retired_count_.load();
+        }
+
+        /**
+         * @param parser Initial version.
+         * @param slots Maximum number of concurrent readers before Read waits.
+         */
+        explicit VersionedParser(P parser, std::size_t slots = 4 * std::max(1u, std::thread::hardware_concurrency())) : slots_(std::max<std::size_t>(slots, 1))
+        {
+            this->current_.store(new Version{ std::make_unique<P>(std::move(parser)), 1 });
+        }
+
+        VersionedParser(VersionedParser const &) = delete;
+
+        /**
+         * All readers must be released first.
+         */
+        ~VersionedParser()
+        {
+            delete this->current_.load();
+        }
+    };
+
+    /**
+     * Builds a new version of `handle`'s parser on `executor` and publishes it if the build succeeds. Parses keep
+     * running on the current version in the meantime.
+     * @tparam P
+     * @tparam Build Callable returning std::expected<P, Error>, e.g. a lambda calling SLRParser<G>::Build
+     * @tparam Executor
+     * @param handle
+     * @param build
+     * @param executor
+     * @return Number of the published version, or the build error.
+     */
+    template<typename P, typename Build, IExecutor Executor>
+    std::future<std::expected<std::uint64_t, Error>> BuildAndPublish(VersionedParser<P> &handle, Build build, Executor &executor)
+    {
+        auto task = std::make_shared<std::packaged_task<std::expected<std::uint64_t, Error>()>>([&handle, build = std::move(build)]() mutable -> std::expected<std::uint64_t, Error>
+        {
+            auto parser = build();
+            if(!parser)
+            {
+                return std::unexpected(parser.error());
+            }
+
+            return handle.Publish(std::move(*parser));
+        });
+
+        auto future = task->get_future();
+        executor.Execute([task] { (*task)(); });
+
+        return future;
+    }
+
+    template<typename P, typename Build>
+    std::future<std::expected<std::uint64_t, Error>> BuildAndPublish(VersionedParser<P> &handle, Build build)
+    {
+        return BuildAndPublish(handle, std::move(build), ThreadPool::Default());
+    }
+}
+
+#endif //BUFFALO_HOT_SWAP_H
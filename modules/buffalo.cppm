@@ -0,0 +1,107 @@
+module;
+
+#include <buffalo/buffalo.h>
+#include <buffalo/async.h>
+#include <buffalo/grammar_file.h>
+#include <buffalo/hot_swap.h>
+
+/*
+ * C++20 module interface for buffalo: `import buffalo;` instead of including the headers. The headers are compiled
+ * once into the module, so importing TUs only instantiate what they use. Macros (BUFFALO_EXTERN_TEMPLATES, ...) are
+ * not part of the module; include buffalo.h for them.
+ */
+export module buffalo;
+
+export namespace bf
+{
+    /*
+     * Grammar definition
+     */
+    using bf::overload;
+    using bf::IGrammar;
+    using bf::GrammarDefinition;
+    using bf::Dummy;
+    using bf::Location;
+    using bf::Error;
+    using bf::GrammarDefinitionError;
+    using bf::ParsingError;
+    using bf::Token;
+    using bf::DebugSymbol;
+    using bf::Associativity;
+    using bf::FeatureMask;
+    using bf::kAllFeatures;
+    using bf::None;
+    using bf::Left;
+    using bf::Right;
+
+    using bf::Terminal;
+    using bf::DefineTerminal;
+    using bf::RegexHazard;
+    using bf::RegexLint;
+    using bf::LintRegex;
+    using bf::DFA;
+    using bf::CombinedDFA;
+    using bf::TerminalRegistry;
+    using bf::RuntimeTerminal;
+    using bf::NonTerminal;
+    using bf::DefineNonTerminal;
+    using bf::Symbol;
+    using bf::ProductionRule;
+    using bf::ProductionRuleList;
+    using bf::PR;
+    using bf::Forward;
+    using bf::ValueAs;
+    using bf::Subrule;
+    using bf::ZeroOrMore;
+    using bf::OneOrMore;
+    using bf::Optional;
+    using bf::operator+;
+    using bf::operator|;
+    using bf::Grammar;
+    using bf::RightRecursion;
+
+    /*
+     * Parsers
+     */
+    using bf::LRItem;
+    using bf::LRState;
+    using bf::lrstate_id_t;
+    using bf::LRActionType;
+    using bf::LRAction;
+    using bf::LRReduction;
+    using bf::PackedTables;
+    using bf::ParseProfile;
+    using bf::UTF8Scan;
+    using bf::SkipASCII;
+    using bf::ScanUTF8;
+    using bf::UTF8Validator;
+    using bf::BuildOptions;
+    using bf::BuildReport;
+    using bf::ParseCheckpoint;
+    using bf::PartialParse;
+    using bf::FlatTree;
+    using bf::ParseTrace;
+    using bf::Parser;
+    using bf::LRParser;
+    using bf::SLRParser;
+    using bf::LR1Parser;
+
+    /*
+     * async.h
+     */
+    using bf::IExecutor;
+    using bf::ThreadPool;
+    using bf::ParseAsync;
+
+    /*
+     * grammar_file.h
+     */
+    using bf::ActionRegistry;
+    using bf::GrammarFile;
+
+    /*
+     * hot_swap.h
+     */
+    using bf::VersionedParser;
+    using bf::BuildAndPublish;
+}
@@ -1,6 +1,12 @@
 #include <gtest/gtest.h>
 #include <buffalo/buffalo.h>
+#include <buffalo/async.h>
+#include <buffalo/grammar_file.h>
+#include <buffalo/hot_swap.h>
 #include <cmath>
+#include <cstring>
+#include <sstream>
+#include <thread>
 
 /*
  * Grammar Definition
@@ -14,6 +20,7 @@ bf::DefineTerminal<G, R"(\d+(\.\d+)?)", double> NUMBER([](auto const &tok) {
     return std::stod(std::string(tok.raw));
 });
 
+bf::DefineTerminal<G, R"(~)"> OP_NEG(bf::Right);
 bf::DefineTerminal<G, R"(\^)"> OP_EXP(bf::Right);
 
 bf::DefineTerminal<G, R"(\*)"> OP_MUL(bf::Left);
@@ -107,3 +114,1092 @@ TEST(Tokenization, Permissive)
     ASSERT_EQ(tokens[2].terminal, &NUMBER);
     ASSERT_EQ(tokens[2].location.begin, 9);
 }
+
+TEST(Parser, CheckpointResume)
+{
+    auto parser = *bf::SLRParser<G>::Build(statement);
+
+    auto checkpoint = parser.ParsePrefix("2 * (3 + ");
+    ASSERT_TRUE(checkpoint.has_value());
+    ASSERT_EQ(checkpoint->Position(), 9);
+
+    auto first = parser.Parse("2 * (3 + 4)", *checkpoint);
+    ASSERT_TRUE(first.has_value());
+    ASSERT_EQ(*first, 14.0);
+
+    auto second = parser.Parse("2 * (3 + 1) ^ 2", *checkpoint);
+    ASSERT_TRUE(second.has_value());
+    ASSERT_EQ(*second, 32.0);
+
+    ASSERT_FALSE(parser.Parse("2 * (3 + )", *checkpoint).has_value());
+
+    // Checkpoints only resume on inputs reaching them, in the parser and dialect they were created with.
+    auto resumable = parser.ParsePrefix("1 + 2 + ");
+    ASSERT_TRUE(resumable.has_value());
+    ASSERT_FALSE(parser.Parse("1", *resumable).has_value());
+    ASSERT_FALSE(parser.ParsePrefix("1", *resumable).has_value());
+    ASSERT_FALSE(parser.Parse("1 + 2 + 3", *resumable, nullptr, 1).has_value());
+
+    auto other = *bf::SLRParser<G>::Build(statement, { .renumber_states = false });
+    ASSERT_FALSE(other.Parse("2 * (3 + 4)", *checkpoint).has_value());
+}
+
+TEST(Parser, CheckpointHoldsBackBoundaryToken)
+{
+    auto parser = *bf::SLRParser<G>::Build(statement);
+
+    auto checkpoint = parser.ParsePrefix("1 + 12");
+    ASSERT_TRUE(checkpoint.has_value());
+    ASSERT_EQ(checkpoint->Position(), 4);
+
+    auto result = parser.Parse("1 + 123", *checkpoint);
+    ASSERT_TRUE(result.has_value());
+    ASSERT_EQ(*result, 124.0);
+}
+
+TEST(Parser, OperatorPrecedenceFastPath)
+{
+    auto parser = *bf::SLRParser<G>::Build(statement);
+
+    // Resumed parses do not use the fast path and walk the full automaton.
+    auto automaton = *parser.ParsePrefix("");
+
+    for(auto input : {"2 ^ 3 ^ 2", "8 - 3 - 2", "2 * 3 + 4 * 5 ^ 2 - 1", "(1 + 2) * (3 - (4 / 2)) ^ 2", "1 + 2 )", "1 + * 2", "1 + 2 $"})
+    {
+        auto fast = parser.Parse(input);
+        auto reference = parser.Parse(input, automaton);
+
+        ASSERT_EQ(fast.has_value(), reference.has_value()) << input;
+        if(fast)
+        {
+            ASSERT_EQ(*fast, *reference) << input;
+        }
+    }
+
+    ASSERT_EQ(*parser.Parse("2 ^ 3 ^ 2"), 512.0);
+    ASSERT_EQ(*parser.Parse("8 - 3 - 2"), 3.0);
+}
+
+bf::DefineNonTerminal<G> number_list
+    = (NUMBER + number_list)<=>[](auto &$) { return $[1] + 1; }
+    | bf::PR<G>(NUMBER)<=>[](auto &$) { return 1.0; }
+    ;
+
+TEST(Analysis, RightRecursion)
+{
+    auto calculator = *bf::SLRParser<G>::Build(statement);
+    ASSERT_TRUE(calculator.GetBuildReport().right_recursions.empty());
+
+    auto parser = *bf::SLRParser<G>::Build(number_list);
+    ASSERT_EQ(*parser.Parse("1 2 3 4"), 4.0);
+
+    auto const &recursions = parser.GetBuildReport().right_recursions;
+    ASSERT_EQ(recursions.size(), 1);
+    ASSERT_EQ(recursions[0].non_terminal, &number_list);
+    ASSERT_EQ(recursions[0].rule_index, 0);
+    ASSERT_EQ(recursions[0].stack_growth, 1);
+
+    std::vector<bf::Symbol<G>> left_recursive = {&number_list, &NUMBER};
+    ASSERT_EQ(recursions[0].left_recursive_sequence, left_recursive);
+}
+
+/*
+ * Repetition
+ */
+using L = bf::GrammarDefinition<std::variant<double, std::vector<double>>>;
+
+bf::DefineTerminal<L, R"(\d+)", double> L_NUMBER([](auto const &tok) -> L::ValueType {
+    return std::stod(std::string(tok.raw));
+});
+
+bf::DefineTerminal<L, R"(\[)"> L_OPEN;
+bf::DefineTerminal<L, R"(\])"> L_CLOSE;
+bf::DefineTerminal<L, R"(-)"> L_MINUS([](auto const &tok) -> L::ValueType {
+    return -1.0;
+});
+
+bf::DefineNonTerminal<L, double> l_item
+    = (bf::Optional(L_MINUS) + L_NUMBER)<=>[](auto &$) -> L::ValueType
+    {
+        // An absent sign is a default constructed value.
+        return std::get<double>($[0]) < 0 ? -std::get<double>($[1]) : std::get<double>($[1]);
+    }
+    ;
+
+bf::DefineNonTerminal<L, std::vector<double>> l_array
+    = (L_OPEN + bf::ZeroOrMore<std::vector<double>>(l_item) + L_CLOSE)<=>[](auto &$) { return std::move($[1]); }
+    | (L_NUMBER + bf::OneOrMore<std::vector<double>>(L_NUMBER))<=>[](auto &$) { return std::move($[1]); }
+    ;
+
+TEST(Repetition, Combinators)
+{
+    auto parser = bf::SLRParser<L>::Build(l_array);
+    ASSERT_TRUE(parser.has_value());
+    ASSERT_TRUE(parser->GetBuildReport().right_recursions.empty());
+
+    auto empty = parser->Parse("[]");
+    ASSERT_TRUE(empty.has_value());
+    ASSERT_EQ(std::get<std::vector<double>>(*empty), std::vector<double>{});
+
+    auto items = parser->Parse("[1 -2 3]");
+    ASSERT_TRUE(items.has_value());
+    ASSERT_EQ(std::get<std::vector<double>>(*items), (std::vector<double>{1, -2, 3}));
+
+    auto tail = parser->Parse("0 4 5");
+    ASSERT_TRUE(tail.has_value());
+    ASSERT_EQ(std::get<std::vector<double>>(*tail), (std::vector<double>{4, 5}));
+
+    ASSERT_FALSE(parser->Parse("0").has_value());
+}
+
+/*
+ * Grammar Optimization
+ */
+bf::DefineNonTerminal<G> unproductive
+    = (OP_MUL + unproductive)<=>[](auto &$) { return $[1]; }
+    ;
+
+bf::DefineNonTerminal<G> operand
+    = bf::PR<G>(NUMBER)<=>bf::Forward<G>
+    | bf::PR<G>(unproductive)<=>bf::Forward<G>
+    ;
+
+bf::DefineNonTerminal<G> sum
+    = (operand + OP_ADD + NUMBER)<=>[](auto &$) { return $[0] + $[2]; }
+    ;
+
+TEST(Analysis, GrammarOptimization)
+{
+    auto parser = bf::SLRParser<G>::Build(sum);
+    ASSERT_TRUE(parser.has_value());
+
+    auto const &report = parser->GetBuildReport();
+    ASSERT_EQ(report.removed_nonterminals, std::vector<bf::NonTerminal<G>*>{&unproductive});
+    ASSERT_EQ(report.inlined_nonterminals, std::vector<bf::NonTerminal<G>*>{&operand});
+
+    ASSERT_FALSE(parser->GetGrammar().HasNonTerminal(operand));
+    ASSERT_EQ(*parser->Parse("1 + 2"), 3.0);
+    ASSERT_FALSE(parser->Parse("* 1 + 2").has_value());
+
+    ASSERT_FALSE(bf::SLRParser<G>::Build(unproductive).has_value());
+}
+
+bf::DefineNonTerminal<G> negation
+    = bf::PR<G>(OP_NEG)<=>bf::Forward<G>
+    ;
+
+bf::DefineNonTerminal<G> signed_expression
+    = bf::PR<G>(NUMBER)<=>[](auto &$) { return $[0]; }
+    | (signed_expression + OP_ADD + signed_expression)<=>[](auto &$) { return $[0] + $[2]; }
+    | (negation + signed_expression)<=>[](auto &$) { return -$[1]; }
+    ;
+
+bf::DefineNonTerminal<G> signed_statement
+    = bf::PR<G>(signed_expression)<=>[](auto &$) { return $[0]; }
+    ;
+
+TEST(Analysis, InliningKeepsPrecedence)
+{
+    auto parser = bf::SLRParser<G>::Build(signed_statement);
+    ASSERT_TRUE(parser.has_value());
+    ASSERT_EQ(parser->GetBuildReport().inlined_nonterminals, std::vector<bf::NonTerminal<G>*>{&negation});
+
+    // `negation signed_expression` has no precedence, so `+` is shifted as without inlining.
+    ASSERT_EQ(*parser->Parse("~2 + 3"), -5.0);
+}
+
+TEST(Parser, StateRenumbering)
+{
+    auto renumbered = *bf::SLRParser<G>::Build(statement);
+    auto discovery = *bf::SLRParser<G>::Build(statement, { .renumber_states = false });
+
+    for(auto input : { "1", "3 * 3 + 4^2 - (9 / 3)", "2^3^2 - (1 - (2 - 3)) * 4", "((7))" })
+    {
+        std::vector<bf::Token<G>> renumbered_tokens, discovery_tokens;
+
+        auto a = renumbered.Parse(input, &renumbered_tokens);
+        auto b = discovery.Parse(input, &discovery_tokens);
+
+        ASSERT_TRUE(a.has_value());
+        ASSERT_TRUE(b.has_value());
+        ASSERT_EQ(*a, *b);
+        ASSERT_EQ(renumbered_tokens.size(), discovery_tokens.size());
+    }
+
+    ASSERT_FALSE(renumbered.Parse("1 + * 2").has_value());
+    ASSERT_FALSE(discovery.Parse("1 + * 2").has_value());
+}
+
+TEST(Parser, ProfileGuidedBuild)
+{
+    auto instrumented = *bf::SLRParser<G>::Build(statement);
+
+    bf::ParseProfile recorded;
+    ASSERT_FALSE(instrumented.Instrument(&recorded).has_value());
+    ASSERT_TRUE(instrumented.Parse("1 + 2 * 3 - (4 / 2) + 5").has_value());
+    ASSERT_TRUE(instrumented.Parse("(1 + 1) ^ 2").has_value());
+    instrumented.Instrument(nullptr);
+
+    std::stringstream file;
+    recorded.Save(file);
+
+    auto profile = bf::ParseProfile::Load(file);
+    ASSERT_TRUE(profile.has_value());
+    ASSERT_GT(profile->Visits(0), 0);
+
+    auto optimized = bf::SLRParser<G>::Build(statement, { .profile = &*profile });
+    ASSERT_TRUE(optimized.has_value());
+
+    for(auto input : { "3 * 3 + 4^2 - (9 / 3)", "((7))", "2^3^2 - 1" })
+    {
+        ASSERT_EQ(*optimized->Parse(input), *instrumented.Parse(input));
+    }
+    ASSERT_FALSE(optimized->Parse("1 + * 2").has_value());
+    ASSERT_FALSE(optimized->Parse("(1 + 2").has_value());
+
+    // Counters recorded for another grammar are rejected.
+    ASSERT_FALSE(bf::SLRParser<G>::Build(number_list, { .profile = &*profile }).has_value());
+
+    // So are malformed files.
+    for(auto text : { "buffalo-profile 2 0 4294967296 4294967296\n1 0 5\n", "buffalo-profile 2 0 2 2\n2 0 5\n", "buffalo-profile 2 0 2 2\n1 x\n", "buffalo-profile 1 0 2 2\n" })
+    {
+        std::stringstream malformed(text);
+        ASSERT_FALSE(bf::ParseProfile::Load(malformed).has_value()) << text;
+    }
+}
+
+/*
+ * Grammar with two terminals that both match `a`, scanned as whichever is tried first.
+ */
+bf::DefineTerminal<G, R"(a|b)"> K_AB;
+bf::DefineTerminal<G, R"(a|c)"> K_AC;
+bf::DefineTerminal<G, R"(\d+)"> K_NUMBER;
+
+bf::DefineNonTerminal<G> k_word
+    = bf::PR<G>(K_AB)<=>[](auto &) { return 1.0; }
+    | bf::PR<G>(K_AC)<=>[](auto &) { return 2.0; }
+    | bf::PR<G>(K_NUMBER)<=>[](auto &) { return 0.0; }
+    ;
+
+bf::DefineNonTerminal<G> k_words
+    = bf::PR<G>(k_word)<=>[](auto &$) { return $[0]; }
+    | (k_words + k_word)<=>[](auto &$) { return $[0] + $[1]; }
+    ;
+
+bf::DefineNonTerminal<G> k_text
+    = bf::PR<G>(k_words)<=>[](auto &$) { return $[0]; }
+    ;
+
+TEST(Parser, ProfileKeepsOverlappingTerminalsInOrder)
+{
+    auto plain = *bf::SLRParser<G>::Build(k_text);
+
+    std::vector<bf::Token<G>> tokens;
+    ASSERT_TRUE(plain.Parse("a", &tokens).has_value());
+    bool ab_first = tokens[0].terminal == &K_AB;
+
+    // Traffic where the terminal `a` is not scanned as is the most frequent, along with numbers.
+    bf::ParseProfile profile;
+    ASSERT_FALSE(plain.Instrument(&profile).has_value());
+    ASSERT_TRUE(plain.Parse(ab_first ? "c c c c 1 2 3 4 5 a" : "b b b b 1 2 3 4 5 a").has_value());
+    plain.Instrument(nullptr);
+
+    auto optimized = *bf::SLRParser<G>::Build(k_text, { .profile = &profile });
+    ASSERT_EQ(*optimized.Parse("a b c 7 a"), *plain.Parse("a b c 7 a"));
+
+    tokens.clear();
+    ASSERT_TRUE(optimized.Parse("a", &tokens).has_value());
+    ASSERT_EQ(tokens[0].terminal, ab_first ? static_cast<bf::Terminal<G>*>(&K_AB) : &K_AC);
+}
+
+TEST(Parser, NarrowTables)
+{
+    auto narrow = *bf::SLRParser<G>::Build(statement);
+    auto wide = *bf::SLRParser<G>::Build(statement, { .narrow_tables = false });
+
+    ASSERT_EQ(narrow.GetBuildReport().action_entry_size, 2);
+    ASSERT_EQ(wide.GetBuildReport().action_entry_size, 4);
+
+    for(auto input : { "3 * 3 + 4^2 - (9 / 3)", "((7))", "2^3^2 - 1" })
+    {
+        ASSERT_EQ(*narrow.Parse(input), *wide.Parse(input));
+    }
+    ASSERT_FALSE(narrow.Parse("1 + * 2").has_value());
+}
+
+/*
+ * Grammar with two states of identical behavior: after `c`, `pair` loses its shift of `a` to the reduction of `item`,
+ * as `c` is defined before `a` and binds tighter.
+ */
+bf::DefineTerminal<G, R"(c)"> M_C;
+bf::DefineTerminal<G, R"(a)"> M_A;
+bf::DefineTerminal<G, R"(b)"> M_B;
+
+bf::DefineNonTerminal<G> m_item
+    = bf::PR<G>(M_C)<=>[](auto &$) { return 1.0; }
+    ;
+
+bf::DefineNonTerminal<G> m_pair
+    = (M_C + M_A)<=>[](auto &$) { return 2.0; }
+    ;
+
+bf::DefineNonTerminal<G> m_root
+    = (M_A + m_item + M_B)<=>[](auto &$) { return $[1] + 10.0; }
+    | (M_B + m_item + M_A)<=>[](auto &$) { return $[1] + 20.0; }
+    | (M_B + m_pair)<=>[](auto &$) { return $[1] + 30.0; }
+    ;
+
+TEST(Parser, StateMerging)
+{
+    auto merged = *bf::SLRParser<G>::Build(m_root);
+    auto unmerged = *bf::SLRParser<G>::Build(m_root, { .merge_states = false });
+
+    ASSERT_GE(merged.GetBuildReport().merged_states, 1);
+    ASSERT_EQ(unmerged.GetBuildReport().merged_states, 0);
+
+    for(auto input : { "acb", "bca", "a c b" })
+    {
+        auto a = merged.Parse(input);
+        auto b = unmerged.Parse(input);
+
+        ASSERT_TRUE(a.has_value());
+        ASSERT_TRUE(b.has_value());
+        ASSERT_EQ(*a, *b);
+    }
+
+    for(auto input : { "aca", "bcb", "ac", "bcab" })
+    {
+        ASSERT_FALSE(merged.Parse(input).has_value());
+        ASSERT_FALSE(unmerged.Parse(input).has_value());
+    }
+
+    // Expression grammar is unaffected.
+    auto calculator = *bf::SLRParser<G>::Build(statement);
+    ASSERT_EQ(*calculator.Parse("3 * 3 + 4^2 - (9 / 3)"), 22.0);
+}
+
+/*
+ * LR(1) grammar that is neither SLR nor LALR: after `a c` and `b c`, the reductions to `n_first` and `n_second` are
+ * told apart by the next terminal, which SLR FOLLOW sets (and LALR merging) cannot do.
+ */
+bf::DefineTerminal<G, R"(d)"> N_D;
+bf::DefineTerminal<G, R"(e)"> N_E;
+
+bf::DefineNonTerminal<G> n_first
+    = bf::PR<G>(M_C)<=>[](auto &$) { return 1.0; }
+    ;
+
+bf::DefineNonTerminal<G> n_second
+    = bf::PR<G>(M_C)<=>[](auto &$) { return 2.0; }
+    ;
+
+bf::DefineNonTerminal<G> n_root
+    = (M_A + n_first + N_D)<=>[](auto &$) { return $[1] + 10.0; }
+    | (M_B + n_second + N_D)<=>[](auto &$) { return $[1] + 20.0; }
+    | (M_A + n_second + N_E)<=>[](auto &$) { return $[1] + 30.0; }
+    | (M_B + n_first + N_E)<=>[](auto &$) { return $[1] + 40.0; }
+    ;
+
+TEST(Parser, LR1)
+{
+    ASSERT_FALSE(bf::SLRParser<G>::Build(n_root).has_value());
+
+    auto parser = bf::LR1Parser<G>::Build(n_root);
+    ASSERT_TRUE(parser.has_value());
+
+    ASSERT_EQ(*parser->Parse("acd"), 11.0);
+    ASSERT_EQ(*parser->Parse("bcd"), 22.0);
+    ASSERT_EQ(*parser->Parse("ace"), 32.0);
+    ASSERT_EQ(*parser->Parse("bce"), 41.0);
+    ASSERT_FALSE(parser->Parse("acc").has_value());
+
+    // Weakly compatible states are merged, so an SLR grammar keeps its LR(0) state count.
+    auto slr = *bf::SLRParser<G>::Build(statement);
+    auto lr1 = *bf::LR1Parser<G>::Build(statement);
+
+    ASSERT_EQ(lr1.GetBuildReport().states, slr.GetBuildReport().states);
+    for(auto input : { "3 * 3 + 4^2 - (9 / 3)", "2^3^2 - (1 - (2 - 3)) * 4" })
+    {
+        ASSERT_EQ(*lr1.Parse(input), *slr.Parse(input));
+    }
+}
+
+/**
+ * Runs tasks immediately on the submitting thread.
+ */
+struct InlineExecutor
+{
+    std::size_t executed = 0;
+
+    void Execute(std::function<void()> task)
+    {
+        this->executed++;
+        task();
+    }
+};
+
+TEST(Parser, ParseAsync)
+{
+    auto parser = *bf::SLRParser<G>::Build(statement);
+
+    bf::ThreadPool pool(4);
+
+    std::vector<std::future<std::expected<double, bf::Error>>> results;
+    for(int i = 0; i < 32; i++)
+    {
+        results.push_back(bf::ParseAsync(parser, std::to_string(i) + " * 2 + (1 - 1)", pool));
+    }
+    for(int i = 0; i < 32; i++)
+    {
+        auto result = results[i].get();
+        ASSERT_TRUE(result.has_value());
+        ASSERT_EQ(*result, i * 2.0);
+    }
+
+    InlineExecutor executor;
+    auto error = bf::ParseAsync(parser, "1 + * 2", executor);
+    ASSERT_EQ(executor.executed, 1);
+    ASSERT_FALSE(error.get().has_value());
+
+    ASSERT_EQ(*bf::ParseAsync(parser, "4^2").get(), 16.0);
+}
+
+TEST(Tokenization, RuntimeDFA)
+{
+    auto match = [](std::string_view pattern, std::string_view input) { return bf::DFA::Compile(pattern)->Match(input); };
+
+    ASSERT_EQ(match("a|ab", "abc"), 2);
+    ASSERT_EQ(match("(ab)*c", "ababc"), 5);
+    ASSERT_EQ(match("(?:ab)+", "c"), std::nullopt);
+    ASSERT_EQ(match("\\d{2,3}", "12345"), 3);
+    ASSERT_EQ(match("x{2}", "xxx"), 2);
+    ASSERT_EQ(match("[^0-9\\s]+", "abc1"), 3);
+    ASSERT_EQ(match("[a-c\\-]*", "b-ad"), 3);
+    ASSERT_EQ(match("0x[0-9a-fA-F]+", "0xFFg"), 4);
+    ASSERT_EQ(match("a?", "b"), 0);
+    ASSERT_EQ(match("(a|b)*abb", "abababb!"), 7);
+
+    for(auto invalid : { "(ab", "ab)", "[a-", "*a", "a{3,2}", "a**", "\\" })
+    {
+        ASSERT_FALSE(bf::DFA::Compile(invalid).has_value());
+    }
+
+    // Unsupported syntax is not matched literally.
+    for(auto unsupported : { "\\bif\\b", "^if", "a$", "\\x41", "\\u0041", "[[:alpha:]]" })
+    {
+        ASSERT_FALSE(bf::DFA::Compile(unsupported).has_value()) << unsupported;
+    }
+    ASSERT_EQ(match("\\$\\^", "$^"), 2);
+
+    // State explosion, from subset construction or nested counted repetitions.
+    ASSERT_EQ(bf::DFA::Compile("(a|b)*a(a|b){12}")->StateCount(), 8193);
+    ASSERT_FALSE(bf::DFA::Compile("(a|b)*a(a|b){15}").has_value());
+    ASSERT_FALSE(bf::DFA::Compile("((a{1000}){1000}){1000}").has_value());
+
+    // Several DFAs in a single pass, each matching what it matches on its own.
+    auto keyword = *bf::DFA::Compile("if");
+    auto word = *bf::DFA::Compile("[a-z]+");
+    auto number = *bf::DFA::Compile("\\d+");
+    std::array<bf::DFA const *, 3> dfas = { &keyword, &word, &number };
+    auto combined = bf::CombinedDFA::Combine(dfas);
+    ASSERT_TRUE(combined.has_value());
+
+    std::vector<std::int32_t> path;
+    std::array<std::uint64_t, 1> all = { 0b111 };
+    combined->Run("ifx 1", all, path);
+    ASSERT_EQ(combined->Longest(path, 0), 2);
+    ASSERT_EQ(combined->Longest(path, 1), 3);
+    ASSERT_EQ(combined->Longest(path, 2), std::nullopt);
+
+    // The run stops once no DFA of the mask can go on.
+    std::array<std::uint64_t, 1> keywords = { 0b001 };
+    combined->Run("ifx 1", keywords, path);
+    ASSERT_EQ(path.size(), 3);
+    ASSERT_EQ(combined->Longest(path, 0), 2);
+}
+
+TEST(Tokenization, RuntimeTerminal)
+{
+    using R = bf::GrammarDefinition<double>;
+
+    bf::RuntimeTerminal<R> hex("0x[0-9a-fA-F]+", [](auto const &tok) { return static_cast<double>(std::stoul(std::string(tok.raw), nullptr, 16)); });
+    bf::RuntimeTerminal<R> plus("plus", bf::Left);
+
+    bf::DefineNonTerminal<R> sum
+        = bf::PR<R>(hex)<=>[](auto &$) { return $[0]; }
+        | (sum + plus + sum)<=>[](auto &$) { return $[0] + $[2]; }
+        ;
+
+    bf::DefineNonTerminal<R> result
+        = bf::PR<R>(sum)<=>[](auto &$) { return $[0]; }
+        ;
+
+    auto parser = bf::SLRParser<R>::Build(result);
+    ASSERT_TRUE(parser.has_value());
+    ASSERT_EQ(*parser->Parse("0x10 plus 0xff plus 0x1"), 272.0);
+
+    bf::RuntimeTerminal<R> broken("[unterminated");
+    bf::DefineNonTerminal<R> bad
+        = bf::PR<R>(broken)<=>[](auto &$) { return 0.0; }
+        ;
+    ASSERT_FALSE(bf::SLRParser<R>::Build(bad).has_value());
+
+    bf::RuntimeTerminal<R> explosive("(a|b)*a(a|b){15}");
+    bf::DefineNonTerminal<R> exploding
+        = bf::PR<R>(explosive)<=>[](auto &) { return 0.0; }
+        ;
+    ASSERT_FALSE(bf::SLRParser<R>::Build(exploding).has_value());
+
+    // Terminals are compiled once, even by concurrent builds.
+    bf::RuntimeTerminal<R> number("\\d+", [](auto const &tok) { return std::stod(std::string(tok.raw)); });
+    bf::RuntimeTerminal<R> times("\\*|times", bf::Left);
+    bf::DefineNonTerminal<R> product
+        = bf::PR<R>(number)<=>[](auto &$) { return $[0]; }
+        | (product + times + product)<=>[](auto &$) { return $[0] * $[2]; }
+        ;
+    bf::DefineNonTerminal<R> products
+        = bf::PR<R>(product)<=>[](auto &$) { return $[0]; }
+        ;
+
+    std::vector<std::optional<std::expected<bf::SLRParser<R>, bf::Error>>> parsers(4);
+    {
+        std::vector<std::jthread> builds;
+        for(auto &built : parsers)
+        {
+            builds.emplace_back([&] { built.emplace(bf::SLRParser<R>::Build(products)); });
+        }
+    }
+    for(auto &built : parsers)
+    {
+        ASSERT_TRUE(built->has_value());
+        ASSERT_EQ(*(*built)->Parse("2 * 3 times 4"), 24.0);
+    }
+}
+
+TEST(GrammarFile, Load)
+{
+    bf::ActionRegistry<G> actions;
+    actions
+        .Reasoner("number", [](auto const &tok) { return std::stod(std::string(tok.raw)); })
+        .Action("forward", bf::Forward<G>)
+        .Action("group", [](auto &$) { return $[1]; })
+        .Action("pow", [](auto &$) { return std::pow($[0], $[2]); })
+        .Action("mul", [](auto &$) { return $[0] * $[2]; })
+        .Action("div", [](auto &$) { return $[0] / $[2]; })
+        .Action("add", [](auto &$) { return $[0] + $[2]; })
+        .Action("sub", [](auto &$) { return $[0] - $[2]; })
+        ;
+
+    auto file = bf::GrammarFile<G>::Load(R"y(
+        %token NUMBER /\d+(\.\d+)?/ number
+        %token POW "^"
+        %token MUL "*"
+        %token DIV "/"
+        %token ADD "+"
+        %token SUB "-"
+        %token OPEN "("
+        %token CLOSE ")"
+
+        %left ADD SUB
+        %left MUL DIV
+        %right POW   /* binds tightest */
+        %start statement
+        %%
+        statement : expression ;        // $$ = $1
+
+        expression
+            : NUMBER
+            | OPEN expression CLOSE     { group }
+            | expression POW expression { pow }
+            | expression MUL expression { mul }
+            | expression DIV expression { div }
+            | expression ADD expression { add }
+            | expression SUB expression { sub }
+            ;
+    )y", actions);
+    ASSERT_TRUE(file.has_value()) << file.error().message;
+
+    auto parser = bf::SLRParser<G>::Build(file->Root());
+    ASSERT_TRUE(parser.has_value());
+
+    // Same tables and results as the calculator defined in C++.
+    auto calculator = *bf::SLRParser<G>::Build(statement);
+    ASSERT_EQ(parser->GetBuildReport().states, calculator.GetBuildReport().states);
+    ASSERT_EQ(*parser->Parse("2 ^ 3 ^ 2 - 10 / 2 * (4 - 3) - 1"), *calculator.Parse("2 ^ 3 ^ 2 - 10 / 2 * (4 - 3) - 1"));
+
+    auto unknown = bf::GrammarFile<G>::Load("%token A \"a\"\n%%\nroot : A { missing } ;", actions);
+    ASSERT_FALSE(unknown.has_value());
+    ASSERT_EQ(unknown.error().message, "Unknown action 'missing' on line 3");
+
+    ASSERT_FALSE(bf::GrammarFile<G>::Load("%%\nroot : undefined ;", actions).has_value());
+}
+
+TEST(GrammarFile, PortableProfile)
+{
+    bf::ActionRegistry<G> actions;
+    actions
+        .Reasoner("number", [](auto const &tok) { return std::stod(std::string(tok.raw)); })
+        .Action("add", [](auto &$) { return $[0] + $[2]; })
+        .Action("mul", [](auto &$) { return $[0] * $[2]; })
+        ;
+
+    std::string rules = R"y(
+        %left ADD
+        %left MUL
+        %%
+        statement : expression ;
+        expression : NUMBER | expression ADD expression { add } | expression MUL expression { mul } ;
+    )y";
+
+    // Terminals are allocated in declaration order, so their ACTION columns differ between both files.
+    auto forward = bf::GrammarFile<G>::Load("%token NUMBER /\\d+/ number\n%token ADD \"+\"\n%token MUL \"*\"\n" + rules, actions);
+    auto backward = bf::GrammarFile<G>::Load("%token MUL \"*\"\n%token ADD \"+\"\n%token NUMBER /\\d+/ number\n" + rules, actions);
+    ASSERT_TRUE(forward.has_value() && backward.has_value());
+
+    std::string saved[2];
+    for(auto [file, out] : { std::pair(&*forward, &saved[0]), std::pair(&*backward, &saved[1]) })
+    {
+        auto parser = *bf::SLRParser<G>::Build(file->Root());
+
+        bf::ParseProfile profile;
+        ASSERT_FALSE(parser.Instrument(&profile).has_value());
+        ASSERT_TRUE(parser.Parse("1 + 2 * 3 + 4").has_value());
+
+        std::stringstream stream;
+        profile.Save(stream);
+        *out = stream.str();
+    }
+
+    // The same traffic gives the same counters, so a profile applies to the other file.
+    ASSERT_EQ(saved[0], saved[1]);
+
+    std::stringstream stream(saved[0]);
+    auto profile = bf::ParseProfile::Load(stream);
+    ASSERT_TRUE(profile.has_value());
+
+    auto optimized = bf::SLRParser<G>::Build(backward->Root(), { .profile = &*profile });
+    ASSERT_TRUE(optimized.has_value());
+    ASSERT_EQ(*optimized->Parse("2 * 3 + 4 * 5"), 26.0);
+
+    // Traces use the same ids, and only replay with the options they were recorded with.
+    std::vector<std::byte> trace;
+    ASSERT_TRUE(bf::SLRParser<G>::Build(forward->Root())->ParseTraced("2 * 3 + 4 * 5", trace).has_value());
+    ASSERT_EQ(*bf::SLRParser<G>::Build(backward->Root())->Replay("2 * 3 + 4 * 5", trace), 26.0);
+    ASSERT_FALSE(optimized->Replay("2 * 3 + 4 * 5", trace).has_value());
+
+    // Another automaton is rejected.
+    auto right = bf::GrammarFile<G>::Load("%token NUMBER /\\d+/ number\n%token ADD \"+\"\n%token MUL \"*\"\n%right ADD\n%left MUL\n%%\nstatement : expression ;\nexpression : NUMBER | expression ADD expression { add } | expression MUL expression { mul } ;", actions);
+    ASSERT_TRUE(right.has_value());
+    ASSERT_FALSE(bf::SLRParser<G>::Build(right->Root(), { .profile = &*profile }).has_value());
+}
+
+TEST(Parser, FlatTree)
+{
+    auto parser = *bf::SLRParser<G>::Build(statement);
+
+    std::string input = "1 + 2 * (3 - 4)";
+    auto bytes = parser.ParseFlatTree(input);
+    ASSERT_TRUE(bytes.has_value());
+
+    // Relocate into another (8-byte aligned) buffer, as a mapped file would be.
+    std::vector<std::uint64_t> storage((bytes->size() + 7) / 8);
+    std::memcpy(storage.data(), bytes->data(), bytes->size());
+    auto tree = bf::FlatTree::View(std::as_bytes(std::span(storage)).first(bytes->size()));
+    ASSERT_TRUE(tree.has_value());
+
+    ASSERT_TRUE(tree->Matches(input));
+    ASSERT_FALSE(tree->Matches("1 + 2 * (3 - 5)"));
+    ASSERT_EQ(tree->GrammarFingerprint(), parser.TreeFingerprint());
+    ASSERT_EQ(tree->GrammarFingerprint(), bf::SLRParser<G>::Build(statement, { .renumber_states = false })->TreeFingerprint());
+
+    auto const &root = tree->Root();
+    ASSERT_EQ(root.symbol, parser.NonTerminalId(statement));
+    ASSERT_EQ(root.begin, 0);
+    ASSERT_EQ(root.end, input.size());
+
+    // statement -> (expression -> expression OP_ADD expression)
+    auto const &sum = tree->Nodes()[tree->Children(root)[0]];
+    ASSERT_EQ(tree->Children(sum).size(), 3);
+    auto const &op = tree->Nodes()[tree->Children(sum)[1]];
+    ASSERT_EQ(op.symbol, bf::FlatTree::kLeaf);
+    ASSERT_EQ(tree->Tokens()[op.first].terminal, parser.TerminalId(OP_ADD));
+
+    ASSERT_EQ(tree->Tokens().size(), 9);
+    ASSERT_FALSE(bf::FlatTree::View(std::as_bytes(std::span(storage)).first(bytes->size() - 4)).has_value());
+
+    // Offsets past the end of the input.
+    for(auto field : { &tree->Tokens()[0].end, &root.end })
+    {
+        std::vector<std::uint64_t> corrupted = storage;
+        std::uint32_t end = input.size() + 1;
+        std::memcpy(reinterpret_cast<std::byte*>(corrupted.data()) + (reinterpret_cast<std::byte const*>(field) - reinterpret_cast<std::byte const*>(storage.data())), &end, sizeof(end));
+        ASSERT_FALSE(bf::FlatTree::View(std::as_bytes(std::span(corrupted)).first(bytes->size())).has_value());
+    }
+}
+
+TEST(Tokenization, RegexLint)
+{
+    static_assert(decltype(NUMBER)::kLint.Linear());
+    static_assert(decltype(NUMBER)::kLint.dfa_compatible);
+
+    static_assert(bf::LintRegex<R"((a+)+b)">().hazard == bf::RegexHazard::kNestedQuantifier);
+    static_assert(bf::LintRegex<R"("(\\.|[^"])*")">().hazard == bf::RegexHazard::kOverlappingAlternation);
+    static_assert(bf::LintRegex<R"("(\\.|[^"\\])*")">().Linear());
+    static_assert(bf::LintRegex<R"(//[^\n]*)">().Linear());
+    static_assert(bf::LintRegex<R"(\d+(,\d+)*)">().Linear());
+    static_assert(bf::LintRegex<R"([a-z]+(_[a-z]+)*)">().Linear());
+    static_assert(bf::LintRegex<R"((a+a)+b)">().hazard == bf::RegexHazard::kNestedQuantifier);
+
+    static_assert(!bf::LintRegex<R"(\bif\b)">().dfa_compatible);
+    static_assert(!bf::LintRegex<R"(a+?)">().dfa_compatible);
+
+    // ctre matches "if" in "ifx", bf::DFA all of it.
+    static_assert(!bf::LintRegex<R"(if|ifx)">().dfa_compatible);
+    static_assert(!bf::LintRegex<R"(a*(ab)?)">().dfa_compatible);
+    static_assert(!bf::LintRegex<R"((?:|a)b?)">().dfa_compatible);
+    static_assert(bf::LintRegex<R"(if|else|[0-9]+)">().dfa_compatible);
+    static_assert(bf::LintRegex<R"([a-z_]\w*)">().dfa_compatible);
+
+    static_assert(bf::LintRegex<R"([a-z]+)">().CanStartWith('q') && !bf::LintRegex<R"([a-z]+)">().CanStartWith('0'));
+    static_assert(bf::LintRegex<R"((?:if|do)x)">().CanStartWith('d') && !bf::LintRegex<R"((?:if|do)x)">().CanStartWith('x'));
+    static_assert(bf::LintRegex<R"(a*)">().CanStartWith('0'));
+
+    auto lint = bf::LintRegex(R"(x(\w+\s?)*)");
+    ASSERT_EQ(lint.hazard, bf::RegexHazard::kNestedQuantifier);
+    ASSERT_EQ(lint.position, 9);
+}
+
+TEST(Tokenization, UTF8)
+{
+    std::string ascii(40, 'a');
+    ASSERT_TRUE(bf::ScanUTF8(ascii).Valid());
+    ASSERT_TRUE(bf::ScanUTF8(ascii).ascii);
+
+    ASSERT_TRUE(bf::ScanUTF8("h\xC3\xA9llo \xE2\x82\xAC \xF0\x9F\xA6\xAC").Valid());
+    ASSERT_FALSE(bf::ScanUTF8("h\xC3\xA9llo").ascii);
+
+    ASSERT_EQ(bf::ScanUTF8(ascii + "\xFF" + ascii).error, 40);
+    ASSERT_EQ(bf::ScanUTF8("ab\xC0\x80").error, 2);         // Overlong
+    ASSERT_EQ(bf::ScanUTF8("\xED\xA0\x80").error, 0);       // Surrogate
+    ASSERT_EQ(bf::ScanUTF8("\xF4\x90\x80\x80").error, 0);   // Above U+10FFFF
+    ASSERT_TRUE(bf::ScanUTF8("x\xE2\x82").truncated);
+
+    auto parser = *bf::SLRParser<G>::Build(statement, { .validate_utf8 = true });
+    ASSERT_EQ(*parser.Parse("1 + 2"), 3.0);
+    ASSERT_FALSE(parser.Parse("1 + \xFF").has_value());
+
+    // Validation runs ahead of the scanner, over long inputs and across segments.
+    std::string spaced = "1" + std::string(10000, ' ') + "+ 2";
+    ASSERT_EQ(*parser.Parse(spaced), 3.0);
+    ASSERT_EQ(parser.Parse(spaced + " \xE2\x82").error().message, "Invalid UTF-8");
+
+    std::string_view segments[] = { "1 + 2 \xC3", "(" };
+    ASSERT_EQ(parser.Parse(std::span<std::string_view const>(segments)).error().message, "Invalid UTF-8");
+
+    // A terminal matching single bytes cannot split a character.
+    using U = bf::GrammarDefinition<double>;
+    bf::RuntimeTerminal<U> byte(".");
+    bf::DefineNonTerminal<U> bytes
+        = bf::PR<U>(byte)<=>[](auto &$) { return 1.0; }
+        | (byte + bytes)<=>[](auto &$) { return 1.0 + $[1]; }
+        ;
+    bf::DefineNonTerminal<U> count
+        = bf::PR<U>(bytes)<=>[](auto &$) { return $[0]; }
+        ;
+
+    ASSERT_EQ(*bf::SLRParser<U>::Build(count)->Parse("\xC3\xA9"), 2.0);
+    ASSERT_FALSE(bf::SLRParser<U>::Build(count, { .validate_utf8 = true })->Parse("\xC3\xA9").has_value());
+}
+
+TEST(Parser, Segmented)
+{
+    auto parser = *bf::SLRParser<G>::Build(statement);
+
+    // Tokens straddling one or more boundaries, empty segments, whitespace at boundaries.
+    std::vector<std::string_view> segments = { "1", "2", "", "3.", "4 ", " + ", "(2 *", " 3", ")" };
+    ASSERT_EQ(*parser.Parse(segments), 129.4);
+
+    std::string input = "1";
+    for(int i = 2; i < 300; i++)
+    {
+        input += " + " + std::to_string(i * 37 % 1000) + ".25";
+    }
+
+    std::vector<std::string_view> chunks;
+    for(std::size_t i = 0; i < input.size(); i += 7)
+    {
+        chunks.push_back(std::string_view(input).substr(i, 7));
+    }
+    ASSERT_EQ(*parser.Parse(chunks), *parser.Parse(input));
+
+    chunks.back() = "+";
+    ASSERT_FALSE(parser.Parse(chunks).has_value());
+
+    // Matches that stopped short at a boundary, far from the start of the segment.
+    std::string digits(70, '1');
+    std::string number = digits + ".";
+    std::vector<std::string_view> fraction = { number, "5" };
+    ASSERT_EQ(*parser.Parse(fraction), *parser.Parse(number + "5"));
+
+    std::string sum = "2 + " + digits + ".";
+    std::vector<std::string_view> sums = { sum, "5 + 1" };
+    ASSERT_EQ(*parser.Parse(sums), *parser.Parse(sum + "5 + 1"));
+
+    // Characters cut by segment boundaries.
+    std::vector<std::string_view> text = { "h\xC3", "\xA9llo \xF0\x9F", "\xA6", "\xAC" };
+    ASSERT_TRUE(bf::ScanUTF8(std::span<std::string_view const>(text)).Valid());
+    text[2] = "x";
+    ASSERT_EQ(bf::ScanUTF8(std::span<std::string_view const>(text)).error, 7);
+}
+
+TEST(Parser, TraceReplay)
+{
+    auto parser = *bf::SLRParser<G>::Build(statement);
+    std::string input = "1 + 2 * (3 - 4) ^ 2 / 8";
+
+    std::vector<std::byte> trace;
+    ASSERT_EQ(*parser.ParseTraced(input, trace), *parser.Parse(input));
+    ASSERT_EQ(*parser.Replay(input, trace), *parser.Parse(input));
+
+    // Replays skip the scanner, so they only run on the recorded input.
+    std::string other = input;
+    other[0] = '5';
+    ASSERT_FALSE(parser.Replay(other, trace).has_value());
+    other[0] = 'x';
+    ASSERT_FALSE(parser.Replay(other, trace).has_value());
+
+    ASSERT_FALSE(parser.Replay(input + " ", trace).has_value());
+    ASSERT_FALSE(parser.Replay(input, std::span(trace).first(trace.size() - 3)).has_value());
+
+    // A recorded action that is not the one of the tables: the first shift goes to another state.
+    std::vector<std::byte> corrupted = trace;
+    std::size_t offset = 0;
+    ASSERT_TRUE(bf::ParseTrace::ReadHeader(corrupted, offset).has_value());
+    bf::ParseTrace::Get(corrupted, offset);
+    bf::ParseTrace::Get(corrupted, offset);
+    corrupted[offset] ^= std::byte{4};
+    ASSERT_FALSE(parser.Replay(input, corrupted).has_value());
+
+    trace[8] = std::byte{1};
+    ASSERT_FALSE(parser.Replay(input, trace).has_value());
+}
+
+TEST(Parser, ParseUntil)
+{
+    auto parser = *bf::SLRParser<G>::Build(statement);
+
+    // Stops at the first reduced expression, once the following token has been scanned.
+    auto prefix = parser.ParseUntil("12 + 3 )", expression);
+    ASSERT_TRUE(prefix.has_value());
+    ASSERT_EQ(prefix->value, 12.0);
+    ASSERT_EQ(prefix->offset, 2);
+    ASSERT_TRUE(prefix->stopped);
+
+    bf::DefineNonTerminal<G> unused
+        = bf::PR<G>(NUMBER)<=>[](auto &$) { return $[0]; }
+        ;
+    ASSERT_FALSE(parser.ParseUntil("1", unused).has_value());
+
+    // First K items of a list.
+    using L = bf::GrammarDefinition<double>;
+
+    bf::RuntimeTerminal<L> number("\\d+", [](auto const &tok) { return std::stod(std::string(tok.raw)); });
+    bf::RuntimeTerminal<L> comma(",");
+
+    bf::DefineNonTerminal<L> item
+        = bf::PR<L>(number)<=>[](auto &$) { return $[0]; }
+        ;
+    bf::DefineNonTerminal<L> items
+        = bf::PR<L>(item)<=>[](auto &$) { return $[0]; }
+        | (items + comma + item)<=>[](auto &$) { return $[0] + $[2]; }
+        ;
+    bf::DefineNonTerminal<L> list
+        = bf::PR<L>(items)<=>[](auto &$) { return $[0]; }
+        ;
+
+    auto list_parser = *bf::SLRParser<L>::Build(list);
+
+    int count = 0;
+    auto first = list_parser.ParseUntil("10, 20, 30, 40", [&](bf::NonTerminal<L> const &non_terminal, double)
+    {
+        return &non_terminal == &items && ++count == 2;
+    });
+    ASSERT_EQ(first->value, 30.0);
+    ASSERT_EQ(first->offset, 6);
+
+    auto all = list_parser.ParseUntil("10, 20", [](auto const &, double) { return false; });
+    ASSERT_EQ(all->value, 30.0);
+    ASSERT_EQ(all->offset, 6);
+    ASSERT_FALSE(all->stopped);
+
+    // Default reductions of a profiled build are not applied either, so the token after the stop point is still
+    // scanned and rejected.
+    bf::ParseProfile profile;
+    ASSERT_FALSE(list_parser.Instrument(&profile).has_value());
+    ASSERT_TRUE(list_parser.Parse("1, 2, 3, 4, 5").has_value());
+    list_parser.Instrument(nullptr);
+
+    auto profiled = *bf::SLRParser<L>::Build(list, { .profile = &profile });
+    for(auto *parser : { &list_parser, &profiled })
+    {
+        count = 0;
+        auto stop = [&](bf::NonTerminal<L> const &non_terminal, double)
+        {
+            return &non_terminal == &items && ++count == 2;
+        };
+
+        auto again = parser->ParseUntil("10, 20, 30, 40", stop);
+        ASSERT_EQ(again->value, 30.0);
+        ASSERT_EQ(again->offset, 6);
+
+        count = 0;
+        ASSERT_FALSE(parser->ParseUntil("10, 20 ?", stop).has_value());
+    }
+}
+
+TEST(GrammarFile, SharedTerminals)
+{
+    bf::ActionRegistry<G> actions;
+    actions
+        .Reasoner("number", [](auto const &tok) { return std::stod(std::string(tok.raw)); })
+        .Action("forward", bf::Forward<G>)
+        .Action("add", [](auto &$) { return $[0] + $[2]; })
+        .Action("mul", [](auto &$) { return $[0] * $[2]; })
+        ;
+
+    bf::TerminalRegistry registry;
+
+    auto base = bf::GrammarFile<G>::Load(R"y(
+        %token NUMBER /\d+/ number
+        %token ADD "+"
+        %left ADD
+        %%
+        statement : expression { forward } ;
+        expression : NUMBER { forward } | expression ADD expression { add } ;
+    )y", actions, &registry);
+    ASSERT_TRUE(base.has_value()) << base.error().message;
+
+    auto extended = bf::GrammarFile<G>::Load(R"y(
+        %token NUMBER /\d+/ number
+        %token ADD "+"
+        %token MUL "*"
+        %left ADD
+        %left MUL
+        %%
+        statement : expression { forward } ;
+        expression : NUMBER { forward } | expression ADD expression { add } | expression MUL expression { mul } ;
+    )y", actions, &registry);
+    ASSERT_TRUE(extended.has_value()) << extended.error().message;
+
+    // One scanner per pattern, shared by both dialects.
+    auto pattern_id = [](auto &file, std::string_view name) { return static_cast<bf::RuntimeTerminal<G>*>(file->FindTerminal(name))->RegistryId(); };
+    ASSERT_EQ(registry.Size(), 3);
+    ASSERT_EQ(pattern_id(base, "NUMBER"), 0);
+    ASSERT_EQ(pattern_id(extended, "NUMBER"), 0);
+    ASSERT_EQ(pattern_id(extended, "MUL"), 2);
+
+    // Terminals cannot move to another registry once compiled.
+    bf::TerminalRegistry other;
+    ASSERT_TRUE(static_cast<bf::RuntimeTerminal<G>*>(base->FindTerminal("NUMBER"))->Compile(other).has_value());
+    ASSERT_FALSE(static_cast<bf::RuntimeTerminal<G>*>(base->FindTerminal("NUMBER"))->Compile(registry).has_value());
+
+    // One combined scanner for both parsers, masked down to the terminals of each.
+    auto base_parser = *bf::SLRParser<G>::Build(base->Root());
+    auto extended_parser = *bf::SLRParser<G>::Build(extended->Root());
+    ASSERT_NE(base_parser.GetScanner(), nullptr);
+    ASSERT_EQ(base_parser.GetScanner(), extended_parser.GetScanner());
+    ASSERT_EQ(base_parser.GetScanner()->Size(), 3);
+
+    ASSERT_EQ(*base_parser.Parse("1 + 2"), 3.0);
+    ASSERT_EQ(*extended_parser.Parse("1 + 2 * 3"), 7.0);
+    ASSERT_FALSE(base_parser.Parse("1 * 2").has_value());
+
+    ASSERT_FALSE(bf::GrammarFile<G>::Load("%token A /(a/\n%%\nroot : A { forward } ;", actions, &registry).has_value());
+}
+
+TEST(Parser, FeatureMasks)
+{
+    using D = bf::GrammarDefinition<double>;
+    constexpr bf::FeatureMask kV1 = 1, kV2 = 2;
+
+    bf::RuntimeTerminal<D> number("\\d+", [](auto const &tok) { return std::stod(std::string(tok.raw)); });
+    bf::RuntimeTerminal<D> times("\\*", bf::Left);
+    bf::RuntimeTerminal<D> plus("\\+", bf::Left);
+    times.features = kV2;
+
+    bf::DefineNonTerminal<D> value
+        = bf::PR<D>(number)<=>[](auto &$) { return $[0]; }
+        | (value + times + value).Features(kV2)<=>[](auto &$) { return $[0] * $[2]; }
+        | (value + plus + value)<=>[](auto &$) { return $[0] + $[2]; }
+        | (value + number).Features(kV1)<=>[](auto &$) { return $[0] * 10 + $[1]; }
+        ;
+    bf::DefineNonTerminal<D> program
+        = bf::PR<D>(value)<=>[](auto &$) { return $[0]; }
+        ;
+
+    auto parser = bf::SLRParser<D>::Build(program);
+    ASSERT_TRUE(parser.has_value()) << parser.error().message;
+
+    ASSERT_EQ(*parser->Parse("1 + 2 * 3", kV2), 7.0);
+    ASSERT_FALSE(parser->Parse("1 + 2 * 3", kV1).has_value());
+
+    ASSERT_EQ(*parser->Parse("1 2 + 3", kV1), 15.0);
+    ASSERT_FALSE(parser->Parse("1 2 + 3", kV2).has_value());
+
+    ASSERT_EQ(*parser->Parse("4 + 5"), 9.0);
+
+    // Every entry point parses in the dialect it is given.
+    auto until = parser->ParseUntil("1 * 2 + 3", value, kV2);
+    ASSERT_TRUE(until.has_value()) << until.error().message;
+    ASSERT_FALSE(parser->ParseUntil("1 * 2 + 3", value, kV1).has_value());
+
+    ASSERT_TRUE(parser->ParsePrefix("1 * 2 +", nullptr, kV2).has_value());
+    ASSERT_FALSE(parser->ParsePrefix("1 * 2 +", nullptr, kV1).has_value());
+
+    std::string_view segments[] = { "1 2", " + 3" };
+    ASSERT_EQ(*parser->Parse(std::span<std::string_view const>(segments), kV1), 15.0);
+    ASSERT_FALSE(parser->Parse(std::span<std::string_view const>(segments), kV2).has_value());
+}
+
+TEST(Parser, HotSwap)
+{
+    bf::VersionedParser<bf::SLRParser<G>> handle(*bf::SLRParser<G>::Build(statement), 4);
+
+    auto pinned = handle.Read();
+    ASSERT_EQ(pinned.Number(), 1);
+
+    ASSERT_EQ(BuildAndPublish(handle, [] { return bf::SLRParser<G>::Build(statement, { .renumber_states = false }); }).get(), 2);
+
+    // The pinned version survives the publish, new readers get the new one.
+    ASSERT_EQ(handle.Reclaim(), 1);
+    ASSERT_EQ(*pinned->Parse("1 + 2"), 3.0);
+    ASSERT_EQ(handle.Read().Number(), 2);
+
+    // Releasing the last reader of the old version destroys it.
+    { auto released = std::move(pinned); }
+    ASSERT_EQ(handle.Retired(), 0);
+
+    // Readers on several threads while versions are swapped.
+    std::atomic<bool> failed = false;
+    std::vector<std::jthread> readers;
+    for(int i = 0; i < 4; i++)
+    {
+        readers.emplace_back([&]
+        {
+            for(int k = 0; k < 200; k++)
+            {
+                auto parser = handle.Read();
+                if(parser->Parse("2 * (3 + 4)") != 14.0) failed = true;
+            }
+        });
+    }
+
+    for(int k = 0; k < 20; k++)
+    {
+        handle.Publish(*bf::SLRParser<G>::Build(statement));
+    }
+
+    readers.clear();
+    ASSERT_FALSE(failed);
+    ASSERT_EQ(handle.Retired(), 0);
+}